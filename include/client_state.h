@@ -2,10 +2,14 @@
 #define CLIENT_STATE_H
 
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GLES2/gl2.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <wayland-client.h>
 #include <wayland-egl.h>
+#include <xkbcommon/xkbcommon-compose.h>
 #include <xkbcommon/xkbcommon.h>
 
 // Structure for storing output-related information
@@ -23,35 +27,370 @@ typedef struct
   float x, y, u, v;
 } Vertex;
 
+// Decoded RGBA8 image, e.g. the wallpaper before it is uploaded
+struct decoded_image
+{
+  unsigned char* pixels;
+  int            width;
+  int            height;
+};
+
+// Mip levels 1..levels-1 of a decoded image, packed back to back
+struct image_mips
+{
+  unsigned char* data;
+  int            levels; // including the base level
+};
+
+// GPU-compressed image, e.g. the cached ETC2 copy of the wallpaper; all levels back to back
+struct compressed_image
+{
+  unsigned char* data;
+  size_t         size;
+  int            width;
+  int            height;
+  int            levels;
+};
+
+// [bg] effects, baked into the wallpaper once (see wallpaper.h)
+struct bg_effects
+{
+  int   blur_radius; // in wallpaper pixels, 0 = off
+  float dim;         // 0..1, darken towards black
+  float vignette;    // 0..1, darken towards the corners
+  float desaturate;  // 0..1, fade towards greyscale
+};
+
+// Where the lock screen background comes from ([bg] mode)
+enum bg_mode
+{
+  BG_MODE_IMAGE,      // the wallpaper at [bg] path
+  BG_MODE_SCREENSHOT, // a blurred capture of the desktop, the wallpaper is the fallback
+};
+
+// How finished frames reach the screen ([display] present_mode, see frame_pacing.h)
+enum present_mode
+{
+  PRESENT_MODE_MAILBOX,   // swap interval 0, one frame per frame callback, never blocks
+  PRESENT_MODE_FIFO,      // swap interval 1, one frame per frame callback
+  PRESENT_MODE_IMMEDIATE, // swap interval 0, frames go out as fast as they are drawn
+};
+
+// Output contents copied through wlr-screencopy into a wl_shm buffer (see screencopy_handle.h)
+struct screen_capture
+{
+  void*             data; // mapping of the shm buffer, NULL until a capture succeeded
+  size_t            size;
+  int               width;
+  int               height;
+  int               stride;
+  uint32_t          format; // wl_shm format
+  bool              y_invert;
+  bool              done; // ready or failed arrived
+  struct wl_buffer* buffer;
+};
+
+#define DAMAGE_MAX_RECTS 8
+#define DAMAGE_HISTORY   4 // buffer ages beyond this are repainted in full
+
+// Buffer pixels, origin top left, x1 / y1 exclusive
+struct damage_rect
+{
+  int x0, y0, x1, y1;
+};
+
+// Disjoint rectangles, or the whole buffer
+struct damage_region
+{
+  bool               full;
+  int                count;
+  struct damage_rect rects[DAMAGE_MAX_RECTS];
+};
+
+// On-screen PIN keypad, shown while the seat has a touchscreen (see keypad.h)
+#define KEYPAD_KEYS 12
+
+struct keypad_key
+{
+  struct damage_rect rect; // surface pixels
+  const char*        label;
+  char               input; // the digit it types, KEYPAD_BACKSPACE or KEYPAD_ENTER
+};
+
+struct keypad_layout
+{
+  int                width, height; // surface it was laid out for
+  struct damage_rect bounds;
+  struct keypad_key  keys[KEYPAD_KEYS];
+};
+
+// What changed on screen since the last frame, and in the frames before it (see damage.h)
+struct damage_tracker
+{
+  int                  width;
+  int                  height;
+  struct damage_region pending;                 // reported by the UI elements for the next frame
+  struct damage_region repaint;                 // pending plus what the reused buffer missed
+  struct damage_region history[DAMAGE_HISTORY]; // [0] is the last frame
+  int                  field_dots;              // password field as last drawn
+  int                  field_border;
+  int                  pointer_hover;      // hovered pointer region as last drawn, 0 if none
+  struct damage_rect   pointer_hover_rect; // and where it is
+  struct keypad_layout keypad;             // at the buffer size
+  bool                 keypad_visible;     // keypad as last drawn
+  int                  keypad_pressed;
+};
+
+// One wl_shm buffer of the software renderer, busy from attach until the compositor releases it
+struct soft_buffer
+{
+  struct wl_buffer* wl_buffer;
+  uint32_t*         pixels;
+  bool              busy;
+  int               age; // frames since its contents were on screen, 0 = never drawn
+};
+
+// Text rendering, see text_layout.h
+#define TEXT_SUBPIXEL_BINS    4 // horizontal pen offsets a glyph is rasterised at, in 1/4 px
+#define TEXT_ATLAS_WIDTH      512
+#define TEXT_ATLAS_HEIGHT     256
+#define TEXT_ATLAS_PAD        2 // empty texels around glyphs, so linear filtering never bleeds
+#define TEXT_ATLAS_MAX_GLYPHS 256
+#define TEXT_GLYPH_HASH_SIZE  512 // power of two, at most half full
+#define TEXT_RUN_MAX_GLYPHS   32
+#define TEXT_RUN_MAX_BYTES    128 // UTF-8
+#define TEXT_RUN_CACHE_SIZE   16 // the KEYPAD_KEYS pinned labels, the rest for clock strings
+
+// The clock only ever shows these, at every subpixel offset they are rasterised by the font task
+#define CLOCK_CHARS "0123456789: "
+
+// One glyph at one subpixel offset, rasterised into the atlas
+struct text_glyph
+{
+  uint32_t codepoint;
+  int      bin;   // pen offset it was rasterised at, in 1/TEXT_SUBPIXEL_BINS px
+  int      index; // FreeType glyph index, for kerning
+  int      x, y;  // top left in the atlas
+  int      width, rows;
+  int      left, top; // bitmap offset from the pen position on the baseline
+  int      advance;   // unhinted, 26.6
+};
+
+struct text_atlas
+{
+  unsigned char*    mask; // TEXT_ATLAS_WIDTH x TEXT_ATLAS_HEIGHT coverage, NULL until built
+  int               ascent, descent; // font wide, in px
+  int               shelf_x, shelf_y, shelf_rows;
+  int               count;
+  uint32_t          generation; // bumped whenever glyphs are added, GL uploads again
+  struct text_glyph glyphs[TEXT_ATLAS_MAX_GLYPHS];
+  int16_t           lookup[TEXT_GLYPH_HASH_SIZE]; // (codepoint, bin) -> glyph index + 1, 0 if free
+};
+
+// A glyph placed in a run, relative to the run's top left
+struct text_cell
+{
+  int glyph; // index into the atlas
+  int x, y;
+};
+
+// A laid out string, cached by its hash
+struct text_run
+{
+  uint64_t         hash;
+  char             text[TEXT_RUN_MAX_BYTES];
+  int              count;
+  int              width, height; // ascent + descent
+  uint32_t         last_use;      // text_run_cache.uses when it was last laid out or found
+  bool             pinned;        // a fixed string (keypad label), never evicted
+  struct text_cell cells[TEXT_RUN_MAX_GLYPHS];
+};
+
+// Least recently used runs are replaced once full, pinned ones never are
+struct text_run_cache
+{
+  struct text_run runs[TEXT_RUN_CACHE_SIZE];
+  int             used;
+  uint32_t        uses; // lookups so far, the clock runs are aged by it
+};
+
+// The clock on the GPU: the glyph atlas as a texture and one quad per character
+struct gl_clock
+{
+  GLuint   texture;
+  uint32_t generation; // of the atlas in `texture`
+  GLuint   vbo;        // TEXT_RUN_MAX_GLYPHS quads, only the ones that changed are rewritten
+  GLuint   ibo;
+  int      count;
+  char     text[16];
+  Vertex   quads[TEXT_RUN_MAX_GLYPHS * 4];
+};
+
+// Keys and labels of the PIN keypad, drawn with the clock's index buffer and atlas texture
+struct gl_keypad
+{
+  GLuint   vbo;
+  int      count; // quads in `vbo`, at most TEXT_RUN_MAX_GLYPHS
+  bool     visible;
+  int      pressed;
+  int      width, height;
+  uint32_t generation; // of the atlas the labels were laid out with
+  Vertex   quads[TEXT_RUN_MAX_GLYPHS * 4];
+};
+
+// CPU renderer drawing into wl_shm buffers when EGL is unavailable (see soft_render.h)
+struct soft_renderer
+{
+  bool               active;
+  int                width;
+  int                height;
+  void*              map; // both buffers, back to back
+  size_t             map_size;
+  struct soft_buffer buffers[2];
+  uint32_t*          background; // XRGB8888 at output size, NULL until the wallpaper is in
+  uint32_t*          thumb;      // upscaled thumbnail, crossfaded out once `background` exists
+  unsigned char*     time_mask;  // clock text stretched over the time box
+  int                time_x, time_y, time_w, time_h;
+  char               time_str[16];
+};
+
 typedef struct
 {
-  char*  font_path;
-  char*  bg_name;
-  char*  bg_path;
-  char*  debug_log_enable;
-  char*  time_format;
-  Vertex time_box_vertices[4];
+  char*             font_path;
+  char*             bg_name;
+  char*             bg_path;
+  char*             debug_log_enable;
+  char*             time_format;
+  char*             pam_service; // PAM service file in /etc/pam.d
+  Vertex            time_box_vertices[4];
+  struct bg_effects bg_effects;
+  enum bg_mode      bg_mode;
+  enum present_mode present_mode;
 } TOMLConfig;
 
-// Structure to represent pointer events and their associated state
-struct pointer_axes
+struct keyboard_event
+{
+  uint32_t serial;
+  uint32_t time;
+  uint32_t key;
+  uint32_t state;
+  uint32_t depressed, latched, locked, group;
+};
+
+// The compositor's keymap, compiled on a startup worker the first time (see wl_keyboard_handle.h)
+struct keymap_loader
+{
+  char*              string;  // keymap text, owned by the compile task while it runs
+  uint64_t           hash;    // of the keymap in use or being compiled
+  bool               pending; // compile task still running, keyboard input waits for it
+  struct xkb_keymap* result;  // what the task compiled, NULL if it failed
+};
+
+// Held key that repeats, at the rate and delay the compositor asked for (see wl_keyboard_handle.h)
+struct key_repeat
 {
-  bool       valid;    // Indicates if the axis value is valid
-  wl_fixed_t value;    // Value of the axis (e.g., scroll amount)
-  int32_t    discrete; // Discrete value for axis, if applicable
+  int      timer_fd; // -1 until key_repeat_init() ran, and if it failed
+  int32_t  rate;     // repeats per second, 0 turns repeat off
+  int32_t  delay;    // ms from the press to the first repeat
+  uint32_t keycode;  // xkb keycode being repeated, 0 if none
 };
 
+// Structure to represent pointer events and their associated state
 struct pointer_event
 {
-  uint32_t            event_mask;  // Mask for event type (button press/release, motion, etc.)
-  wl_fixed_t          surface_x;   // X coordinate on the surface
-  wl_fixed_t          surface_y;   // Y coordinate on the surface
-  uint32_t            button;      // Button associated with the event
-  uint32_t            state;       // Button state (pressed/released)
-  uint32_t            time;        // Time of the event
-  uint32_t            serial;      // Serial number for the event
-  struct pointer_axes axes[2];     // Axes information (0 = vertical, 1 = horizontal)
-  uint32_t            axis_source; // Source of the axis event (e.g., finger, wheel)
+  uint32_t   event_mask; // Mask for event type (button press/release, motion, etc.)
+  wl_fixed_t surface_x;  // X coordinate on the surface
+  wl_fixed_t surface_y;  // Y coordinate on the surface
+  uint32_t   button;     // Button associated with the event
+  uint32_t   state;      // Button state (pressed/released)
+  uint32_t   time;       // Time of the event
+  uint32_t   serial;     // Serial number for the event
+};
+
+// Touch points that changed since the last wl_touch.frame (see wl_touch_handle.h)
+#define TOUCH_MAX_POINTS 8
+
+enum touch_point_flags
+{
+  TOUCH_POINT_DOWN   = 1 << 0,
+  TOUCH_POINT_MOTION = 1 << 1,
+  TOUCH_POINT_UP     = 1 << 2,
+};
+
+struct touch_point
+{
+  int32_t    id;
+  wl_fixed_t x, y;
+  uint32_t   flags;
+};
+
+struct touch_event
+{
+  bool               cancel; // the compositor took the touch sequence over
+  int                count;
+  struct touch_point points[TOUCH_MAX_POINTS];
+};
+
+struct touch_state
+{
+  struct touch_event   pending;    // collected until wl_touch.frame
+  struct keypad_layout layout;     // at the lock surface size, for hit testing
+  bool                 seat_touch; // the seat has a touchscreen, the keypad is shown
+  bool                 tracking;   // a finger went down on the keypad and is still on it
+  int32_t              tracking_id;
+  int                  pressed; // keys[pressed - 1] is under that finger, 0 if none
+};
+
+// Something on the lock screen that reacts to the pointer (see wl_pointer_handle.h)
+#define POINTER_MAX_REGIONS 8
+
+struct client_state;
+typedef void (*pointer_region_fn)(struct client_state* state, int id);
+
+struct pointer_region
+{
+  int                id;       // non-zero, picked by whoever adds the region
+  struct damage_rect rect;     // surface pixels
+  pointer_region_fn  activate; // button pressed and released inside, may be NULL
+};
+
+struct pointer_regions
+{
+  int                   count;
+  struct pointer_region regions[POINTER_MAX_REGIONS];
+  bool                  seat_pointer; // the seat has a pointer we could bind
+  int                   hovered;      // id of the region under the pointer, 0 if none
+  struct damage_rect    hovered_rect;
+  int                   pressed;      // id of the region a button went down on, 0 if none
+};
+
+// Input received during one dispatch, applied in order afterwards (see input_queue.h)
+#define INPUT_QUEUE_SIZE 256
+
+enum input_event_type
+{
+  INPUT_EVENT_KEY,            // wl_keyboard.key
+  INPUT_EVENT_MODIFIERS,      // wl_keyboard.modifiers
+  INPUT_EVENT_KEYBOARD_LEAVE, // wl_keyboard.leave
+  INPUT_EVENT_POINTER_FRAME,  // everything up to a wl_pointer.frame
+  INPUT_EVENT_TOUCH_FRAME,    // everything up to a wl_touch.frame, or a wl_touch.cancel
+};
+
+struct input_event
+{
+  enum input_event_type type;
+  union
+  {
+    struct keyboard_event keyboard;
+    struct pointer_event  pointer;
+    struct touch_event    touch;
+  };
+};
+
+struct input_queue
+{
+  int                count;
+  struct input_event events[INPUT_QUEUE_SIZE];
 };
 
 // Structure to handle animation states and timings
@@ -76,6 +415,7 @@ struct session_lock
 {
   bool                                surface_created;
   bool                                surface_dirty;
+  uint32_t                            configures; // each one has to be answered with a commit
   struct ext_session_lock_manager_v1* ext_session_lock_manager;
   struct ext_session_lock_v1*         ext_session_lock;
   struct ext_session_lock_surface_v1* ext_session_lock_surface;
@@ -83,23 +423,64 @@ struct session_lock
 
 struct auth_state
 {
-  bool  auth_success;
-  bool  auth_failed;
-  float fail_effect_intensity;    // Intensity of failure effect (0.0 - 1.0)
-  float success_effect_intensity; // Intensity of success effect (0.0 - 1.0)
+  bool     auth_success;
+  uint64_t fail_until_ns;            // the failed attempt is shown until then (CLOCK_MONOTONIC)
+  float    fail_effect_intensity;    // Intensity of failure effect (0.0 - 1.0)
+  float    success_effect_intensity; // Intensity of success effect (0.0 - 1.0)
 };
 
 // Structure to store PAM-related state and authentication information
+#define PAM_PASSWORD_SIZE   256
+#define PAM_DEFAULT_SERVICE "login" // without a [pam] service in the config
+#define PAM_SERVICE_MAX     64
+
 struct pam_state
 {
   bool              first_enter_press; // Tracks first Enter key press for authentication
   char*             username;          // Stores the username for authentication
-  char              password[256];     // Password buffer
-  int               password_index;    // Current index in the password buffer
+  char*             password;          // PAM_PASSWORD_SIZE bytes in the secure arena, UTF-8 and
+                                       // always NUL terminated (see password_buffer.h)
+  int               password_index;    // Bytes in the password buffer
   bool              locked;            // Locks the session if authentication fails
   struct auth_state auth_state;        // the authentication state of the event loop
 };
 
+// Everything the lock screen shows that comes from input, as of one moment (see render_thread.h)
+struct ui_snapshot
+{
+  int                password_length;
+  bool               auth_failed;
+  char               time_str[16];
+  uint32_t           configures;         // session_lock.configures, a new one asks for a full frame
+  int                pointer_hover;      // pointer_regions.hovered
+  struct damage_rect pointer_hover_rect; // and its rectangle, so the renderer can damage it
+  bool               keypad_visible;     // touch.seat_touch
+  int                keypad_pressed;     // touch.pressed
+  int                width;              // output_state, the size the last configure asked for
+  int                height;
+};
+
+#define UI_MAILBOX_FRESH 4u // set on the middle slot index until the render thread takes it
+
+// Lock-free triple buffer between the event loop and the render thread
+struct ui_mailbox
+{
+  struct ui_snapshot slots[3];
+  _Atomic uint32_t   middle; // last posted slot, or the one the render thread handed back
+  uint32_t           back;   // only touched by the event loop
+  uint32_t           front;  // only touched by the render thread
+};
+
+// Thread that owns the EGL context and draws every frame once init_egl() is done
+struct render_thread
+{
+  pthread_t         thread;
+  bool              running;
+  atomic_bool       stop;
+  int               wake_fd; // eventfd, bumped by every post
+  struct ui_mailbox mailbox;
+};
+
 // Main structure for client state
 struct client_state
 {
@@ -113,6 +494,9 @@ struct client_state
   struct wl_seat*       wl_seat;
   struct wl_output*     wl_output;
 
+  /* Optional Wayland Globals, NULL if the compositor lacks them */
+  struct zwlr_screencopy_manager_v1* screencopy_manager;
+
   /* Wayland Objects */
   struct wl_surface*    wl_surface;
   struct wl_egl_window* egl_window;
@@ -120,6 +504,7 @@ struct client_state
   struct xdg_toplevel*  xdg_toplevel;
   struct wl_keyboard*   wl_keyboard;
   struct wl_pointer*    wl_pointer;
+  struct wl_touch*      wl_touch;
 
   /* Window State */
   int  width, height;
@@ -132,12 +517,22 @@ struct client_state
   char* shaderRuntimeDir;
 
   /* Input and Pointer State */
-  struct pointer_event pointer_event;
+  struct pointer_event   pointer_event;
+  struct pointer_regions pointer_regions;
+  struct touch_state     touch;
+  struct input_queue     input_queue;
 
   /* XKB Keyboard State */
   struct xkb_state*   xkb_state;
   struct xkb_context* xkb_context;
   struct xkb_keymap*  xkb_keymap;
+  struct keymap_loader keymap_loader;
+  struct key_repeat    key_repeat;
+
+  /* XKB Compose State, loaded on the first dead key or Compose press */
+  struct xkb_compose_table* xkb_compose_table;
+  struct xkb_compose_state* xkb_compose_state;
+  bool                      xkb_compose_tried;
 
   /* Animation and Rendering State */
   struct animation_state animation;
@@ -156,12 +551,54 @@ struct client_state
   /* User Configs */
   TOMLConfig global_config;
 
+  /* Wallpaper, decoded by a startup task and uploaded once it is done */
+  struct decoded_image    wallpaper;
+  struct image_mips       wallpaper_mips;
+  struct decoded_image    thumbnail;     // blurred low-res stand-in from the bg cache
+  struct compressed_image wallpaper_etc; // cached ETC2 copy, replaces `wallpaper` when set
+  struct screen_capture   screenshot;    // [bg] mode = "screenshot", replaces the wallpaper
+
+  /* Startup assets streamed into the lock screen (see stream_in_assets) */
+  struct
+  {
+    bool     font_done;      // font task finished and was handled
+    bool     font_ready;     // ... and succeeded, the time box can be drawn
+    bool     thumbnail_done; // thumbnail task finished, thumb_texture is set on a cache hit
+    bool     wallpaper_done; // wallpaper task finished, bg_texture is set if it succeeded
+    bool     reported;
+    uint64_t bg_fade_start_ns; // thumbnail -> wallpaper crossfade start
+  } assets;
+
   /* EGL and GLES State */
-  EGLDisplay egl_display;
-  EGLContext egl_context;
-  EGLSurface egl_surface;
-  EGLConfig  egl_config;
-  GLuint     time_texture;
+  EGLDisplay       egl_display;
+  EGLContext       egl_context;
+  EGLSurface       egl_surface;
+  EGLConfig        egl_config;
+  struct gl_clock  clock;
+  struct gl_keypad keypad;
+  GLuint           bg_texture;
+  GLuint           thumb_texture;
+  GLenum           etc_format; // ETC2/ETC1 internal format the context samples, 0 if none
+  bool             npot_mips;  // mipmapped NPOT textures are complete (GLES3 or OES_texture_npot)
+
+  /* EGL Damage Extensions, a full redraw and plain eglSwapBuffers() without them */
+  bool                               egl_buffer_age;        // EXT_buffer_age or KHR_partial_update
+  PFNEGLSETDAMAGEREGIONKHRPROC       egl_set_damage_region; // KHR_partial_update
+  PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC egl_swap_with_damage;  // KHR or EXT swap_buffers_with_damage
+
+  /* Damage Tracking State, shared by the EGL and software renderers */
+  struct damage_tracker damage;
+
+  /* Frame Pacing State, set while a committed frame waits for its frame callback */
+  _Atomic(struct wl_callback*) frame_callback; // created on the render thread, done on the loop
+  atomic_bool                  frame_pending;
+
+  /* Render Thread State, what it draws is only ever read from `ui` */
+  struct render_thread render;
+  struct ui_snapshot   ui;
+
+  /* Software Rendering State, takes over when EGL cannot be initialized */
+  struct soft_renderer soft;
 
   /* Shader Program State */
   struct
@@ -3,7 +3,9 @@
 
 #include "../../toml/toml.h"
 #include "../client_state.h"
+#include "../global_funcs.h"
 #include "../log.h"
+#include "config_cache.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,7 +15,7 @@
 #define CONFIG_LOAD_FAIL    0
 
 // Global config instance
-static TOMLConfig global_config = {NULL, NULL, NULL, NULL, NULL};
+static TOMLConfig global_config = {0};
 
 // Buffer to hold config file path
 static char _config_path[256];
@@ -57,6 +59,110 @@ static int get_toml_float_array(toml_table_t* table, const char* key, float* x,
   return CONFIG_LOAD_SUCCESS;
 }
 
+// Optional number in [min, max]; ints are accepted too, a missing key gives `fallback`
+static double get_toml_number(toml_table_t* table, const char* key, double fallback, double min,
+                              double max)
+{
+  toml_datum_t datum = toml_double_in(table, key);
+  double       value = datum.u.d;
+  if (!datum.ok)
+  {
+    datum = toml_int_in(table, key);
+    value = (double)datum.u.i;
+  }
+
+  if (!datum.ok)
+  {
+    return fallback;
+  }
+
+  if (value < min || value > max)
+  {
+    log_message(LOG_LEVEL_WARN, "[TOML] Key '%s' out of range [%g, %g], clamping.", key, min,
+                max);
+  }
+  return ANVIL_CLAMP(value, min, max);
+}
+
+// Optional [bg] mode, "image" unless it asks for a screenshot
+static enum bg_mode get_toml_bg_mode(toml_table_t* table)
+{
+  toml_datum_t datum = toml_string_in(table, "mode");
+  enum bg_mode mode  = BG_MODE_IMAGE;
+  if (!datum.ok)
+  {
+    return mode;
+  }
+
+  if (strcmp(datum.u.s, "screenshot") == 0)
+  {
+    mode = BG_MODE_SCREENSHOT;
+  }
+  else if (strcmp(datum.u.s, "image") != 0)
+  {
+    log_message(LOG_LEVEL_WARN, "[TOML] Unknown [bg] mode '%s', using 'image'.", datum.u.s);
+  }
+  free(datum.u.s);
+  return mode;
+}
+
+// Optional [display] present_mode, "mailbox" unless it asks for another one
+static enum present_mode get_toml_present_mode(toml_table_t* table)
+{
+  enum present_mode mode = PRESENT_MODE_MAILBOX;
+  if (!table)
+  {
+    return mode;
+  }
+
+  toml_datum_t datum = toml_string_in(table, "present_mode");
+  if (!datum.ok)
+  {
+    return mode;
+  }
+
+  if (strcmp(datum.u.s, "fifo") == 0)
+  {
+    mode = PRESENT_MODE_FIFO;
+  }
+  else if (strcmp(datum.u.s, "immediate") == 0)
+  {
+    mode = PRESENT_MODE_IMMEDIATE;
+  }
+  else if (strcmp(datum.u.s, "mailbox") != 0)
+  {
+    log_message(LOG_LEVEL_WARN, "[TOML] Unknown [display] present_mode '%s', using 'mailbox'.",
+                datum.u.s);
+  }
+  free(datum.u.s);
+  return mode;
+}
+
+// Optional [pam] service, the PAM stack to authenticate with, "login" unless it names another
+static char* get_toml_pam_service(toml_table_t* table)
+{
+  if (!table)
+  {
+    return strdup(PAM_DEFAULT_SERVICE);
+  }
+
+  toml_datum_t datum = toml_string_in(table, "service");
+  if (!datum.ok)
+  {
+    return strdup(PAM_DEFAULT_SERVICE);
+  }
+
+  // A service is a file name in /etc/pam.d, never a path
+  if (!*datum.u.s || strchr(datum.u.s, '/') || strlen(datum.u.s) >= PAM_SERVICE_MAX)
+  {
+    log_message(LOG_LEVEL_WARN, "[TOML] Invalid [pam] service '%s', using '%s'.", datum.u.s,
+                PAM_DEFAULT_SERVICE);
+    free(datum.u.s);
+    return strdup(PAM_DEFAULT_SERVICE);
+  }
+  return datum.u.s;
+}
+
 // Helper function to read a string from a TOML table
 static char* get_toml_string(toml_table_t* table, const char* key)
 {
@@ -78,20 +184,20 @@ static int load_config(void)
     return CONFIG_LOAD_FAIL;
   }
 
-  FILE* config_file = fopen(config_path, "r");
-  if (!config_file)
+  // Fast path: a compiled config that is still in sync with config.toml
+  if (config_cache_load(config_path, &global_config))
   {
-    log_message(LOG_LEVEL_ERROR, "[TOML] Failed to open config file: %s", config_path);
-    return CONFIG_LOAD_FAIL;
+    return CONFIG_LOAD_SUCCESS;
   }
 
+  // Map the file and parse it in place; values are only copied out when we
+  // convert them below, which keeps reparsing (e.g. on reload) cheap.
   char          errbuf[200];
-  toml_table_t* root = toml_parse_file(config_file, errbuf, sizeof(errbuf));
-  fclose(config_file);
+  toml_table_t* root = toml_parse_mmap(config_path, errbuf, sizeof(errbuf));
 
   if (!root)
   {
-    log_message(LOG_LEVEL_ERROR, "[TOML] Parsing failed: %s", errbuf);
+    log_message(LOG_LEVEL_ERROR, "[TOML] Failed to load config file %s: %s", config_path, errbuf);
     return CONFIG_LOAD_FAIL;
   }
 
@@ -101,6 +207,8 @@ static int load_config(void)
   toml_table_t* time_format_table = toml_table_in(root, "time");
   toml_table_t* debug_table       = toml_table_in(root, "debug");
   toml_table_t* time_box_table    = toml_table_in(root, "time_box");
+  toml_table_t* display_table     = toml_table_in(root, "display"); // optional
+  toml_table_t* pam_table         = toml_table_in(root, "pam");     // optional
 
   if (!font_table || !bg_table || !time_format_table || !debug_table)
   {
@@ -116,6 +224,19 @@ static int load_config(void)
   global_config.time_format      = get_toml_string(time_format_table, "time_format");
   global_config.debug_log_enable = get_toml_string(debug_table, "debug_log_enable");
 
+  // Background source and effects, all optional
+  global_config.bg_mode                = get_toml_bg_mode(bg_table);
+  global_config.bg_effects.blur_radius = (int)get_toml_number(bg_table, "blur_radius", 0, 0, 256);
+  global_config.bg_effects.dim         = (float)get_toml_number(bg_table, "dim", 0, 0, 1);
+  global_config.bg_effects.vignette    = (float)get_toml_number(bg_table, "vignette", 0, 0, 1);
+  global_config.bg_effects.desaturate  = (float)get_toml_number(bg_table, "desaturate", 0, 0, 1);
+
+  // How frames are presented, optional
+  global_config.present_mode = get_toml_present_mode(display_table);
+
+  // Which PAM stack unlocks, optional
+  global_config.pam_service = get_toml_pam_service(pam_table);
+
   float texcoords[4][2] = {
     {0.0f, 0.0f}, // Top left
     {1.0f, 0.0f}, // Top right
@@ -139,6 +260,9 @@ static int load_config(void)
   }
 
   toml_free(root);
+
+  // Compile what we just parsed so the next lock can skip all of the above
+  config_cache_store(config_path, &global_config);
   return CONFIG_LOAD_SUCCESS;
 }
 
@@ -148,11 +272,19 @@ static const TOMLConfig* get_config(void) { return &global_config; }
 // Free dynamically allocated strings
 static void free_config(void)
 {
+  // Strings served from the compiled cache live in its mapping
+  if (config_cache_release())
+  {
+    memset(&global_config, 0, sizeof(TOMLConfig));
+    return;
+  }
+
   free(global_config.font_path);
   free(global_config.bg_name);
   free(global_config.bg_path);
   free(global_config.debug_log_enable);
   free(global_config.time_format);
+  free(global_config.pam_service);
 
   memset(&global_config, 0, sizeof(TOMLConfig));
 }
@@ -0,0 +1,435 @@
+#ifndef CONFIG_CACHE_H
+#define CONFIG_CACHE_H
+
+#include "../client_state.h"
+#include "../global_funcs.h"
+#include "../log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * @COMPILED CONFIG CACHE:
+ *
+ * Parsing config.toml on every lock costs a parse, a pile of small allocations
+ * and a strdup per value. Instead, the first time a given config.toml is loaded
+ * the validated TOMLConfig is flattened into a blob under
+ * $XDG_CACHE_HOME/anvilock/ (or ~/.cache/anvilock/):
+ *
+ *   [ config_cache_header | string table ]
+ *
+ * Strings are stored as offsets into the string table and paths are already
+ * resolved to absolute ones. Later locks mmap the blob and point the TOMLConfig
+ * members straight into the mapping, so there is no parsing at all.
+ *
+ * The blob is rebuilt whenever config.toml's size or mtime changes and its
+ * content hash differs from the one recorded in the header. Bump
+ * CONFIG_CACHE_VERSION whenever the layout or TOMLConfig changes.
+ *
+ */
+
+#define CONFIG_CACHE_MAGIC   0x43564E41u // "ANVC"
+#define CONFIG_CACHE_VERSION 5u
+#define CONFIG_CACHE_FILE    "config.bin"
+
+enum config_cache_str
+{
+  CONFIG_CACHE_STR_FONT_PATH,
+  CONFIG_CACHE_STR_BG_NAME,
+  CONFIG_CACHE_STR_BG_PATH,
+  CONFIG_CACHE_STR_DEBUG_LOG_ENABLE,
+  CONFIG_CACHE_STR_TIME_FORMAT,
+  CONFIG_CACHE_STR_PAM_SERVICE,
+  CONFIG_CACHE_STR_COUNT
+};
+
+struct config_cache_header
+{
+  uint32_t          magic;
+  uint32_t          version;
+  uint32_t          total_size; // header + string table
+  uint32_t          str_off[CONFIG_CACHE_STR_COUNT];
+  int64_t           src_mtime_sec;
+  int64_t           src_mtime_nsec;
+  uint64_t          src_size;
+  uint64_t          src_hash;
+  Vertex            time_box_vertices[4];
+  struct bg_effects bg_effects;
+  int32_t           bg_mode;
+  int32_t           present_mode;
+};
+
+// The live mapping, if the current config was served from the cache
+static void*  config_cache_map    = NULL;
+static size_t config_cache_map_sz = 0;
+
+static void config_cache_fields(TOMLConfig* config, char** fields[CONFIG_CACHE_STR_COUNT])
+{
+  fields[CONFIG_CACHE_STR_FONT_PATH]        = &config->font_path;
+  fields[CONFIG_CACHE_STR_BG_NAME]          = &config->bg_name;
+  fields[CONFIG_CACHE_STR_BG_PATH]          = &config->bg_path;
+  fields[CONFIG_CACHE_STR_DEBUG_LOG_ENABLE] = &config->debug_log_enable;
+  fields[CONFIG_CACHE_STR_TIME_FORMAT]      = &config->time_format;
+  fields[CONFIG_CACHE_STR_PAM_SERVICE]      = &config->pam_service;
+}
+
+// Returns $XDG_CACHE_HOME/anvilock (or ~/.cache/anvilock), creating it if asked to
+static int config_cache_dir(char* buf, size_t size, bool create)
+{
+  const char* xdg_cache = getenv("XDG_CACHE_HOME");
+  int         len;
+
+  if (xdg_cache && *xdg_cache == '/')
+  {
+    len = snprintf(buf, size, "%s/anvilock", xdg_cache);
+  }
+  else
+  {
+    len = snprintf(buf, size, "%s/.cache/anvilock", ANVIL_GET_HOME_DIR());
+  }
+
+  if (len < 0 || (size_t)len >= size)
+  {
+    return -1;
+  }
+
+  if (create)
+  {
+    // mkdir -p for the last two components is all we ever need
+    char* slash = strrchr(buf, '/');
+    *slash      = '\0';
+    mkdir(buf, 0700);
+    *slash = '/';
+    if (mkdir(buf, 0700) != 0 && errno != EEXIST)
+    {
+      log_message(LOG_LEVEL_WARN, "[CONFIG CACHE] Unable to create cache dir %s: %s", buf,
+                  strerror(errno));
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static int config_cache_path(char* buf, size_t size, bool create)
+{
+  char dir[PATH_MAX];
+  if (config_cache_dir(dir, sizeof(dir), create) != 0)
+  {
+    return -1;
+  }
+
+  int len = snprintf(buf, size, "%s/%s", dir, CONFIG_CACHE_FILE);
+  return (len < 0 || (size_t)len >= size) ? -1 : 0;
+}
+
+// Hash config.toml's content so a touched-but-unchanged file keeps its cache
+static bool config_cache_hash_file(const char* path, uint64_t* hash)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  if (st.st_size == 0)
+  {
+    close(fd);
+    *hash = anvil_hash64(NULL, 0);
+    return true;
+  }
+
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+  {
+    return false;
+  }
+
+  *hash = anvil_hash64(data, st.st_size);
+  munmap(data, st.st_size);
+  return true;
+}
+
+// Sanity check a mapped blob before pointing anything into it
+static bool config_cache_validate(const struct config_cache_header* hdr, size_t size)
+{
+  if (size < sizeof(*hdr) || hdr->magic != CONFIG_CACHE_MAGIC ||
+      hdr->version != CONFIG_CACHE_VERSION || hdr->total_size != size)
+  {
+    return false;
+  }
+
+  const char* base = (const char*)hdr;
+  for (int i = 0; i < CONFIG_CACHE_STR_COUNT; i++)
+  {
+    uint32_t off = hdr->str_off[i];
+    if (off == 0)
+    {
+      continue; // NULL field
+    }
+    if (off < sizeof(*hdr) || off >= size || !memchr(base + off, '\0', size - off))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/*
+ * [bg] mode as of the last cached config, without mapping or parsing anything.
+ * Not checked against config.toml, so it can be one edit behind; false if
+ * there is no cache blob at all.
+ */
+static bool config_cache_peek_bg_mode(int* out_mode)
+{
+  char cache_path[PATH_MAX];
+  if (config_cache_path(cache_path, sizeof(cache_path), false) != 0)
+  {
+    return false;
+  }
+
+  int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return false;
+  }
+  struct config_cache_header hdr;
+  bool ok = pread(fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) &&
+            hdr.magic == CONFIG_CACHE_MAGIC && hdr.version == CONFIG_CACHE_VERSION;
+  close(fd);
+
+  if (ok)
+  {
+    *out_mode = hdr.bg_mode;
+  }
+  return ok;
+}
+
+static void config_cache_store(const char* config_path, const TOMLConfig* config);
+
+/*
+ * Try to serve `config` straight from the cache blob.
+ *
+ * On success every string member of `config` points into a read-only mapping
+ * that stays alive until config_cache_release(). Must not be free()'d.
+ */
+static bool config_cache_load(const char* config_path, TOMLConfig* config)
+{
+  // Already mapped by an earlier load_config(); `config` still points into it
+  if (config_cache_map)
+  {
+    return true;
+  }
+
+  struct stat src_st;
+  if (stat(config_path, &src_st) != 0)
+  {
+    return false;
+  }
+
+  char cache_path[PATH_MAX];
+  if (config_cache_path(cache_path, sizeof(cache_path), false) != 0)
+  {
+    return false;
+  }
+
+  int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct config_cache_header))
+  {
+    close(fd);
+    return false;
+  }
+
+  void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    return false;
+  }
+
+  const struct config_cache_header* hdr = map;
+  if (!config_cache_validate(hdr, st.st_size))
+  {
+    log_message(LOG_LEVEL_WARN, "[CONFIG CACHE] Ignoring invalid cache blob %s", cache_path);
+    munmap(map, st.st_size);
+    return false;
+  }
+
+  bool fresh = hdr->src_size == (uint64_t)src_st.st_size &&
+               hdr->src_mtime_sec == (int64_t)src_st.st_mtim.tv_sec &&
+               hdr->src_mtime_nsec == (int64_t)src_st.st_mtim.tv_nsec;
+  if (!fresh)
+  {
+    // mtime moved; only rebuild if the content actually changed
+    uint64_t hash;
+    if (!config_cache_hash_file(config_path, &hash) || hash != hdr->src_hash)
+    {
+      log_message(LOG_LEVEL_DEBUG, "[CONFIG CACHE] %s changed, cache is stale.", config_path);
+      munmap(map, st.st_size);
+      return false;
+    }
+  }
+
+  char** fields[CONFIG_CACHE_STR_COUNT];
+  config_cache_fields(config, fields);
+  for (int i = 0; i < CONFIG_CACHE_STR_COUNT; i++)
+  {
+    *fields[i] = hdr->str_off[i] ? (char*)map + hdr->str_off[i] : NULL;
+  }
+  memcpy(config->time_box_vertices, hdr->time_box_vertices, sizeof(hdr->time_box_vertices));
+  config->bg_effects   = hdr->bg_effects;
+  config->bg_mode      = hdr->bg_mode;
+  config->present_mode = hdr->present_mode;
+
+  config_cache_map    = map;
+  config_cache_map_sz = st.st_size;
+
+  // Content was unchanged, refresh the recorded mtime so we skip hashing next time
+  if (!fresh)
+  {
+    config_cache_store(config_path, config);
+  }
+
+  log_message(LOG_LEVEL_INFO, "[CONFIG CACHE] Loaded compiled config from %s", cache_path);
+  return true;
+}
+
+/*
+ * Flatten a freshly parsed and validated `config` into the cache blob.
+ * Paths are resolved to absolute ones on the way in. Failures are not fatal,
+ * we simply parse again next time.
+ */
+static void config_cache_store(const char* config_path, const TOMLConfig* config)
+{
+  struct stat src_st;
+  uint64_t    src_hash;
+  if (stat(config_path, &src_st) != 0 || !config_cache_hash_file(config_path, &src_hash))
+  {
+    return;
+  }
+
+  char cache_path[PATH_MAX];
+  if (config_cache_path(cache_path, sizeof(cache_path), true) != 0)
+  {
+    return;
+  }
+
+  struct config_cache_header hdr = {0};
+  hdr.magic                      = CONFIG_CACHE_MAGIC;
+  hdr.version                    = CONFIG_CACHE_VERSION;
+  hdr.src_mtime_sec              = src_st.st_mtim.tv_sec;
+  hdr.src_mtime_nsec             = src_st.st_mtim.tv_nsec;
+  hdr.src_size                   = src_st.st_size;
+  hdr.src_hash                   = src_hash;
+  memcpy(hdr.time_box_vertices, config->time_box_vertices, sizeof(hdr.time_box_vertices));
+  hdr.bg_effects   = config->bg_effects;
+  hdr.bg_mode      = config->bg_mode;
+  hdr.present_mode = config->present_mode;
+
+  // Resolve paths and lay out the string table
+  char        resolved[2][PATH_MAX];
+  const char* strs[CONFIG_CACHE_STR_COUNT] = {
+    [CONFIG_CACHE_STR_FONT_PATH]        = config->font_path,
+    [CONFIG_CACHE_STR_BG_NAME]          = config->bg_name,
+    [CONFIG_CACHE_STR_BG_PATH]          = config->bg_path,
+    [CONFIG_CACHE_STR_DEBUG_LOG_ENABLE] = config->debug_log_enable,
+    [CONFIG_CACHE_STR_TIME_FORMAT]      = config->time_format,
+    [CONFIG_CACHE_STR_PAM_SERVICE]      = config->pam_service,
+  };
+  if (strs[CONFIG_CACHE_STR_FONT_PATH] && realpath(strs[CONFIG_CACHE_STR_FONT_PATH], resolved[0]))
+  {
+    strs[CONFIG_CACHE_STR_FONT_PATH] = resolved[0];
+  }
+  if (strs[CONFIG_CACHE_STR_BG_PATH] && realpath(strs[CONFIG_CACHE_STR_BG_PATH], resolved[1]))
+  {
+    strs[CONFIG_CACHE_STR_BG_PATH] = resolved[1];
+  }
+
+  size_t total = sizeof(hdr);
+  for (int i = 0; i < CONFIG_CACHE_STR_COUNT; i++)
+  {
+    if (strs[i])
+    {
+      hdr.str_off[i] = total;
+      total += strlen(strs[i]) + 1;
+    }
+  }
+  hdr.total_size = total;
+
+  char tmp_path[PATH_MAX + 8];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", cache_path);
+  int fd = mkstemp(tmp_path);
+  if (fd < 0)
+  {
+    log_message(LOG_LEVEL_WARN, "[CONFIG CACHE] Unable to write %s: %s", cache_path,
+                strerror(errno));
+    return;
+  }
+
+  FILE* out = fdopen(fd, "wb");
+  if (!out)
+  {
+    close(fd);
+    unlink(tmp_path);
+    return;
+  }
+
+  bool ok = fwrite(&hdr, sizeof(hdr), 1, out) == 1;
+  for (int i = 0; ok && i < CONFIG_CACHE_STR_COUNT; i++)
+  {
+    if (strs[i])
+    {
+      ok = fwrite(strs[i], strlen(strs[i]) + 1, 1, out) == 1;
+    }
+  }
+  ok = (fclose(out) == 0) && ok;
+
+  // Atomically replace so a concurrent lock never maps a half written blob
+  if (!ok || rename(tmp_path, cache_path) != 0)
+  {
+    log_message(LOG_LEVEL_WARN, "[CONFIG CACHE] Unable to write %s", cache_path);
+    unlink(tmp_path);
+    return;
+  }
+
+  log_message(LOG_LEVEL_DEBUG, "[CONFIG CACHE] Compiled %s into %s", config_path, cache_path);
+}
+
+// Drop the mapping backing a cached config (the TOMLConfig strings die with it)
+static bool config_cache_release(void)
+{
+  if (!config_cache_map)
+  {
+    return false;
+  }
+
+  munmap(config_cache_map, config_cache_map_sz);
+  config_cache_map    = NULL;
+  config_cache_map_sz = 0;
+  return true;
+}
+
+#endif // CONFIG_CACHE_H
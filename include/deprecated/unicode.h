@@ -1,6 +1,7 @@
 #ifndef UNICODE_H
 #define UNICODE_H
 
+#include "../utf8.h"
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
@@ -17,23 +18,7 @@
 #define CHAR_HEIGHT 20 // Height of characters
 #define CHAR_WIDTH  10 // Width of characters
 
-// UTF-8 Utility Functions
-
-int utf8_last_size(const char* str)
-{
-  int   len = 0;
-  char* pos = strchr(str, '\0');
-  while (pos > str)
-  {
-    --pos;
-    ++len;
-    if ((*pos & 0xc0) != 0x80)
-    {
-      return len;
-    }
-  }
-  return 0;
-}
+// UTF-8 Utility Functions (decode, last_size and strlen live in utf8.h now)
 
 size_t utf8_chsize(uint32_t ch)
 {
@@ -88,58 +73,6 @@ size_t utf8_encode(char* str, uint32_t ch)
   return len;
 }
 
-uint32_t utf8_decode(const char** s)
-{
-  const unsigned char* p     = (const unsigned char*)*s;
-  uint32_t             ch    = 0;
-  int                  extra = 0;
-
-  if (*p < 0x80)
-  {
-    ch    = *p;
-    extra = 0;
-  }
-  else if ((*p & 0xE0) == 0xC0)
-  {
-    ch    = *p & 0x1F;
-    extra = 1;
-  }
-  else if ((*p & 0xF0) == 0xE0)
-  {
-    ch    = *p & 0x0F;
-    extra = 2;
-  }
-  else if ((*p & 0xF8) == 0xF0)
-  {
-    ch    = *p & 0x07;
-    extra = 3;
-  }
-  else
-  {
-    *s += 1;
-    return '?'; // Invalid UTF-8 sequence, return a placeholder
-  }
-
-  *s += 1;
-  while (extra-- > 0)
-  {
-    ch = (ch << 6) | (*(*s)++ & 0x3F);
-  }
-
-  return ch;
-}
-
-int utf8_strlen(const char* s)
-{
-  int count = 0;
-  while (*s)
-  {
-    utf8_decode(&s); // Advance by one UTF-8 character
-    count++;
-  }
-  return count;
-}
-
 static const struct
 {
   uint8_t mask;
@@ -3,6 +3,7 @@
 
 #include "../config/config.h"
 #include "../log.h"
+#include "../memory/anvil_mem.h"
 #include <ft2build.h>
 #include FT_FREETYPE_H
 
@@ -13,11 +14,12 @@
 FT_Library ft_library;
 FT_Face    ft_face;
 
-static int init_freetype(void)
+// Expects the config to be loaded already (runs as a startup task, see startup.h)
+static int init_freetype(const char* font_path)
 {
-  if (!load_config())
+  if (!font_path)
   {
-    log_message(LOG_LEVEL_ERROR, "Failed to load config file");
+    log_message(LOG_LEVEL_ERROR, "Font path not found in config");
     return 0;
   }
 
@@ -28,7 +30,7 @@ static int init_freetype(void)
     return 0;
   }
 
-  error = FT_New_Face(ft_library, global_config.font_path, 0, &ft_face);
+  error = FT_New_Face(ft_library, font_path, 0, &ft_face);
   if (error)
   {
     log_message(LOG_LEVEL_ERROR, "Failed to load font");
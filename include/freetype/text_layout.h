@@ -0,0 +1,389 @@
+#ifndef TEXT_LAYOUT_H
+#define TEXT_LAYOUT_H
+
+#include "../client_state.h"
+#include "../global_funcs.h"
+#include "../log.h"
+#include "../memory/anvil_mem.h"
+#include "../utf8.h"
+#include "freetype.h"
+#include <ft2build.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include FT_FREETYPE_H
+
+/*
+ * @TEXT LAYOUT:
+ *
+ * Strings are laid out once and cached by hash (text_layout()). The pen
+ * moves in 26.6 fixed point by the unhinted advance of each glyph plus the
+ * kerning with the one before it, so proportional fonts keep their spacing.
+ *
+ * Each glyph is rasterised into a shared atlas at the pen's fractional
+ * position, snapped to one of TEXT_SUBPIXEL_BINS offsets, so an "1" that
+ * lands at x = 10.25 is drawn from a bitmap rendered a quarter pixel to the
+ * right instead of being rounded to 10. A codepoint at a given offset is only
+ * ever rasterised once and found again through a small hash table, whatever
+ * script it is from; the font task rasterises every glyph the clock uses up
+ * front, so no frame ever waits on FreeType.
+ *
+ *   "12:34" -> hash -> cached run? -> cells (atlas glyph, x, y)
+ *                             \-> pen + kerning -> bin -> atlas glyph (rasterised on a miss)
+ *
+ * Renderers only see runs: GL draws one quad per cell out of the atlas
+ * texture, the software renderer composes the cells into a mask.
+ *
+ */
+
+// Glyphs of the lock screen, built by the font task
+static struct text_atlas     glyph_atlas;
+static struct text_run_cache text_runs;
+
+static bool text_atlas_init(struct text_atlas* atlas)
+{
+  memset(atlas, 0, sizeof(*atlas));
+  ANVIL_SAFE_CALLOC(atlas->mask, unsigned char, TEXT_ATLAS_WIDTH* TEXT_ATLAS_HEIGHT);
+  if (!atlas->mask)
+  {
+    return false;
+  }
+
+  FT_Size_Metrics* metrics = &ft_face->size->metrics;
+  atlas->ascent            = (int)((metrics->ascender + 63) >> 6);
+  atlas->descent           = (int)((-metrics->descender + 63) >> 6);
+  atlas->shelf_x           = TEXT_ATLAS_PAD;
+  atlas->shelf_y           = TEXT_ATLAS_PAD;
+  return true;
+}
+
+static void text_atlas_free(struct text_atlas* atlas)
+{
+  ANVIL_SAFE_FREE(atlas->mask);
+}
+
+// Slot of (codepoint, bin) in atlas->lookup: where it is, or the free slot it would go to
+static int text_atlas_slot(const struct text_atlas* atlas, uint32_t codepoint, int bin)
+{
+  uint32_t slot = (codepoint * TEXT_SUBPIXEL_BINS + (uint32_t)bin) * 2654435761u;
+  for (;; slot++)
+  {
+    slot &= TEXT_GLYPH_HASH_SIZE - 1;
+    int index = atlas->lookup[slot] - 1;
+    if (index < 0 ||
+        (atlas->glyphs[index].codepoint == codepoint && atlas->glyphs[index].bin == bin))
+    {
+      return (int)slot;
+    }
+  }
+}
+
+// Shelf packing: left to right, a new shelf below once a row is full. False once it is full.
+static bool text_atlas_place(struct text_atlas* atlas, int width, int rows, int* out_x, int* out_y)
+{
+  if (atlas->shelf_x + width + TEXT_ATLAS_PAD > TEXT_ATLAS_WIDTH)
+  {
+    atlas->shelf_x    = TEXT_ATLAS_PAD;
+    atlas->shelf_y   += atlas->shelf_rows + TEXT_ATLAS_PAD;
+    atlas->shelf_rows = 0;
+  }
+  if (atlas->shelf_y + rows + TEXT_ATLAS_PAD > TEXT_ATLAS_HEIGHT)
+  {
+    return false;
+  }
+
+  *out_x             = atlas->shelf_x;
+  *out_y             = atlas->shelf_y;
+  atlas->shelf_x    += width + TEXT_ATLAS_PAD;
+  atlas->shelf_rows  = ANVIL_MAX(atlas->shelf_rows, rows);
+  return true;
+}
+
+// Atlas index of `codepoint` rasterised at pen offset `bin`, -1 if it cannot be had
+static int text_atlas_glyph(struct text_atlas* atlas, uint32_t codepoint, int bin)
+{
+  int entry = text_atlas_slot(atlas, codepoint, bin);
+  if (atlas->lookup[entry])
+  {
+    return atlas->lookup[entry] - 1;
+  }
+  if (!atlas->mask || atlas->count == TEXT_ATLAS_MAX_GLYPHS)
+  {
+    return -1;
+  }
+
+  // Light hinting leaves the horizontal outline alone, so the subpixel offset survives
+  FT_UInt   index = FT_Get_Char_Index(ft_face, codepoint);
+  FT_Vector delta = {bin * 64 / TEXT_SUBPIXEL_BINS, 0};
+  FT_Set_Transform(ft_face, NULL, &delta);
+  FT_Error error = FT_Load_Glyph(ft_face, index, FT_LOAD_RENDER | FT_LOAD_TARGET_LIGHT);
+  FT_Set_Transform(ft_face, NULL, NULL);
+  if (error)
+  {
+    log_message(LOG_LEVEL_ERROR, "[TEXT] Failed to load glyph U+%04X.", codepoint);
+    return -1;
+  }
+
+  FT_GlyphSlot slot  = ft_face->glyph;
+  int          width = (int)slot->bitmap.width;
+  int          rows  = (int)slot->bitmap.rows;
+  int          x, y;
+  if (!text_atlas_place(atlas, width, rows, &x, &y))
+  {
+    log_message(LOG_LEVEL_WARN, "[TEXT] Glyph atlas is full, U+%04X is not shown.", codepoint);
+    return -1;
+  }
+
+  for (int row = 0; row < rows; row++)
+  {
+    memcpy(atlas->mask + (size_t)(y + row) * TEXT_ATLAS_WIDTH + x,
+           slot->bitmap.buffer + row * slot->bitmap.pitch, width);
+  }
+
+  struct text_glyph* glyph = &atlas->glyphs[atlas->count];
+  glyph->codepoint         = codepoint;
+  glyph->bin               = bin;
+  glyph->index             = (int)index;
+  glyph->x                 = x;
+  glyph->y                 = y;
+  glyph->width             = width;
+  glyph->rows              = rows;
+  glyph->left              = slot->bitmap_left;
+  glyph->top               = slot->bitmap_top;
+  glyph->advance           = (int)(slot->linearHoriAdvance >> 10); // 16.16 -> 26.6
+  atlas->generation++;
+
+  atlas->lookup[entry] = (int16_t)(atlas->count + 1);
+  return atlas->count++;
+}
+
+/*
+ * A small block of constant coverage `alpha`, so flat rectangles can be drawn
+ * from the atlas together with text. Swatches live in the glyph table under
+ * codepoints past Unicode, where no font has anything.
+ */
+#define TEXT_SWATCH_CODEPOINT(alpha) (0x110000u + (alpha))
+#define TEXT_SWATCH_SIZE             4
+
+static int text_atlas_swatch(struct text_atlas* atlas, uint8_t alpha)
+{
+  uint32_t codepoint = TEXT_SWATCH_CODEPOINT(alpha);
+  int      entry     = text_atlas_slot(atlas, codepoint, 0);
+  if (atlas->lookup[entry])
+  {
+    return atlas->lookup[entry] - 1;
+  }
+  if (!atlas->mask || atlas->count == TEXT_ATLAS_MAX_GLYPHS)
+  {
+    return -1;
+  }
+
+  int x, y;
+  if (!text_atlas_place(atlas, TEXT_SWATCH_SIZE, TEXT_SWATCH_SIZE, &x, &y))
+  {
+    return -1;
+  }
+  for (int row = 0; row < TEXT_SWATCH_SIZE; row++)
+  {
+    memset(atlas->mask + (size_t)(y + row) * TEXT_ATLAS_WIDTH + x, alpha, TEXT_SWATCH_SIZE);
+  }
+
+  struct text_glyph* glyph = &atlas->glyphs[atlas->count];
+  memset(glyph, 0, sizeof(*glyph));
+  glyph->codepoint = codepoint;
+  glyph->x         = x;
+  glyph->y         = y;
+  glyph->width     = TEXT_SWATCH_SIZE;
+  glyph->rows      = TEXT_SWATCH_SIZE;
+  atlas->generation++;
+
+  atlas->lookup[entry] = (int16_t)(atlas->count + 1);
+  return atlas->count++;
+}
+
+// Rasterise `chars` at every subpixel offset now, so laying them out later never has to
+static void text_atlas_warm(struct text_atlas* atlas, const char* chars)
+{
+  for (const char* p = chars; *p;)
+  {
+    uint32_t codepoint = utf8_decode(&p);
+    for (int bin = 0; bin < TEXT_SUBPIXEL_BINS; bin++)
+    {
+      text_atlas_glyph(atlas, codepoint, bin);
+    }
+  }
+  log_message(LOG_LEVEL_DEBUG, "[TEXT] Glyph atlas warmed with %d glyphs.", atlas->count);
+}
+
+// The slot a new run goes to: a free one, else the least recently used run that is not pinned
+static struct text_run* text_run_cache_slot(struct text_run_cache* cache)
+{
+  if (cache->used < TEXT_RUN_CACHE_SIZE)
+  {
+    return &cache->runs[cache->used++];
+  }
+
+  struct text_run* oldest = NULL;
+  for (int i = 0; i < TEXT_RUN_CACHE_SIZE; i++)
+  {
+    struct text_run* run = &cache->runs[i];
+    if (!run->pinned && (!oldest || cache->uses - run->last_use > cache->uses - oldest->last_use))
+    {
+      oldest = run;
+    }
+  }
+  if (!oldest)
+  {
+    log_message(LOG_LEVEL_WARN, "[TEXT] Every cached run is pinned, replacing the first one.");
+    oldest = &cache->runs[0];
+  }
+  return oldest;
+}
+
+/*
+ * Lay `text` out, or return the run it was laid out into before. The run
+ * stays valid until TEXT_RUN_CACHE_SIZE other strings were laid out; a
+ * `pinned` one (the keypad labels) for as long as the cache lives.
+ */
+static const struct text_run* text_layout_run(struct text_atlas* atlas,
+                                              struct text_run_cache* cache, const char* text,
+                                              bool pinned)
+{
+  uint64_t hash = anvil_hash64(text, strlen(text));
+  cache->uses++;
+  for (int i = 0; i < cache->used; i++)
+  {
+    struct text_run* run = &cache->runs[i];
+    if (run->hash == hash && strcmp(run->text, text) == 0)
+    {
+      run->last_use  = cache->uses;
+      run->pinned   |= pinned;
+      return run;
+    }
+  }
+
+  struct text_run* run = text_run_cache_slot(cache);
+  snprintf(run->text, sizeof(run->text), "%s", text);
+  run->hash     = hash;
+  run->count    = 0;
+  run->last_use = cache->uses;
+  run->pinned   = pinned;
+
+  FT_Pos  pen   = 0; // 26.6
+  FT_UInt prev  = 0;
+  int     min_x = 0;
+  int     max_x = 0;
+  for (const char* p = run->text; *p && run->count < TEXT_RUN_MAX_GLYPHS;)
+  {
+    uint32_t codepoint = utf8_decode(&p);
+    FT_UInt  index     = FT_Get_Char_Index(ft_face, codepoint);
+    if (prev && index && FT_HAS_KERNING(ft_face))
+    {
+      FT_Vector kerning;
+      if (!FT_Get_Kerning(ft_face, prev, index, FT_KERNING_UNFITTED, &kerning))
+      {
+        pen += kerning.x;
+      }
+    }
+    prev = index;
+
+    // Round the pen to the nearest subpixel bin
+    FT_Pos snapped = (ANVIL_MAX(pen, 0) * TEXT_SUBPIXEL_BINS + 32) >> 6;
+    int    glyph   = text_atlas_glyph(atlas, codepoint, snapped % TEXT_SUBPIXEL_BINS);
+    if (glyph < 0)
+    {
+      continue;
+    }
+
+    const struct text_glyph* g    = &atlas->glyphs[glyph];
+    struct text_cell*        cell = &run->cells[run->count++];
+    cell->glyph                   = glyph;
+    cell->x                       = (int)(snapped / TEXT_SUBPIXEL_BINS) + g->left;
+    cell->y                       = atlas->ascent - g->top;
+    min_x                         = ANVIL_MIN(min_x, cell->x);
+    max_x                         = ANVIL_MAX(max_x, cell->x + g->width);
+    pen += g->advance;
+  }
+
+  // A negative left bearing on the first glyph would start left of the run
+  for (int i = 0; i < run->count; i++)
+  {
+    run->cells[i].x -= min_x;
+  }
+  run->width  = ANVIL_MAX(max_x, (int)((pen + 63) >> 6)) - min_x;
+  run->height = atlas->ascent + atlas->descent;
+  return run;
+}
+
+// A string that changes, like the clock
+static const struct text_run* text_layout(struct text_atlas* atlas, struct text_run_cache* cache,
+                                          const char* text)
+{
+  return text_layout_run(atlas, cache, text, false);
+}
+
+// A string that is shown for as long as the lock screen is, like a keypad label
+static const struct text_run* text_layout_pinned(struct text_atlas*     atlas,
+                                                 struct text_run_cache* cache, const char* text)
+{
+  return text_layout_run(atlas, cache, text, true);
+}
+
+/*
+ * Size of the power of two text mask a run is centred in, the way the time
+ * box has always stretched its text. Returns the row the run starts at.
+ */
+static int text_run_mask_size(const struct text_run* run, int* out_width, int* out_height)
+{
+  *out_width  = next_power_of_two(ANVIL_MAX(run->width, 1));
+  *out_height = next_power_of_two(ANVIL_MAX(CHAR_HEIGHT, run->height));
+  return (*out_height - run->height) / 2;
+}
+
+// The run composed into its text mask, calloc()'d, for the software renderer
+static unsigned char* text_compose_mask(const struct text_atlas* atlas, const struct text_run* run,
+                                        int* out_width, int* out_height)
+{
+  if (run->count == 0)
+  {
+    return NULL;
+  }
+
+  int            width, height;
+  int            y_offset = text_run_mask_size(run, &width, &height);
+  unsigned char* image;
+  ANVIL_SAFE_CALLOC(image, unsigned char, width* height);
+  if (!image)
+  {
+    return NULL;
+  }
+
+  // Kerned glyphs may overlap, keep the stronger coverage
+  for (int i = 0; i < run->count; i++)
+  {
+    const struct text_cell*  cell  = &run->cells[i];
+    const struct text_glyph* glyph = &atlas->glyphs[cell->glyph];
+    for (int row = 0; row < glyph->rows; row++)
+    {
+      int y = y_offset + cell->y + row;
+      if (y < 0 || y >= height)
+      {
+        continue;
+      }
+
+      const unsigned char* src =
+        atlas->mask + (size_t)(glyph->y + row) * TEXT_ATLAS_WIDTH + glyph->x;
+      unsigned char* dst = image + (size_t)y * width + cell->x;
+      for (int col = 0; col < glyph->width; col++)
+      {
+        dst[col] = ANVIL_MAX(dst[col], src[col]);
+      }
+    }
+  }
+
+  *out_width  = width;
+  *out_height = height;
+  return image;
+}
+
+#endif
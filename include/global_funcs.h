@@ -2,6 +2,7 @@
 #define GLOBAL_FUNCS_H
 
 #include "log.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,6 +14,9 @@
 #define __ANVIL_FALLBACK_SCREEN_HEIGHT__ 1080
 #define __ANVIL_FALLBACK_HOME_DIR__      "/root"
 
+// XRGB colour of the lock screen until the wallpaper is up (black needs no pixel writes)
+#define __ANVIL_PLACEHOLDER_COLOR__ 0x000000
+
 // OpenGL ret codes
 #define GL_RET_CODE_FAIL 0
 
@@ -54,6 +58,19 @@
     result;                                      \
   })
 
+// 64-bit FNV-1a, used to key on-disk caches by content
+static inline uint64_t anvil_hash64(const void* data, size_t len)
+{
+  const unsigned char* p    = data;
+  uint64_t             hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++)
+  {
+    hash ^= p[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
 // Get current time as a formatted string
 void get_time_string(char* buffer, size_t size, const char* format)
 {
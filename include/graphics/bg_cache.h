@@ -0,0 +1,245 @@
+#ifndef BG_CACHE_H
+#define BG_CACHE_H
+
+#include "../config/config_cache.h"
+#include "../global_funcs.h"
+#include "../log.h"
+#include "../memory/anvil_mem.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * @BACKGROUND CACHE:
+ *
+ * Artifacts derived from the wallpaper (the blurred thumbnail shown while the
+ * full image decodes, the ETC2 copy that replaces decoding) are stored next to
+ * the compiled config, one file per artifact kind:
+ *
+ *   $XDG_CACHE_HOME/anvilock/bg-<key>.<kind>   =   [ bg_cache_header | payload ]
+ *
+ * <key> hashes the wallpaper's absolute path, size and mtime, plus a variant
+ * for whatever else shaped the artifact (e.g. the [bg] effects), so replacing
+ * or touching the wallpaper, or changing the effects, simply turns into a
+ * miss. Storing an artifact prunes older files of the same kind. Bump
+ * BG_CACHE_VERSION whenever a payload layout changes.
+ *
+ */
+
+#define BG_CACHE_MAGIC   0x42564E41u // "ANVB"
+#define BG_CACHE_VERSION 2u
+
+enum bg_cache_format
+{
+  BG_CACHE_FORMAT_RGBA8     = 1,
+  BG_CACHE_FORMAT_ETC2_RGB8 = 2,
+};
+
+struct bg_cache_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint32_t format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t levels; // mip levels in the payload, back to back
+  uint32_t payload_size;
+};
+
+// Key a wallpaper by absolute path, size, mtime and `variant`; false if it cannot be stat()'d
+static bool bg_cache_key(const char* src_path, uint64_t variant, uint64_t* key)
+{
+  char        abs_path[PATH_MAX];
+  struct stat st;
+  if (!realpath(src_path, abs_path) || stat(abs_path, &st) != 0)
+  {
+    return false;
+  }
+
+  struct
+  {
+    int64_t  size;
+    int64_t  mtime_sec;
+    int64_t  mtime_nsec;
+    uint64_t path_hash;
+    uint64_t variant;
+  } id = {st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec,
+          anvil_hash64(abs_path, strlen(abs_path)), variant};
+
+  *key = anvil_hash64(&id, sizeof(id));
+  return true;
+}
+
+static int bg_cache_path(char* buf, size_t size, uint64_t key, const char* kind, bool create)
+{
+  char dir[PATH_MAX];
+  if (config_cache_dir(dir, sizeof(dir), create) != 0)
+  {
+    return -1;
+  }
+
+  int len = snprintf(buf, size, "%s/bg-%016llx.%s", dir, (unsigned long long)key, kind);
+  return (len < 0 || (size_t)len >= size) ? -1 : 0;
+}
+
+static bool bg_cache_exists(uint64_t key, const char* kind)
+{
+  char path[PATH_MAX];
+  return bg_cache_path(path, sizeof(path), key, kind, false) == 0 && access(path, R_OK) == 0;
+}
+
+/*
+ * Read a cached artifact. On success `*payload` is malloc()'d and holds
+ * hdr->payload_size bytes.
+ */
+static bool bg_cache_load(uint64_t key, const char* kind, struct bg_cache_header* hdr,
+                          void** payload)
+{
+  char path[PATH_MAX];
+  if (bg_cache_path(path, sizeof(path), key, kind, false) != 0)
+  {
+    return false;
+  }
+
+  FILE* in = fopen(path, "rbe");
+  if (!in)
+  {
+    return false;
+  }
+
+  bool ok = fread(hdr, sizeof(*hdr), 1, in) == 1 && hdr->magic == BG_CACHE_MAGIC &&
+            hdr->version == BG_CACHE_VERSION && hdr->key == key;
+
+  *payload = ok ? malloc(ANVIL_MAX(hdr->payload_size, 1u)) : NULL;
+  ok       = ok && *payload && fread(*payload, 1, hdr->payload_size, in) == hdr->payload_size;
+  fclose(in);
+
+  if (!ok)
+  {
+    log_message(LOG_LEVEL_DEBUG, "[BG CACHE] Ignoring unusable entry %s", path);
+    ANVIL_SAFE_FREE(*payload);
+    return false;
+  }
+
+  log_message(LOG_LEVEL_DEBUG, "[BG CACHE] Loaded %s", path);
+  return true;
+}
+
+// Remove every other bg-*.<kind> entry, i.e. artifacts of previous wallpapers
+static void bg_cache_prune(const char* dir, const char* keep, const char* kind)
+{
+  DIR* d = opendir(dir);
+  if (!d)
+  {
+    return;
+  }
+
+  size_t         kind_len = strlen(kind);
+  struct dirent* entry;
+  while ((entry = readdir(d)))
+  {
+    size_t len = strlen(entry->d_name);
+    if (strncmp(entry->d_name, "bg-", 3) != 0 || len < kind_len + 1 ||
+        entry->d_name[len - kind_len - 1] != '.' ||
+        strcmp(entry->d_name + len - kind_len, kind) != 0 || strcmp(entry->d_name, keep) == 0)
+    {
+      continue;
+    }
+    unlinkat(dirfd(d), entry->d_name, 0);
+  }
+  closedir(d);
+}
+
+// Write an artifact atomically. Failures are not fatal, it is rebuilt next time.
+static void bg_cache_store(uint64_t key, const char* kind, const struct bg_cache_header* hdr,
+                           const void* payload)
+{
+  char path[PATH_MAX];
+  if (bg_cache_path(path, sizeof(path), key, kind, true) != 0)
+  {
+    return;
+  }
+
+  char tmp_path[PATH_MAX + 8];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+  int fd = mkstemp(tmp_path);
+  if (fd < 0)
+  {
+    log_message(LOG_LEVEL_WARN, "[BG CACHE] Unable to write %s: %s", path, strerror(errno));
+    return;
+  }
+
+  FILE* out = fdopen(fd, "wb");
+  if (!out)
+  {
+    close(fd);
+    unlink(tmp_path);
+    return;
+  }
+
+  struct bg_cache_header full = *hdr;
+  full.magic                  = BG_CACHE_MAGIC;
+  full.version                = BG_CACHE_VERSION;
+  full.key                    = key;
+
+  bool ok = fwrite(&full, sizeof(full), 1, out) == 1 &&
+            fwrite(payload, 1, full.payload_size, out) == full.payload_size;
+  ok      = (fclose(out) == 0) && ok;
+
+  if (!ok || rename(tmp_path, path) != 0)
+  {
+    log_message(LOG_LEVEL_WARN, "[BG CACHE] Unable to write %s", path);
+    unlink(tmp_path);
+    return;
+  }
+
+  char* name  = strrchr(path, '/');
+  *name       = '\0';
+  bg_cache_prune(path, name + 1, kind);
+  log_message(LOG_LEVEL_DEBUG, "[BG CACHE] Stored %s/%s", path, name + 1);
+}
+
+// Convenience wrappers for plain RGBA8 images
+static bool bg_cache_load_image(uint64_t key, const char* kind, struct decoded_image* out)
+{
+  struct bg_cache_header hdr;
+  void*                  payload;
+  if (!bg_cache_load(key, kind, &hdr, &payload))
+  {
+    return false;
+  }
+
+  if (hdr.format != BG_CACHE_FORMAT_RGBA8 || hdr.width == 0 || hdr.height == 0 ||
+      hdr.levels != 1 || (uint64_t)hdr.width * hdr.height * 4 != hdr.payload_size)
+  {
+    free(payload);
+    return false;
+  }
+
+  out->pixels = payload;
+  out->width  = hdr.width;
+  out->height = hdr.height;
+  return true;
+}
+
+static void bg_cache_store_image(uint64_t key, const char* kind, const struct decoded_image* image)
+{
+  struct bg_cache_header hdr = {0};
+  hdr.format                 = BG_CACHE_FORMAT_RGBA8;
+  hdr.width                  = image->width;
+  hdr.height                 = image->height;
+  hdr.levels                 = 1;
+  hdr.payload_size           = (uint32_t)image->width * image->height * 4;
+  bg_cache_store(key, kind, &hdr, image->pixels);
+}
+
+#endif // BG_CACHE_H
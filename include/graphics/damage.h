@@ -0,0 +1,289 @@
+#ifndef DAMAGE_H
+#define DAMAGE_H
+
+#include "../client_state.h"
+#include "../global_funcs.h"
+#include "keypad.h"
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+/*
+ * @DAMAGE TRACKING:
+ *
+ * Most frames only change a few small parts of the lock screen: a password
+ * dot, the border colour, the clock text. Every element reports its screen
+ * rectangle to state->damage when it changes, and a frame with no damage is
+ * not drawn at all.
+ *
+ * A frame that is drawn only repaints its damage, plus whatever changed since
+ * the buffer it reuses was last on screen. That is what the buffer age tells
+ * us (EGL_EXT_buffer_age on the GPU, our own two wl_shm buffers on the CPU),
+ * and why the damage of the last DAMAGE_HISTORY frames is kept around:
+ *
+ *   repaint = this frame + the (age - 1) frames before it
+ *
+ * An age of 0 (unknown contents) or older than the history repaints it all.
+ * The compositor is only told about this frame's own damage.
+ *
+ * Rectangles in a region never overlap, so drawing everything once per
+ * rectangle never blends a pixel twice.
+ *
+ */
+
+static inline bool damage_rect_empty(struct damage_rect r)
+{
+  return r.x1 <= r.x0 || r.y1 <= r.y0;
+}
+
+static inline bool damage_rects_overlap(struct damage_rect a, struct damage_rect b)
+{
+  return a.x0 < b.x1 && b.x0 < a.x1 && a.y0 < b.y1 && b.y0 < a.y1;
+}
+
+static inline struct damage_rect damage_rect_union(struct damage_rect a, struct damage_rect b)
+{
+  struct damage_rect r = {ANVIL_MIN(a.x0, b.x0), ANVIL_MIN(a.y0, b.y0), ANVIL_MAX(a.x1, b.x1),
+                          ANVIL_MAX(a.y1, b.y1)};
+  return r;
+}
+
+static inline struct damage_rect damage_rect_intersect(struct damage_rect a, struct damage_rect b)
+{
+  struct damage_rect r = {ANVIL_MAX(a.x0, b.x0), ANVIL_MAX(a.y0, b.y0), ANVIL_MIN(a.x1, b.x1),
+                          ANVIL_MIN(a.y1, b.y1)};
+  return r;
+}
+
+// Pixels whose centres fall inside an NDC coordinate, the way GL rasterises it
+static inline int damage_ndc_to_px(float ndc, int size, bool flip)
+{
+  float px = (flip ? 1.0f - ndc : ndc + 1.0f) * 0.5f * size;
+  return ANVIL_CLAMP((int)ceilf(px - 0.5f), 0, size);
+}
+
+// Bounding box of a quad given as 4 (x, y) pairs `step` floats apart, moved by (dx, dy)
+static struct damage_rect damage_quad_rect(const GLfloat* v, int step, float dx, float dy,
+                                           int width, int height)
+{
+  float left = v[0], right = v[0], top = v[1], bottom = v[1];
+  for (int i = 1; i < 4; i++)
+  {
+    left   = fminf(left, v[i * step]);
+    right  = fmaxf(right, v[i * step]);
+    bottom = fminf(bottom, v[i * step + 1]);
+    top    = fmaxf(top, v[i * step + 1]);
+  }
+
+  struct damage_rect rect = {
+    .x0 = damage_ndc_to_px(left + dx, width, false),
+    .y0 = damage_ndc_to_px(top + dy, height, true),
+    .x1 = damage_ndc_to_px(right + dx, width, false),
+    .y1 = damage_ndc_to_px(bottom + dy, height, true),
+  };
+  return rect;
+}
+
+// Merges whatever `rect` overlaps, so the region stays disjoint
+static void damage_region_add(struct damage_region* region, struct damage_rect rect)
+{
+  if (region->full || damage_rect_empty(rect))
+  {
+    return;
+  }
+
+  for (int i = 0; i < region->count;)
+  {
+    if (damage_rects_overlap(rect, region->rects[i]))
+    {
+      rect             = damage_rect_union(rect, region->rects[i]);
+      region->rects[i] = region->rects[--region->count];
+      i                = 0; // the union may overlap rectangles already checked
+      continue;
+    }
+    i++;
+  }
+
+  // Out of slots, fall back to one bounding box
+  if (region->count == DAMAGE_MAX_RECTS)
+  {
+    for (int i = 0; i < region->count; i++)
+    {
+      rect = damage_rect_union(rect, region->rects[i]);
+    }
+    region->count = 0;
+  }
+  region->rects[region->count++] = rect;
+}
+
+static void damage_region_merge(struct damage_region* dst, const struct damage_region* src)
+{
+  dst->full = dst->full || src->full;
+  for (int i = 0; i < src->count && !dst->full; i++)
+  {
+    damage_region_add(dst, src->rects[i]);
+  }
+}
+
+// New buffer size, or new buffers: nothing on them can be reused
+static void damage_reset(struct damage_tracker* damage, int width, int height)
+{
+  damage->width  = width;
+  damage->height = height;
+  memset(&damage->pending, 0, sizeof(damage->pending));
+  damage->pending.full = true;
+  for (int i = 0; i < DAMAGE_HISTORY; i++)
+  {
+    damage->history[i] = damage->pending;
+  }
+}
+
+static void damage_add(struct damage_tracker* damage, struct damage_rect rect)
+{
+  struct damage_rect bounds = {0, 0, damage->width, damage->height};
+  damage_region_add(&damage->pending, damage_rect_intersect(rect, bounds));
+}
+
+static void damage_add_full(struct damage_tracker* damage)
+{
+  damage->pending.full = true;
+}
+
+static inline bool damage_pending(const struct damage_tracker* damage)
+{
+  return damage->pending.full || damage->pending.count > 0;
+}
+
+// What a frame drawn into a buffer of age `age` has to repaint
+static const struct damage_region* damage_begin_frame(struct damage_tracker* damage, int age)
+{
+  damage->repaint      = damage->pending;
+  damage->repaint.full = damage->repaint.full || age < 1 || age - 1 > DAMAGE_HISTORY;
+  for (int i = 0; i < age - 1 && !damage->repaint.full; i++)
+  {
+    damage_region_merge(&damage->repaint, &damage->history[i]);
+  }
+  return &damage->repaint;
+}
+
+static void damage_end_frame(struct damage_tracker* damage)
+{
+  memmove(&damage->history[1], &damage->history[0],
+          sizeof(damage->history[0]) * (DAMAGE_HISTORY - 1));
+  damage->history[0] = damage->pending;
+  memset(&damage->pending, 0, sizeof(damage->pending));
+}
+
+// The rectangles of a region, or the whole buffer
+static int damage_region_rects(const struct damage_tracker* damage,
+                               const struct damage_region* region, struct damage_rect* out)
+{
+  if (region->full)
+  {
+    out[0] = (struct damage_rect){0, 0, damage->width, damage->height};
+    return 1;
+  }
+  memcpy(out, region->rects, sizeof(region->rects[0]) * region->count);
+  return region->count;
+}
+
+/*
+ * UI elements. A pixel of slack around each covers GL line loops and
+ * linear filtering at the edges.
+ */
+static struct damage_rect damage_inflate(const struct damage_tracker* damage,
+                                         struct damage_rect rect)
+{
+  struct damage_rect bounds = {0, 0, damage->width, damage->height};
+  struct damage_rect grown  = {rect.x0 - 1, rect.y0 - 1, rect.x1 + 1, rect.y1 + 1};
+  return damage_rect_intersect(grown, bounds);
+}
+
+static struct damage_rect damage_time_box_rect(const struct damage_tracker* damage,
+                                               const TOMLConfig*            config)
+{
+  return damage_inflate(damage, damage_quad_rect(&config->time_box_vertices[0].x, 4, 0.0f, 0.0f,
+                                                 damage->width, damage->height));
+}
+
+static struct damage_rect damage_password_field_rect(const struct damage_tracker* damage)
+{
+  return damage_inflate(damage, damage_quad_rect(password_field_vertices, 2, 0.0f,
+                                                 -0.8f + 0.15f / 2.0f, damage->width,
+                                                 damage->height));
+}
+
+// The clock text changed
+static void damage_time_box(struct client_state* state)
+{
+  damage_add(&state->damage, damage_time_box_rect(&state->damage, &state->global_config));
+}
+
+// One character of the GL clock moved or changed, `quad` as in gl_clock
+static void damage_clock_glyph(struct client_state* state, const Vertex* quad)
+{
+  struct damage_tracker* damage = &state->damage;
+  damage_add(damage, damage_inflate(damage, damage_quad_rect(&quad[0].x, 4, 0.0f, 0.0f,
+                                                             damage->width, damage->height)));
+}
+
+// Dots and border colour are all the password field shows
+static void damage_track_password_field(struct client_state* state)
+{
+  struct damage_tracker* damage = &state->damage;
+  int                    dots   = state->ui.password_length;
+  int                    border = state->ui.auth_failed ? 2 : dots > 0;
+  if (damage->field_dots != dots || damage->field_border != border)
+  {
+    damage->field_dots   = dots;
+    damage->field_border = border;
+    damage_add(damage, damage_password_field_rect(damage));
+  }
+}
+
+// Whatever the pointer hovers is drawn differently, only the old and the new one change
+static void damage_track_pointer_hover(struct client_state* state)
+{
+  struct damage_tracker* damage = &state->damage;
+  if (damage->pointer_hover != state->ui.pointer_hover)
+  {
+    // "Nothing hovered" has an empty rectangle, inflating it would not keep it empty
+    if (!damage_rect_empty(damage->pointer_hover_rect))
+    {
+      damage_add(damage, damage_inflate(damage, damage->pointer_hover_rect));
+    }
+    if (!damage_rect_empty(state->ui.pointer_hover_rect))
+    {
+      damage_add(damage, damage_inflate(damage, state->ui.pointer_hover_rect));
+    }
+    damage->pointer_hover      = state->ui.pointer_hover;
+    damage->pointer_hover_rect = state->ui.pointer_hover_rect;
+  }
+}
+
+// The keypad comes and goes with the touchscreen; while it is up only a key press changes it
+static void damage_track_keypad(struct client_state* state)
+{
+  struct damage_tracker* damage = &state->damage;
+  struct keypad_layout*  layout = &damage->keypad;
+  keypad_layout_update(layout, damage->width, damage->height);
+  if (damage->keypad_visible != state->ui.keypad_visible)
+  {
+    damage_add(damage, damage_inflate(damage, layout->bounds));
+  }
+  else if (damage->keypad_visible && damage->keypad_pressed != state->ui.keypad_pressed)
+  {
+    if (damage->keypad_pressed)
+    {
+      damage_add(damage, damage_inflate(damage, layout->keys[damage->keypad_pressed - 1].rect));
+    }
+    if (state->ui.keypad_pressed)
+    {
+      damage_add(damage, damage_inflate(damage, layout->keys[state->ui.keypad_pressed - 1].rect));
+    }
+  }
+  damage->keypad_visible = state->ui.keypad_visible;
+  damage->keypad_pressed = state->ui.keypad_pressed;
+}
+
+#endif
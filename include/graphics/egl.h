@@ -4,9 +4,18 @@
 #include "../client_state.h"
 #include "../config/config.h"
 #include "../freetype/freetype.h"
+#include "../freetype/text_layout.h"
 #include "../global_funcs.h"
 #include "../graphics/shaders.h"
 #include "../log.h"
+#include "../startup/startup.h"
+#include "../wayland/screencopy_handle.h"
+#include "damage.h"
+#include "etc_encoder.h"
+#include "frame_pacing.h"
+#include "image_ops.h"
+#include "render_thread.h"
+#include "screen_blur.h"
 #include <EGL/egl.h>
 #include <GLES2/gl2.h>
 #include <wayland-client.h>
@@ -14,6 +23,64 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "../stb_image.h"
 
+// Compile one stage of a program, 0 if it does not compile
+static GLuint egl_compile_shader(const char* shader_runtime_dir, const char* relpath, GLenum type)
+{
+  char* path = ANVIL_SAFE_STR_JOIN(shader_runtime_dir, relpath);
+  if (!path)
+  {
+    return GL_RET_CODE_FAIL;
+  }
+  char* source = load_shader_source(path);
+  free(path);
+
+  GLuint shader = glCreateShader(type);
+  glShaderSource(shader, 1, (const char**)&source, NULL);
+  glCompileShader(shader);
+  free(source);
+
+  GLint compile_status;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &compile_status);
+  if (compile_status == GL_FALSE)
+  {
+    log_message(LOG_LEVEL_ERROR, "Shader compilation failed: %s", relpath);
+    glDeleteShader(shader);
+    return GL_RET_CODE_FAIL;
+  }
+  return shader;
+}
+
+// Compile and link a vertex/fragment pair, 0 if either stage or the link fails
+static GLuint egl_link_program(const char* shader_runtime_dir, const char* vertex,
+                               const char* fragment)
+{
+  GLuint vertex_shader   = egl_compile_shader(shader_runtime_dir, vertex, GL_VERTEX_SHADER);
+  GLuint fragment_shader = egl_compile_shader(shader_runtime_dir, fragment, GL_FRAGMENT_SHADER);
+  if (!vertex_shader || !fragment_shader)
+  {
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+    return GL_RET_CODE_FAIL;
+  }
+
+  GLuint program = glCreateProgram();
+  glAttachShader(program, vertex_shader);
+  glAttachShader(program, fragment_shader);
+  glLinkProgram(program);
+  glDeleteShader(vertex_shader);
+  glDeleteShader(fragment_shader);
+
+  GLint link_status;
+  glGetProgramiv(program, GL_LINK_STATUS, &link_status);
+  if (link_status == GL_FALSE)
+  {
+    log_message(LOG_LEVEL_ERROR, "Shader program linking failed: %s", fragment);
+    glDeleteProgram(program);
+    return GL_RET_CODE_FAIL;
+  }
+  return program;
+}
+
 static GLuint create_texture_shader_program(const char* shader_runtime_dir)
 {
 
@@ -24,7 +91,8 @@ static GLuint create_texture_shader_program(const char* shader_runtime_dir)
    * we prepend (concatenate) shader runtime dir and the SHADERS_xx macros.
    *
    * Then perform a sanity check if the strings exist (concatenated string) and
-   * the shader source is loaded with the absolute path of the shader.
+   * the shader source is loaded with the absolute path of the shader, see
+   * egl_compile_shader().
    *
    * NOTE:- shaderRuntimeDir is a member of ClientState struct in `client_state.h`
    *
@@ -33,181 +101,335 @@ static GLuint create_texture_shader_program(const char* shader_runtime_dir)
    *
    */
 
-  char* vertex_shader_str   = ANVIL_SAFE_STR_JOIN(shader_runtime_dir, SHADERS_TEXTURE_EGL_VERTEX);
-  char* fragment_shader_str = ANVIL_SAFE_STR_JOIN(shader_runtime_dir, SHADERS_TEXTURE_EGL_FRAG);
-
-  if (vertex_shader_str && fragment_shader_str)
+  GLuint program =
+    egl_link_program(shader_runtime_dir, SHADERS_TEXTURE_EGL_VERTEX, SHADERS_TEXTURE_EGL_FRAG);
+  if (!program)
   {
+    log_message(LOG_LEVEL_ERROR, "Failed to create texture shader program.");
+  }
+  return program; // GL_RET_CODE_FAIL on failure
+}
 
-    const char* vertex_shader_source   = load_shader_source(vertex_shader_str);
-    const char* fragment_shader_source = load_shader_source(fragment_shader_str);
+static void render_password_field(struct client_state* state);
 
-    // Create and compile vertex shader
-    GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex_shader, 1, &vertex_shader_source, NULL);
-    glCompileShader(vertex_shader);
+// Software renderer (soft_render.h), used when init_egl() fails
+static uint32_t* soft_build_background(const struct decoded_image* image,
+                                       const struct image_mips* mips, int width, int height);
+static void      soft_render_frame(struct client_state* state);
 
-    // Create and compile fragment shader
-    GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment_shader, 1, &fragment_shader_source, NULL);
-    glCompileShader(fragment_shader);
+// Buffer-space rectangle to a GL one, whose origin is bottom left
+static void egl_rect(const struct damage_tracker* damage, struct damage_rect rect, EGLint* out)
+{
+  out[0] = rect.x0;
+  out[1] = damage->height - rect.y1;
+  out[2] = rect.x1 - rect.x0;
+  out[3] = rect.y1 - rect.y0;
+}
 
-    // Create and link shader program
-    GLuint program = glCreateProgram();
-    glAttachShader(program, vertex_shader);
-    glAttachShader(program, fragment_shader);
-    glLinkProgram(program);
+// A configure asked for another size: the next swap is at that size, fully redrawn
+static void egl_fit_window(struct client_state* state, int width, int height)
+{
+  struct damage_tracker* damage = &state->damage;
+  if (!state->egl_window || width <= 0 || height <= 0 ||
+      (width == damage->width && height == damage->height))
+  {
+    return;
+  }
+  wl_egl_window_resize(state->egl_window, width, height, 0, 0);
+  glViewport(0, 0, width, height);
+  damage_reset(damage, width, height);
+  log_message(LOG_LEVEL_DEBUG, "[RENDER] Surface resized to %dx%d", width, height);
+}
 
-    // Clean up shaders
-    glDeleteShader(vertex_shader);
-    glDeleteShader(fragment_shader);
+static void egl_probe_damage_extensions(struct client_state* state)
+{
+  const char* extensions = eglQueryString(state->egl_display, EGL_EXTENSIONS);
+  if (!extensions)
+  {
+    return;
+  }
 
-    return program;
+  state->egl_buffer_age = strstr(extensions, "EGL_EXT_buffer_age") ||
+                          strstr(extensions, "EGL_KHR_partial_update");
+  if (strstr(extensions, "EGL_KHR_partial_update"))
+  {
+    state->egl_set_damage_region =
+      (PFNEGLSETDAMAGEREGIONKHRPROC)eglGetProcAddress("eglSetDamageRegionKHR");
   }
-  else
+  if (strstr(extensions, "EGL_KHR_swap_buffers_with_damage"))
   {
-    log_message(LOG_LEVEL_ERROR, "Failed to create texture shader program.");
+    state->egl_swap_with_damage =
+      (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+  }
+  else if (strstr(extensions, "EGL_EXT_swap_buffers_with_damage"))
+  {
+    state->egl_swap_with_damage =
+      (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)eglGetProcAddress("eglSwapBuffersWithDamageEXT");
   }
 
-  return GL_RET_CODE_FAIL; // Always ensure that we return this when we are returning a fail for
-                           // OpenGL functions with return type GLuint
+  log_message(LOG_LEVEL_DEBUG, "EGL damage: buffer age %d, partial update %d, swap with damage %d",
+              state->egl_buffer_age, state->egl_set_damage_region != NULL,
+              state->egl_swap_with_damage != NULL);
 }
 
-static void render_password_field(struct client_state* state);
-
-GLuint create_text_texture(const char* text)
+// Work out what the back buffer is missing, everything drawn after this is clipped to it
+static void egl_begin_frame(struct client_state* state)
 {
-  if (!text || !*text)
+  EGLint age = 0;
+  if (state->egl_buffer_age &&
+      !eglQuerySurface(state->egl_display, state->egl_surface, EGL_BUFFER_AGE_EXT, &age))
   {
-    log_message(LOG_LEVEL_ERROR, "Invalid text string for texture.");
-    return 0;
+    age = 0;
   }
 
-  FT_GlyphSlot slot = ft_face->glyph;
-
-  // First pass: measure dimensions
-  int width         = 0;
-  int max_height    = 0;
-  int max_bearing_y = 0;
+  const struct damage_region* repaint = damage_begin_frame(&state->damage, age);
+  if (repaint->full)
+  {
+    glDisable(GL_SCISSOR_TEST);
+    return;
+  }
 
-  for (const char* p = text; *p; p++)
+  if (state->egl_set_damage_region)
   {
-    if (FT_Load_Char(ft_face, *p, FT_LOAD_RENDER))
+    EGLint rects[DAMAGE_MAX_RECTS * 4];
+    for (int i = 0; i < repaint->count; i++)
     {
-      log_message(LOG_LEVEL_ERROR, "Failed to load glyph.");
-      continue;
+      egl_rect(&state->damage, repaint->rects[i], &rects[i * 4]);
     }
-
-    // Add proper spacing between characters
-    width += slot->bitmap.width + 1; // +1 for spacing
-    max_height    = ANVIL_MAX_UINT(max_height, slot->bitmap.rows);
-    max_bearing_y = ANVIL_MAX_UINT(max_bearing_y, slot->bitmap_top);
+    state->egl_set_damage_region(state->egl_display, state->egl_surface, rects, repaint->count);
   }
+  glEnable(GL_SCISSOR_TEST);
+}
 
-  int height = ANVIL_MAX_UINT(CHAR_HEIGHT, max_height);
-
-  // Convert width and height into powers of two (check global_funcs.h for more docs)
-  width  = next_power_of_two(width);
-  height = next_power_of_two(height);
+// Select repaint rectangle `index`, false once there are no more
+static bool egl_scissor(const struct damage_tracker* damage, int index)
+{
+  if (damage->repaint.full)
+  {
+    return index == 0;
+  }
+  if (index >= damage->repaint.count)
+  {
+    return false;
+  }
 
-  // Allocate image buffer
-  /*unsigned char* image = calloc(width * height, sizeof(unsigned char));*/
-  unsigned char* image;
-  ANVIL_SAFE_CALLOC(image, unsigned char, width* height);
+  EGLint rect[4];
+  egl_rect(damage, damage->repaint.rects[index], rect);
+  glScissor(rect[0], rect[1], rect[2], rect[3]);
+  return true;
+}
 
-  if (!image)
+// glDrawArrays(), glDrawElements() and glClear(), once per repaint rectangle
+static void render_draw_arrays(struct client_state* state, GLenum mode, GLint first, GLsizei count)
+{
+  for (int i = 0; egl_scissor(&state->damage, i); i++)
   {
-    log_message(LOG_LEVEL_ERROR, "Failed to allocate image buffer.");
-    return GL_RET_CODE_FAIL;
+    glDrawArrays(mode, first, count);
   }
+}
 
-  // Second pass: render glyphs
-  int x_offset = 0;
-  for (const char* p = text; *p; p++)
+static void render_draw_elements(struct client_state* state, GLenum mode, GLsizei count,
+                                 GLenum type, const void* indices)
+{
+  for (int i = 0; egl_scissor(&state->damage, i); i++)
   {
-    if (FT_Load_Char(ft_face, *p, FT_LOAD_RENDER))
-      continue;
+    glDrawElements(mode, count, type, indices);
+  }
+}
 
-    // Calculate vertical position for baseline alignment
-    int y_offset = (max_bearing_y - slot->bitmap_top) + (height - max_height) / 2;
+static void render_clear(struct client_state* state)
+{
+  for (int i = 0; egl_scissor(&state->damage, i); i++)
+  {
+    glClear(GL_COLOR_BUFFER_BIT);
+  }
+}
 
-    for (unsigned int row = 0; row < slot->bitmap.rows; row++)
+// Present the frame, telling the compositor only about what changed since the last one
+static void egl_end_frame(struct client_state* state)
+{
+  struct damage_tracker* damage = &state->damage;
+  frame_pacing_request(state);
+  if (state->egl_swap_with_damage && !damage->pending.full)
+  {
+    EGLint rects[DAMAGE_MAX_RECTS * 4];
+    for (int i = 0; i < damage->pending.count; i++)
     {
-      for (unsigned int col = 0; col < slot->bitmap.width; col++)
-      {
-        int dst_row = row + y_offset;
-        if (dst_row >= 0 && dst_row < height)
-        {
-          image[(dst_row * width) + x_offset + col] =
-            slot->bitmap.buffer[row * slot->bitmap.width + col];
-        }
-      }
+      egl_rect(damage, damage->pending.rects[i], &rects[i * 4]);
     }
+    state->egl_swap_with_damage(state->egl_display, state->egl_surface, rects,
+                                damage->pending.count);
+  }
+  else
+  {
+    eglSwapBuffers(state->egl_display, state->egl_surface);
+  }
+  glDisable(GL_SCISSOR_TEST);
+  damage_end_frame(damage);
+}
+
+/*
+ * The clock. The glyph atlas goes up as an alpha texture (again only if
+ * glyphs were added to it), after that a tick only rewrites the quads of the
+ * characters that changed, with glBufferSubData() into a small dynamic VBO.
+ * Each quad sits where its glyph is in the run's text mask stretched over the
+ * time box (see text_layout.h).
+ */
 
-    x_offset += slot->bitmap.width + 1; // +1 for spacing
+// Point of the time box at texture coordinate (u, v), where GL stretched the text mask to
+static void clock_box_point(const Vertex* box, float u, float v, Vertex* out)
+{
+  out->x = 0.0f;
+  out->y = 0.0f;
+  for (int i = 0; i < 4; i++)
+  {
+    float weight = (box[i].u > 0.5f ? u : 1.0f - u) * (box[i].v > 0.5f ? v : 1.0f - v);
+    out->x += weight * box[i].x;
+    out->y += weight * box[i].y;
   }
+}
 
-  // Create OpenGL texture
-  GLuint texture;
-  glGenTextures(1, &texture);
-  if (texture == 0)
+// Upload the glyph atlas if it changed, and create the quad buffers the first time
+static bool clock_gl_init(struct client_state* state)
+{
+  struct gl_clock* clock = &state->clock;
+  if (!glyph_atlas.mask)
   {
-    log_message(LOG_LEVEL_ERROR, "Failed to generate OpenGL texture.");
-    ANVIL_SAFE_FREE(image);
-    return GL_RET_CODE_FAIL;
+    return false;
+  }
+  if (clock->texture && clock->generation == glyph_atlas.generation)
+  {
+    return true;
   }
 
-  glBindTexture(GL_TEXTURE_2D, texture);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, width, height, 0, GL_ALPHA, GL_UNSIGNED_BYTE, image);
+  bool first = clock->texture == 0;
+  if (first)
+  {
+    glGenTextures(1, &clock->texture);
+    if (clock->texture == 0)
+    {
+      log_message(LOG_LEVEL_ERROR, "Failed to generate OpenGL texture.");
+      return false;
+    }
+  }
+  glBindTexture(GL_TEXTURE_2D, clock->texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, TEXT_ATLAS_WIDTH, TEXT_ATLAS_HEIGHT, 0, GL_ALPHA,
+               GL_UNSIGNED_BYTE, glyph_atlas.mask);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  clock->generation = glyph_atlas.generation;
+  log_message(LOG_LEVEL_DEBUG, "[CLOCK] Glyph atlas uploaded (%d glyphs).", glyph_atlas.count);
+  if (!first)
+  {
+    return true;
+  }
 
-  ANVIL_SAFE_FREE(image);
-  log_message(LOG_LEVEL_DEBUG, "Text texture successfully created.");
-  return texture;
+  // Two triangles per quad, corners in the order of time_box_vertices
+  GLushort indices[TEXT_RUN_MAX_GLYPHS * 6];
+  for (int i = 0; i < TEXT_RUN_MAX_GLYPHS; i++)
+  {
+    GLushort first  = (GLushort)(i * 4);
+    GLushort quad[] = {first, first + 1, first + 2, first + 2, first + 1, first + 3};
+    memcpy(&indices[i * 6], quad, sizeof(quad));
+  }
+  glGenBuffers(1, &clock->ibo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, clock->ibo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+  glGenBuffers(1, &clock->vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, clock->vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(clock->quads), NULL, GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  clock->count   = 0;
+  clock->text[0] = '\0';
+  return true;
 }
 
-void update_time_texture(struct client_state* state)
+// Quad of one laid out glyph, corners in the order of time_box_vertices
+static void clock_quad(const struct client_state* state, const struct text_cell* cell,
+                       int mask_w, int mask_h, int top, Vertex* quad)
 {
-  char time_str[16];
-  get_time_string(time_str, sizeof(time_str), global_config.time_format);
+  const Vertex*            box   = state->global_config.time_box_vertices;
+  const struct text_glyph* glyph = &glyph_atlas.glyphs[cell->glyph];
 
-  static char last_time_str[16] = "";
-  if (strcmp(last_time_str, time_str) != 0)
+  for (int i = 0; i < 4; i++)
   {
-    strcpy(last_time_str, time_str);
-
-    if (state->time_texture)
-    {
-      glDeleteTextures(1, &state->time_texture);
-      state->time_texture = 0;
-      log_message(LOG_LEVEL_DEBUG, "Old time texture deleted.");
-    }
-    state->time_texture = create_text_texture(time_str);
+    int dx = box[i].u > 0.5f ? glyph->width : 0;
+    int dy = box[i].v > 0.5f ? glyph->rows : 0;
+    clock_box_point(box, (float)(cell->x + dx) / mask_w, (float)(top + cell->y + dy) / mask_h,
+                    &quad[i]);
+    quad[i].u = (float)(glyph->x + dx) / TEXT_ATLAS_WIDTH;
+    quad[i].v = (float)(glyph->y + dy) / TEXT_ATLAS_HEIGHT;
   }
 }
 
-void render_time_box(struct client_state* state)
+// Rewrite and damage only the characters that changed since the last tick
+static void update_time_quads(struct client_state* state)
 {
-  if (!state->time_texture)
+  struct gl_clock* clock = &state->clock;
+  const char*      text  = state->ui.time_str;
+  if (strcmp(clock->text, text) == 0 || !glyph_atlas.mask)
+  {
+    return;
+  }
+
+  // Laying out may add glyphs to the atlas, upload after
+  const struct text_run* run = text_layout(&glyph_atlas, &text_runs, text);
+  if (!clock_gl_init(state))
   {
-    log_message(LOG_LEVEL_ERROR, "No valid texture for rendering.");
     return;
   }
+  strcpy(clock->text, text);
+
+  int mask_w, mask_h;
+  int top   = text_run_mask_size(run, &mask_w, &mask_h);
+  int count = run->count;
 
-  static GLuint vbo = 0;
-  if (vbo == 0)
+  glBindBuffer(GL_ARRAY_BUFFER, clock->vbo);
+  for (int i = 0; i < ANVIL_MAX(count, clock->count); i++)
   {
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(state->global_config.time_box_vertices),
-                 state->global_config.time_box_vertices, GL_STATIC_DRAW);
+    Vertex quad[4] = {0}; // characters that went away are collapsed
+    if (i < count)
+    {
+      clock_quad(state, &run->cells[i], mask_w, mask_h, top, quad);
+    }
+
+    Vertex* old = &clock->quads[i * 4];
+    if (memcmp(old, quad, sizeof(quad)) == 0)
+    {
+      continue;
+    }
+
+    // Both where the old glyph was and where the new one goes
+    if (i < clock->count)
+    {
+      damage_clock_glyph(state, old);
+    }
+    memcpy(old, quad, sizeof(quad));
+    if (i < count)
+    {
+      damage_clock_glyph(state, old);
+    }
+    glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)(i * sizeof(quad)), sizeof(quad), quad);
   }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  clock->count = count;
+}
 
+// `count` atlas quads from `vbo`, with whichever texture program is bound, like the background
+static void render_atlas_quads(struct client_state* state, GLuint vbo, int count)
+{
+  struct gl_clock* clock = &state->clock;
   glEnable(GL_BLEND);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
   glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, clock->ibo);
   glEnableVertexAttribArray(0);
   glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (void*)0);
   glEnableVertexAttribArray(1);
@@ -215,8 +437,8 @@ void render_time_box(struct client_state* state)
                         (void*)(2 * sizeof(GLfloat)));
 
   glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, state->time_texture);
-  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  glBindTexture(GL_TEXTURE_2D, clock->texture);
+  render_draw_elements(state, GL_TRIANGLES, count * 6, GL_UNSIGNED_SHORT, (void*)0);
 
   GLenum error = glGetError();
   if (error != GL_NO_ERROR)
@@ -226,57 +448,468 @@ void render_time_box(struct client_state* state)
 
   glDisableVertexAttribArray(1);
   glDisableVertexAttribArray(0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
   glBindBuffer(GL_ARRAY_BUFFER, 0);
   glBindTexture(GL_TEXTURE_2D, 0);
   glDisable(GL_BLEND);
+}
 
+void render_time_box(struct client_state* state)
+{
+  struct gl_clock* clock = &state->clock;
+  if (!clock->texture)
+  {
+    log_message(LOG_LEVEL_ERROR, "No valid texture for rendering.");
+    return;
+  }
+  render_atlas_quads(state, clock->vbo, clock->count);
   log_message(LOG_LEVEL_DEBUG, "Time box rendered successfully.");
 }
 
-static GLuint load_texture(const char* filepath)
+/*
+ * The touch keypad goes through the same atlas texture and index buffer as
+ * the clock: a key background is a quad over a solid swatch in the atlas, a
+ * label is one quad per glyph, so the whole keypad is a single draw call.
+ * The quads are only rebuilt when a key is pressed or released, the surface
+ * is resized, or glyphs were added to the atlas.
+ */
+
+// Quad over the pixel rectangle `rect` showing the atlas rectangle `uv` (x, y, width, rows)
+static void keypad_quad(const struct damage_tracker* damage, struct damage_rect rect,
+                        const float* uv, Vertex* quad)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    int dx    = i & 1;
+    int dy    = i >> 1;
+    quad[i].x = 2.0f * (dx ? rect.x1 : rect.x0) / damage->width - 1.0f;
+    quad[i].y = 1.0f - 2.0f * (dy ? rect.y1 : rect.y0) / damage->height;
+    quad[i].u = (uv[0] + dx * uv[2]) / TEXT_ATLAS_WIDTH;
+    quad[i].v = (uv[1] + dy * uv[3]) / TEXT_ATLAS_HEIGHT;
+  }
+}
+
+static void update_keypad_quads(struct client_state* state)
 {
-  int            width, height, channels;
-  unsigned char* image = stbi_load(filepath, &width, &height, &channels, STBI_rgb_alpha);
-  if (!image)
+  struct gl_keypad*      keypad = &state->keypad;
+  struct damage_tracker* damage = &state->damage;
+  bool                   same   = keypad->visible == state->ui.keypad_visible &&
+                                  keypad->pressed == state->ui.keypad_pressed &&
+                                  keypad->width == damage->width &&
+                                  keypad->height == damage->height &&
+                                  keypad->generation == glyph_atlas.generation;
+  if (same || !glyph_atlas.mask)
+  {
+    return;
+  }
+  keypad->visible = state->ui.keypad_visible;
+  keypad->pressed = state->ui.keypad_pressed;
+  keypad->width   = damage->width;
+  keypad->height  = damage->height;
+  keypad->count   = 0;
+
+  struct keypad_layout layout = {0};
+  keypad_layout_update(&layout, damage->width, damage->height);
+  for (int i = 0; keypad->visible && i < KEYPAD_KEYS; i++)
+  {
+    const struct keypad_key* key     = &layout.keys[i];
+    bool                     pressed = i + 1 == keypad->pressed;
+    int fill = text_atlas_swatch(&glyph_atlas, pressed ? KEYPAD_PRESSED_ALPHA : KEYPAD_KEY_ALPHA);
+    if (fill >= 0 && keypad->count < TEXT_RUN_MAX_GLYPHS)
+    {
+      // Sample the middle of the swatch, the whole quad gets its one alpha
+      const struct text_glyph* swatch = &glyph_atlas.glyphs[fill];
+      float                    uv[4]  = {swatch->x + TEXT_SWATCH_SIZE / 2.0f,
+                                         swatch->y + TEXT_SWATCH_SIZE / 2.0f, 0.0f, 0.0f};
+      keypad_quad(damage, key->rect, uv, &keypad->quads[keypad->count++ * 4]);
+    }
+
+    // Labels are drawn 1:1, centred on their key
+    const struct text_run* run = text_layout_pinned(&glyph_atlas, &text_runs, key->label);
+    int                    x0  = (key->rect.x0 + key->rect.x1 - run->width) / 2;
+    int                    y0  = (key->rect.y0 + key->rect.y1 - run->height) / 2;
+    for (int c = 0; c < run->count && keypad->count < TEXT_RUN_MAX_GLYPHS; c++)
+    {
+      const struct text_glyph* glyph = &glyph_atlas.glyphs[run->cells[c].glyph];
+      int                      x     = x0 + run->cells[c].x;
+      int                      y     = y0 + run->cells[c].y;
+      float                    uv[4] = {glyph->x, glyph->y, glyph->width, glyph->rows};
+      keypad_quad(damage, (struct damage_rect){x, y, x + glyph->width, y + glyph->rows}, uv,
+                  &keypad->quads[keypad->count++ * 4]);
+    }
+  }
+
+  // Swatches and labels may have just gone into the atlas, upload after
+  if (!clock_gl_init(state))
+  {
+    keypad->count = 0;
+    return;
+  }
+  keypad->generation = glyph_atlas.generation;
+  if (!keypad->vbo)
+  {
+    glGenBuffers(1, &keypad->vbo);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, keypad->vbo);
+  glBufferData(GL_ARRAY_BUFFER, keypad->count * 4 * sizeof(Vertex), keypad->quads,
+               GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static void render_keypad(struct client_state* state)
+{
+  if (state->keypad.count > 0 && state->clock.texture)
+  {
+    render_atlas_quads(state, state->keypad.vbo, state->keypad.count);
+  }
+}
+
+// Decode an image file into RGBA8. Does no GL work, so it is safe to run off the main thread.
+static bool decode_image(const char* filepath, struct decoded_image* out)
+{
+  int channels;
+  out->pixels = stbi_load(filepath, &out->width, &out->height, &channels, STBI_rgb_alpha);
+  if (!out->pixels)
   {
     log_message(LOG_LEVEL_ERROR, "Failed to load image: %s", filepath);
-    exit(EXIT_FAILURE);
+    return false;
   }
+  return true;
+}
+
+static void free_decoded_image(struct decoded_image* image)
+{
+  if (image->pixels)
+  {
+    stbi_image_free(image->pixels);
+    image->pixels = NULL;
+  }
+}
+
+#ifndef GL_ETC1_RGB8_OES
+#define GL_ETC1_RGB8_OES 0x8D64
+#endif
+#ifndef GL_COMPRESSED_RGB8_ETC2
+#define GL_COMPRESSED_RGB8_ETC2 0x9274
+#endif
+
+// ETC2 RGB8 if the driver lists it, else ETC1 (our ETC2 data is ETC1-compatible), else 0
+static GLenum probe_etc_format(void)
+{
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &count);
+  if (count <= 0)
+  {
+    return 0;
+  }
+
+  GLint* formats = malloc(count * sizeof(GLint));
+  if (!formats)
+  {
+    return 0;
+  }
+  glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, formats);
+
+  GLenum found = 0;
+  for (GLint i = 0; i < count; i++)
+  {
+    if (formats[i] == GL_COMPRESSED_RGB8_ETC2)
+    {
+      found = GL_COMPRESSED_RGB8_ETC2;
+      break;
+    }
+    if (formats[i] == GL_ETC1_RGB8_OES)
+    {
+      found = GL_ETC1_RGB8_OES;
+    }
+  }
+  free(formats);
+  return found;
+}
+
+// GLES2 only mipmaps NPOT textures with OES_texture_npot, GLES3 always can
+static bool probe_npot_mipmaps(void)
+{
+  const char* version    = (const char*)glGetString(GL_VERSION);
+  const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+  return (version && strncmp(version, "OpenGL ES 3", 11) == 0) ||
+         (extensions && strstr(extensions, "GL_OES_texture_npot"));
+}
+
+static inline bool is_pot(int v)
+{
+  return v > 0 && (v & (v - 1)) == 0;
+}
+
+// Whether a `levels` deep chain of a width x height texture would be complete here
+static bool can_mipmap(const struct client_state* state, int width, int height, int levels)
+{
+  return levels > 1 && levels == image_mip_count(width, height) &&
+         (state->npot_mips || (is_pot(width) && is_pot(height)));
+}
 
+// Linear (trilinear if mipmapped) and clamped, clamping keeps NPOT textures complete on GLES2
+static void set_texture_params(bool mipmapped)
+{
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+static GLuint upload_texture(const struct decoded_image* image)
+{
   GLuint texture;
   glGenTextures(1, &texture);
   glBindTexture(GL_TEXTURE_2D, texture);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image->width, image->height, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, image->pixels);
+  set_texture_params(false);
 
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  return texture;
+}
+
+// Base level plus the precomputed mips, if this context can sample them
+static GLuint upload_texture_mips(const struct client_state*  state,
+                                  const struct decoded_image* base, const struct image_mips* mips)
+{
+  bool   mipmapped = can_mipmap(state, base->width, base->height, mips->levels);
+  int    levels    = mipmapped ? mips->levels : 1;
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  for (int level = 0; level < levels; level++)
+  {
+    struct decoded_image image = image_mip_level(base, mips, level);
+    glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, image.width, image.height, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, image.pixels);
+  }
+  set_texture_params(mipmapped);
 
-  stbi_image_free(image);
   return texture;
 }
 
-static void init_egl(struct client_state* state)
+static GLuint upload_compressed_texture(const struct client_state* state,
+                                        const struct compressed_image* image, GLenum format)
+{
+  bool           mipmapped = can_mipmap(state, image->width, image->height, image->levels);
+  int            levels    = mipmapped ? image->levels : 1;
+  const uint8_t* data      = image->data;
+  GLuint         texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  for (int level = 0; level < levels; level++)
+  {
+    int    width  = image_mip_dim(image->width, level);
+    int    height = image_mip_dim(image->height, level);
+    size_t size   = etc_image_size(width, height);
+    glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height, 0, size, data);
+    data += size;
+  }
+  set_texture_params(mipmapped);
+
+  GLenum error = glGetError();
+  if (error != GL_NO_ERROR)
+  {
+    log_message(LOG_LEVEL_ERROR, "Compressed texture upload failed: 0x%x", error);
+    glDeleteTextures(1, &texture);
+    return 0;
+  }
+  return texture;
+}
+
+// Pick up whatever the startup workers finished since the last frame.
+// Failures are not fatal: the lock screen keeps its placeholder instead.
+static void stream_in_assets(struct client_state* state)
+{
+  int result;
+
+  if (!state->assets.thumbnail_done && startup_task_poll(STARTUP_TASK_THUMBNAIL, &result))
+  {
+    state->assets.thumbnail_done = true;
+    // Pointless once the full wallpaper made it first
+    if (result == 0 && state->soft.active && !state->soft.background)
+    {
+      state->soft.thumb =
+        soft_build_background(&state->thumbnail, NULL, state->soft.width, state->soft.height);
+      damage_add_full(&state->damage);
+    }
+    else if (result == 0 && !state->soft.active && !state->bg_texture)
+    {
+      state->thumb_texture = upload_texture(&state->thumbnail);
+      damage_add_full(&state->damage);
+    }
+    free_decoded_image(&state->thumbnail);
+  }
+
+  if (!state->assets.wallpaper_done && startup_task_poll(STARTUP_TASK_WALLPAPER, &result))
+  {
+    state->assets.wallpaper_done = true;
+    if (result == 0)
+    {
+      int stage = startup_stage_begin("bg-upload", false);
+      if (state->soft.active)
+      {
+        state->soft.background = soft_build_background(&state->wallpaper, &state->wallpaper_mips,
+                                                       state->soft.width, state->soft.height);
+      }
+      else if (state->wallpaper_etc.data)
+      {
+        state->bg_texture =
+          upload_compressed_texture(state, &state->wallpaper_etc, state->etc_format);
+        ANVIL_SAFE_FREE(state->wallpaper_etc.data);
+      }
+      else
+      {
+        state->bg_texture = upload_texture_mips(state, &state->wallpaper, &state->wallpaper_mips);
+      }
+      state->assets.bg_fade_start_ns = startup_now_ns();
+      damage_add_full(&state->damage);
+      startup_stage_end(stage);
+    }
+    else if (!state->bg_texture && !state->soft.background)
+    {
+      log_message(LOG_LEVEL_ERROR, "Wallpaper failed to load, keeping the placeholder");
+    }
+  }
+
+  // The pixels are not needed once they are on the GPU and the bg cache is built from them
+  if (state->wallpaper.pixels && state->assets.wallpaper_done &&
+      startup_task_poll(STARTUP_TASK_BG_CACHE, &result))
+  {
+    free_decoded_image(&state->wallpaper);
+    ANVIL_SAFE_FREE(state->wallpaper_mips.data);
+  }
+
+  if (!state->assets.font_done && startup_task_poll(STARTUP_TASK_FONT, &result))
+  {
+    state->assets.font_done  = true;
+    state->assets.font_ready = result == 0;
+    if (!state->assets.font_ready)
+    {
+      log_message(LOG_LEVEL_ERROR, "Font failed to load, the clock will not be shown");
+    }
+  }
+
+  if (!state->assets.reported && state->assets.wallpaper_done && state->assets.font_done)
+  {
+    state->assets.reported = true;
+    startup_report();
+  }
+}
+
+#define BG_CROSSFADE_NS 250000000ULL
+
+// True while the thumbnail -> wallpaper crossfade still needs frames
+static bool render_is_animating(const struct client_state* state)
+{
+  return (state->thumb_texture && state->bg_texture) ||
+         (state->soft.thumb && state->soft.background);
+}
+
+/*
+ * Draw the background quad through the currently bound texture program:
+ * the blurred thumbnail until the wallpaper is uploaded, then a short
+ * crossfade over to it. The fade is done with a constant blend alpha so the
+ * texture shader itself stays a plain copy.
+ */
+static void draw_background(struct client_state* state)
+{
+  float fade = 1.0f;
+  if (render_is_animating(state))
+  {
+    fade = (startup_now_ns() - state->assets.bg_fade_start_ns) / (float)BG_CROSSFADE_NS;
+    if (fade >= 1.0f)
+    {
+      glDeleteTextures(1, &state->thumb_texture);
+      state->thumb_texture = 0;
+      fade                 = 1.0f;
+    }
+  }
+
+  glActiveTexture(GL_TEXTURE0);
+  if (state->thumb_texture)
+  {
+    glBindTexture(GL_TEXTURE_2D, state->thumb_texture);
+    render_draw_arrays(state, GL_TRIANGLE_STRIP, 0, 4);
+  }
+
+  if (!state->bg_texture)
+  {
+    return;
+  }
+
+  glBindTexture(GL_TEXTURE_2D, state->bg_texture);
+  if (fade < 1.0f)
+  {
+    glEnable(GL_BLEND);
+    glBlendColor(0.0f, 0.0f, 0.0f, fade);
+    glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+  }
+  render_draw_arrays(state, GL_TRIANGLE_STRIP, 0, 4);
+  if (fade < 1.0f)
+  {
+    glDisable(GL_BLEND);
+  }
+}
+
+// Undo a partial init_egl() and hand the surface over to the software renderer
+static bool egl_init_failed(struct client_state* state, int stage)
+{
+  if (state->egl_display != EGL_NO_DISPLAY)
+  {
+    eglMakeCurrent(state->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (state->egl_surface != EGL_NO_SURFACE)
+    {
+      eglDestroySurface(state->egl_display, state->egl_surface);
+    }
+    if (state->egl_context != EGL_NO_CONTEXT)
+    {
+      eglDestroyContext(state->egl_display, state->egl_context);
+    }
+    eglTerminate(state->egl_display);
+  }
+  if (state->egl_window)
+  {
+    wl_egl_window_destroy(state->egl_window);
+  }
+
+  state->egl_display = EGL_NO_DISPLAY;
+  state->egl_context = EGL_NO_CONTEXT;
+  state->egl_surface = EGL_NO_SURFACE;
+  state->egl_window  = NULL;
+  startup_stage_end(stage);
+
+  log_message(LOG_LEVEL_WARN, "EGL is unavailable, falling back to software rendering");
+  return false;
+}
+
+// Returns false, with nothing left initialized, if there is no usable EGL
+static bool init_egl(struct client_state* state)
 {
+  int egl_stage = startup_stage_begin("egl", false);
+
   // Get the EGL display connection using Wayland's display
   state->egl_display = eglGetDisplay((EGLNativeDisplayType)state->wl_display);
   if (state->egl_display == EGL_NO_DISPLAY)
   {
     log_message(LOG_LEVEL_ERROR, "Failed to get EGL display\n");
-    exit(EXIT_FAILURE);
+    return egl_init_failed(state, egl_stage);
   }
 
   // Initialize the EGL display
   if (!eglInitialize(state->egl_display, NULL, NULL))
   {
     log_message(LOG_LEVEL_ERROR, "Failed to initialize EGL");
-    exit(EXIT_FAILURE);
+    return egl_init_failed(state, egl_stage);
   }
 
   // Bind the OpenGL ES API
   if (!eglBindAPI(EGL_OPENGL_ES_API))
   {
     log_message(LOG_LEVEL_ERROR, "Failed to bind OpenGL ES API");
-    exit(EXIT_FAILURE);
+    return egl_init_failed(state, egl_stage);
   }
 
   // EGL configuration: specifies rendering type and color depth
@@ -296,7 +929,7 @@ static void init_egl(struct client_state* state)
   if (!eglChooseConfig(state->egl_display, attribs, &config, 1, &num_configs) || num_configs < 1)
   {
     log_message(LOG_LEVEL_ERROR, "Failed to choose EGL config");
-    exit(EXIT_FAILURE);
+    return egl_init_failed(state, egl_stage);
   }
 
   // Create an EGL context for OpenGL ES 2.0
@@ -306,12 +939,9 @@ static void init_egl(struct client_state* state)
   if (state->egl_context == EGL_NO_CONTEXT)
   {
     log_message(LOG_LEVEL_ERROR, "Failed to create EGL context");
-    exit(EXIT_FAILURE);
+    return egl_init_failed(state, egl_stage);
   }
 
-  // Ensure Wayland surface events are processed before creating EGL window
-  wl_display_roundtrip(state->wl_display);
-
   // Validate output dimensions and create EGL window surface
   int width =
     state->output_state.width > 0 ? state->output_state.width : __ANVIL_FALLBACK_SCREEN_WIDTH__;
@@ -321,7 +951,7 @@ static void init_egl(struct client_state* state)
   if (!state->egl_window)
   {
     log_message(LOG_LEVEL_ERROR, "Failed to create wl_egl_window");
-    exit(EXIT_FAILURE);
+    return egl_init_failed(state, egl_stage);
   }
 
   state->egl_surface = eglCreateWindowSurface(state->egl_display, config,
@@ -330,7 +960,7 @@ static void init_egl(struct client_state* state)
   {
     EGLint error = eglGetError();
     log_message(LOG_LEVEL_ERROR, "Failed to create EGL surface, error code: %x", error);
-    exit(EXIT_FAILURE);
+    return egl_init_failed(state, egl_stage);
   }
 
   // Make the EGL context current
@@ -338,236 +968,219 @@ static void init_egl(struct client_state* state)
                       state->egl_context))
   {
     log_message(LOG_LEVEL_ERROR, "Failed to make EGL context current");
-    exit(EXIT_FAILURE);
+    return egl_init_failed(state, egl_stage);
   }
 
   // Set the OpenGL viewport to match the window size
   glViewport(0, 0, width, height);
 
-  // Load the image and create a texture
-  GLuint texture = load_texture(state->global_config.bg_path);
-
-  // Use the texture for rendering
-  glBindTexture(GL_TEXTURE_2D, texture);
+  // A shader the driver rejects is as good as no GPU, the software renderer takes over
+  GLuint shader_program =
+    egl_link_program(state->shaderRuntimeDir, SHADERS_INIT_EGL_VERTEX, SHADERS_INIT_EGL_FRAG);
+  // The password field program is built once here, render_password_field() only binds it
+  GLuint field_program = egl_link_program(state->shaderRuntimeDir,
+                                          SHADERS_RENDER_PWD_FIELD_EGL_VERTEX,
+                                          SHADERS_RENDER_PWD_FIELD_EGL_FRAG);
+  if (!shader_program || !field_program)
+  {
+    glDeleteProgram(shader_program);
+    glDeleteProgram(field_program);
+    return egl_init_failed(state, egl_stage);
+  }
+  state->shader_state.program           = field_program;
+  state->shader_state.color_location    = glGetUniformLocation(field_program, "color");
+  state->shader_state.offset_location   = glGetUniformLocation(field_program, "offset");
+  state->shader_state.position_location = glGetAttribLocation(field_program, "position");
+
+  // Frames are paced by frame callbacks, the swap only blocks if fifo asked it to
+  frame_pacing_set_swap_interval(state);
+
+  // Only what changed gets redrawn, as far as the driver lets us know what the buffer holds
+  damage_reset(&state->damage, width, height);
+  egl_probe_damage_extensions(state);
+
+  // Lets the wallpaper worker use its cached ETC2 copy instead of decoding
+  state->etc_format = probe_etc_format();
+  state->npot_mips  = probe_npot_mipmaps();
+  startup_gate_open(STARTUP_TASK_GL_CAPS, state->etc_format ? 0 : -1);
+  log_message(LOG_LEVEL_DEBUG, "Compressed wallpaper format: 0x%x", state->etc_format);
+
+  // A captured desktop is the background from the very first frame, the wallpaper only a fallback
+  if (state->screenshot.data)
+  {
+    int blur_stage    = startup_stage_begin("screen-blur", false);
+    state->bg_texture = screen_blur_capture(state, &state->screenshot, &global_config.bg_effects);
+    screencopy_release(&state->screenshot);
+    startup_stage_end(blur_stage);
+  }
+  startup_gate_open(STARTUP_TASK_SCREENSHOT, state->bg_texture ? 0 : -1);
+
+  // Anything not streamed in yet shows up as the placeholder colour
+  glClearColor(((__ANVIL_PLACEHOLDER_COLOR__ >> 16) & 0xFF) / 255.0f,
+               ((__ANVIL_PLACEHOLDER_COLOR__ >> 8) & 0xFF) / 255.0f,
+               (__ANVIL_PLACEHOLDER_COLOR__ & 0xFF) / 255.0f, 1.0f);
+  startup_stage_end(egl_stage);
+
+  // Draw with whatever is ready now, the rest streams in on later frames
+  int frame_stage = startup_stage_begin("egl-frame", false);
+  struct ui_snapshot snapshot;
+  ui_snapshot_build(state, &snapshot);
+  ui_snapshot_apply(state, &snapshot);
+  stream_in_assets(state);
+  damage_track_password_field(state);
+  damage_track_pointer_hover(state);
+  damage_track_keypad(state);
+  egl_begin_frame(state);
 
   // Clear color buffer
-  glClear(GL_COLOR_BUFFER_BIT);
+  render_clear(state);
 
   // Render the quad with the texture
-  char* vertex_shader_str   = ANVIL_SAFE_STR_JOIN(state->shaderRuntimeDir, SHADERS_INIT_EGL_VERTEX);
-  char* fragment_shader_str = ANVIL_SAFE_STR_JOIN(state->shaderRuntimeDir, SHADERS_INIT_EGL_FRAG);
-
-  if (vertex_shader_str && fragment_shader_str)
-  {
-    const char* vertex_shader_source = load_shader_source(vertex_shader_str);
-    GLuint      vertex_shader        = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex_shader, 1, &vertex_shader_source, NULL);
-    glCompileShader(vertex_shader);
-
-    // Check for vertex shader compile errors
-    GLint compile_status;
-    glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &compile_status);
-    if (compile_status == GL_FALSE)
-    {
-      log_message(LOG_LEVEL_ERROR, "Vertex shader compilation failed");
-      exit(EXIT_FAILURE);
-    }
+  glUseProgram(shader_program);
 
-    const char* fragment_shader_source = load_shader_source(fragment_shader_str);
-    GLuint      fragment_shader        = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment_shader, 1, &fragment_shader_source, NULL);
-    glCompileShader(fragment_shader);
+  GLint position_location = glGetAttribLocation(shader_program, "position");
+  GLint texCoord_location = glGetAttribLocation(shader_program, "texCoord");
+  glVertexAttribPointer(position_location, 2, GL_FLOAT, GL_FALSE, 0, quad_vertices);
+  glEnableVertexAttribArray(position_location);
+  glVertexAttribPointer(texCoord_location, 2, GL_FLOAT, GL_FALSE, 0, tex_coords);
+  glEnableVertexAttribArray(texCoord_location);
 
-    // Check for fragment shader compile errors
-    glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &compile_status);
-    if (compile_status == GL_FALSE)
-    {
-      log_message(LOG_LEVEL_ERROR, "Fragment shader compilation failed");
-      exit(EXIT_FAILURE);
-    }
-
-    GLuint shader_program = glCreateProgram();
-    glAttachShader(shader_program, vertex_shader);
-    glAttachShader(shader_program, fragment_shader);
-    glLinkProgram(shader_program);
-
-    GLint link_status;
-    glGetProgramiv(shader_program, GL_LINK_STATUS, &link_status);
-    if (link_status == GL_FALSE)
-    {
-      log_message(LOG_LEVEL_ERROR, "Shader program linking failed");
-      exit(EXIT_FAILURE);
-    }
-
-    glUseProgram(shader_program);
+  glUniform1i(glGetUniformLocation(shader_program, "uTexture"), 0);
 
-    GLint position_location = glGetAttribLocation(shader_program, "position");
-    GLint texCoord_location = glGetAttribLocation(shader_program, "texCoord");
-    glVertexAttribPointer(position_location, 2, GL_FLOAT, GL_FALSE, 0, quad_vertices);
-    glEnableVertexAttribArray(position_location);
-    glVertexAttribPointer(texCoord_location, 2, GL_FLOAT, GL_FALSE, 0, tex_coords);
-    glEnableVertexAttribArray(texCoord_location);
+  draw_background(state);
 
-    glUniform1i(glGetUniformLocation(shader_program, "uTexture"), 0);
-
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-    update_time_texture(state);
-    render_time_box(state);
-    render_password_field(state);
-
-    eglSwapBuffers(state->egl_display, state->egl_surface);
-  }
-  else
+  if (state->assets.font_ready)
   {
-    log_message(LOG_LEVEL_ERROR, "Failed to allocate memory, causing texture load errors.");
+    update_time_quads(state);
+    update_keypad_quads(state);
+    render_time_box(state);
+    render_keypad(state);
   }
+  render_password_field(state);
+  egl_end_frame(state);
+  glDeleteProgram(shader_program); // later frames use the texture program
+
+  startup_stage_end(frame_stage);
+  return true;
 }
 
 static void render_password_field(struct client_state* state)
 {
+  // Enable blending for transparency
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-  char* vertex_shader_str =
-    ANVIL_SAFE_STR_JOIN(state->shaderRuntimeDir, SHADERS_RENDER_PWD_FIELD_EGL_VERTEX);
-  char* fragment_shader_str =
-    ANVIL_SAFE_STR_JOIN(state->shaderRuntimeDir, SHADERS_RENDER_PWD_FIELD_EGL_FRAG);
+  // Use the shader program, built once by init_egl()
+  glUseProgram(state->shader_state.program);
+  GLint color_location    = state->shader_state.color_location;
+  GLint offset_location   = state->shader_state.offset_location;
+  GLint position_location = state->shader_state.position_location;
 
-  if (vertex_shader_str && fragment_shader_str)
-  {
+  // Width and height of the password field
+  float field_width  = 0.7f;  // Adjusted width for the field
+  float field_height = 0.15f; // Adjusted height for the field
 
-    const char* vertex_shader_source   = load_shader_source(vertex_shader_str);
-    const char* fragment_shader_source = load_shader_source(fragment_shader_str);
+  // Position offset to center at the bottom of the screen
+  float offset_x = 0;                           // Horizontally center the field
+  float offset_y = -0.8f + field_height / 2.0f; // Vertically align it at the bottom
 
-    // Create and compile shaders
-    GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex_shader, 1, &vertex_shader_source, NULL);
-    glCompileShader(vertex_shader);
+  // Set up the password field background (using GL_TRIANGLE_STRIP for a rectangle)
+  glUniform4f(color_location, 1.0f, 1.0f, 1.0f, 0.70f); // Light background with transparency
+  glUniform2f(offset_location, offset_x, offset_y);
 
-    GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment_shader, 1, &fragment_shader_source, NULL);
-    glCompileShader(fragment_shader);
+  glVertexAttribPointer(position_location, 2, GL_FLOAT, GL_FALSE, 0, password_field_vertices);
+  glEnableVertexAttribArray(position_location);
 
-    // Create and link program
-    GLuint program = glCreateProgram();
-    glAttachShader(program, vertex_shader);
-    glAttachShader(program, fragment_shader);
-    glLinkProgram(program);
+  // Draw the background of the password field
+  render_draw_arrays(state, GL_TRIANGLE_STRIP, 0, 4);
 
-    // Enable blending for transparency
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  // Draw the border with a subtle shadow effect
+  glUniform4f(color_location, 0.8f, 0.8f, 0.8f, 1.0f);
+  render_draw_arrays(state, GL_LINE_LOOP, 0, 4);
 
-    // Use the shader program
-    glUseProgram(program);
+  // Draw password dots
+  glUniform4f(color_location, 0.3f, 0.3f, 0.3f, 0.8f); // Gray dots
 
-    // Get uniform locations
-    GLint color_location    = glGetUniformLocation(program, "color");
-    GLint offset_location   = glGetUniformLocation(program, "offset");
-    GLint position_location = glGetAttribLocation(program, "position");
+  // Set up vertices for dots
+  glVertexAttribPointer(position_location, 2, GL_FLOAT, GL_FALSE, 0, dot_vertices);
 
-    // Width and height of the password field
-    float field_width  = 0.7f;  // Adjusted width for the field
-    float field_height = 0.15f; // Adjusted height for the field
+  // Adjust dot positions based on password input
+  float dot_spacing = field_width / (state->ui.password_length + 1);
+  for (int i = 0; i < state->ui.password_length; i++)
+  {
+    float x_position = offset_x + (i + 1) * dot_spacing - field_width / 2; // Center the dots
+    glUniform2f(offset_location, x_position, offset_y);
+    render_draw_arrays(state, GL_TRIANGLE_STRIP, 0, 4);
+  }
 
-    // Position offset to center at the bottom of the screen
-    float offset_x = 0;                           // Horizontally center the field
-    float offset_y = -0.8f + field_height / 2.0f; // Vertically align it at the bottom
+  // Handle Authentication Failure (Red border for failure)
+  if (state->ui.auth_failed)
+  {
+    float failColor[] = {1.0f, 0.0f, 0.0f, 1.0f}; // Red for failure
 
-    // Set up the password field background (using GL_TRIANGLE_STRIP for a rectangle)
-    glUniform4f(color_location, 1.0f, 1.0f, 1.0f, 0.70f); // Light background with transparency
+    glUniform4fv(color_location, 1, failColor);
     glUniform2f(offset_location, offset_x, offset_y);
-
-    glVertexAttribPointer(position_location, 2, GL_FLOAT, GL_FALSE, 0, password_field_vertices);
-    glEnableVertexAttribArray(position_location);
-
-    // Draw the background of the password field
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-    // Draw the border with a subtle shadow effect
-    glUniform4f(color_location, 0.8f, 0.8f, 0.8f, 1.0f);
-    glDrawArrays(GL_LINE_LOOP, 0, 4);
-
-    // Draw password dots
-    glUniform4f(color_location, 0.3f, 0.3f, 0.3f, 0.8f); // Gray dots
-
-    // Set up vertices for dots
-    glVertexAttribPointer(position_location, 2, GL_FLOAT, GL_FALSE, 0, dot_vertices);
-
-    // Adjust dot positions based on password input
-    float dot_spacing = field_width / (state->pam.password_index + 1);
-    for (int i = 0; i < state->pam.password_index; i++)
-    {
-      float x_position = offset_x + (i + 1) * dot_spacing - field_width / 2; // Center the dots
-      glUniform2f(offset_location, x_position, offset_y);
-      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    }
-
-    // Handle Authentication Failure (Red border for failure)
-    if (state->pam.auth_state.auth_failed)
-    {
-      float failColor[] = {1.0f, 0.0f, 0.0f, 1.0f}; // Red for failure
-
-      glUniform4fv(color_location, 1, failColor);
-      glUniform2f(offset_location, offset_x, offset_y);
-      glDrawArrays(GL_LINE_LOOP, 0, 4); // Re-draw border with failure color
-    }
-
-    // Handle Authentication Success (Green border for success)
-    if (!state->pam.auth_state.auth_failed && state->pam.password_index > 0)
-    {
-      float successColor[] = {0.0f, 1.0f, 0.0f, 1.0f}; // Green for success
-
-      glUniform4fv(color_location, 1, successColor);
-      glUniform2f(offset_location, offset_x, offset_y);
-      glDrawArrays(GL_LINE_LOOP, 0, 4); // Re-draw border with success color
-    }
-
-    // Disable blending and clean up
-    glDisable(GL_BLEND);
-    glDeleteShader(vertex_shader);
-    glDeleteShader(fragment_shader);
-    glDeleteProgram(program);
-
-    // Swap buffers to render the final frame
-    eglSwapBuffers(state->egl_display, state->egl_surface);
-
-    if (state->pam.auth_state.auth_failed)
-      sleep(1);
+    render_draw_arrays(state, GL_LINE_LOOP, 0, 4); // Re-draw border with failure color
   }
-  else
+
+  // Handle Authentication Success (Green border for success)
+  if (!state->ui.auth_failed && state->ui.password_length > 0)
   {
-    log_message(LOG_LEVEL_ERROR,
-                "Failed to allocate memory, causing password field render to fail");
+    float successColor[] = {0.0f, 1.0f, 0.0f, 1.0f}; // Green for success
+
+    glUniform4fv(color_location, 1, successColor);
+    glUniform2f(offset_location, offset_x, offset_y);
+    render_draw_arrays(state, GL_LINE_LOOP, 0, 4); // Re-draw border with success color
   }
+
+  glDisable(GL_BLEND);
 }
 
-void render_lock_screen(struct client_state* state)
+// One frame of the current `ui` snapshot, on whichever thread holds the EGL context
+static void egl_render_frame(struct client_state* state)
 {
-  // Bind the context to ensure it's current
-  if (!eglMakeCurrent(state->egl_display, state->egl_surface, state->egl_surface,
-                      state->egl_context))
+  stream_in_assets(state);
+
+  // The compositor has not shown the last frame yet, its callback brings us back here
+  if (!frame_pacing_ready(state))
   {
-    log_message(LOG_LEVEL_ERROR, "Failed to make EGL context current for rendering");
     return;
   }
 
   // Initialize static resources on first run
-  static GLuint texture                = 0;
   static GLuint texture_shader_program = 0;
   static int    initialized            = 0;
 
   if (!initialized)
   {
-    // Load the background image path from the TOML configuration
+    // The background texture itself was uploaded by init_egl
     log_message(LOG_LEVEL_WARN, "EGL not initialized.");
-    texture = load_texture(state->global_config.bg_path); // Use the bg path here
     // Create shader program for texture
     texture_shader_program = create_texture_shader_program(state->shaderRuntimeDir);
     initialized            = 1;
   }
 
+  // Find out what changed, a frame where nothing did is not drawn at all
+  if (state->assets.font_ready)
+  {
+    update_time_quads(state);
+    update_keypad_quads(state);
+  }
+  damage_track_password_field(state);
+  damage_track_pointer_hover(state);
+  damage_track_keypad(state);
+  if (render_is_animating(state))
+  {
+    damage_add_full(&state->damage);
+  }
+  if (!damage_pending(&state->damage))
+  {
+    return;
+  }
+  egl_begin_frame(state);
+
   // Clear the screen
-  glClear(GL_COLOR_BUFFER_BIT);
+  render_clear(state);
 
   // First render the texture
   glUseProgram(texture_shader_program);
@@ -583,16 +1196,48 @@ void render_lock_screen(struct client_state* state)
   glEnableVertexAttribArray(texcoord_loc);
 
   // Bind and render texture
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, texture);
   glUniform1i(glGetUniformLocation(texture_shader_program, "uTexture"), 0);
-
-  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  draw_background(state);
 
   // Then render the triangle
-  update_time_texture(state);
-  render_time_box(state);
+  if (state->assets.font_ready)
+  {
+    render_time_box(state);
+    render_keypad(state);
+  }
   render_password_field(state);
+  egl_end_frame(state);
+}
+
+/*
+ * Show the current input state. With the render thread up this only posts a
+ * snapshot, so input handlers never wait for a frame to be drawn.
+ */
+void render_lock_screen(struct client_state* state)
+{
+  struct ui_snapshot snapshot;
+  ui_snapshot_build(state, &snapshot);
+  if (state->render.running)
+  {
+    render_thread_post(state, &snapshot);
+    return;
+  }
+
+  // Still on the placeholder frame, init_egl() has not run yet
+  if (!state->soft.active && state->egl_surface == EGL_NO_SURFACE)
+  {
+    return;
+  }
+
+  ui_snapshot_apply(state, &snapshot);
+  if (state->soft.active)
+  {
+    soft_render_frame(state);
+  }
+  else
+  {
+    egl_render_frame(state);
+  }
 }
 
 #endif
@@ -0,0 +1,265 @@
+#ifndef ETC_ENCODER_H
+#define ETC_ENCODER_H
+
+#include "../client_state.h"
+#include "../global_funcs.h"
+#include "image_ops.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * @ETC2 RGB8 ENCODER:
+ *
+ * Turns a decoded RGBA8 image into ETC2 RGB8 blocks (4 bits per pixel, 8x
+ * smaller than RGBA8 on the GPU). Only the "individual" and "differential"
+ * block modes are emitted, never T/H/planar, which makes the output the
+ * ETC1-compatible subset of ETC2: the same bytes can be uploaded as
+ * GL_COMPRESSED_RGB8_ETC2 or, on plain GLES2 drivers, as GL_ETC1_RGB8_OES.
+ *
+ * This is a fast single-pass encoder: per 4x4 block both sub-block
+ * orientations are tried with the sub-block averages as base colours, and per
+ * sub-block the modifier table with the least squared error wins. Good enough
+ * for a full screen wallpaper, and it only ever runs once per wallpaper on a
+ * worker thread.
+ *
+ */
+
+#define ETC_BLOCK_BYTES 8
+
+static const int etc_modifier_table[8][2] = {
+  {2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106}, {47, 183},
+};
+
+static inline size_t etc_image_size(int width, int height)
+{
+  return (size_t)((width + 3) / 4) * ((height + 3) / 4) * ETC_BLOCK_BYTES;
+}
+
+static inline int etc_clamp255(int v)
+{
+  return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+// Pixel (x, y) of a block, fetched into pixels[x * 4 + y] (the ETC index order)
+static void etc_fetch_block(const struct decoded_image* image, int bx, int by, int pixels[16][3])
+{
+  for (int x = 0; x < 4; x++)
+  {
+    for (int y = 0; y < 4; y++)
+    {
+      int                  sx = ANVIL_MIN(bx + x, image->width - 1);
+      int                  sy = ANVIL_MIN(by + y, image->height - 1);
+      const unsigned char* px = image->pixels + ((size_t)sy * image->width + sx) * 4;
+      pixels[x * 4 + y][0]    = px[0];
+      pixels[x * 4 + y][1]    = px[1];
+      pixels[x * 4 + y][2]    = px[2];
+    }
+  }
+}
+
+static inline bool etc_in_subblock(int i, bool flip, int sub)
+{
+  int x = i / 4, y = i % 4;
+  return (flip ? y >= 2 : x >= 2) == (sub == 1);
+}
+
+/*
+ * Pick the modifier table for one sub-block around `base`, filling in the
+ * 2-bit index of each of its pixels. Returns the squared error.
+ */
+static uint32_t etc_fit_subblock(int pixels[16][3], const int base[3], bool flip, int sub,
+                                 int* table_out, uint8_t indices[16])
+{
+  uint32_t best_err = UINT32_MAX;
+
+  for (int t = 0; t < 8; t++)
+  {
+    int      a = etc_modifier_table[t][0], b = etc_modifier_table[t][1];
+    int      mods[4] = {a, b, -a, -b}; // index = (msb << 1) | lsb
+    uint32_t err     = 0;
+    uint8_t  picked[16];
+
+    for (int i = 0; i < 16 && err < best_err; i++)
+    {
+      if (!etc_in_subblock(i, flip, sub))
+      {
+        continue;
+      }
+
+      // Clamping at 0/255 makes a closed form unreliable, just try all four
+      uint32_t pixel_best = UINT32_MAX;
+      for (int m = 0; m < 4; m++)
+      {
+        uint32_t e = 0;
+        for (int c = 0; c < 3; c++)
+        {
+          int d = etc_clamp255(base[c] + mods[m]) - pixels[i][c];
+          e += d * d;
+        }
+        if (e < pixel_best)
+        {
+          pixel_best = e;
+          picked[i]  = m;
+        }
+      }
+      err += pixel_best;
+    }
+
+    if (err < best_err)
+    {
+      best_err   = err;
+      *table_out = t;
+      for (int i = 0; i < 16; i++)
+      {
+        if (etc_in_subblock(i, flip, sub))
+        {
+          indices[i] = picked[i];
+        }
+      }
+    }
+  }
+
+  return best_err;
+}
+
+static inline int etc_expand4(int v)
+{
+  return (v << 4) | v;
+}
+
+static inline int etc_expand5(int v)
+{
+  return (v << 3) | (v >> 2);
+}
+
+// Encode one block with a fixed orientation; returns its error and fills `out`
+static uint32_t etc_encode_block_flip(int pixels[16][3], bool flip, uint8_t out[ETC_BLOCK_BYTES])
+{
+  int sum[2][3] = {{0}};
+  for (int i = 0; i < 16; i++)
+  {
+    int sub = etc_in_subblock(i, flip, 1);
+    for (int c = 0; c < 3; c++)
+    {
+      sum[sub][c] += pixels[i][c];
+    }
+  }
+
+  // Differential mode: 5-bit base + 3-bit signed delta, if the averages are close enough
+  int  q[2][3], base[2][3];
+  bool diff = true;
+  for (int c = 0; c < 3; c++)
+  {
+    q[0][c] = (sum[0][c] * 31 + 8 * 255 / 2) / (8 * 255);
+    q[1][c] = (sum[1][c] * 31 + 8 * 255 / 2) / (8 * 255);
+    int d   = q[1][c] - q[0][c];
+    diff    = diff && d >= -4 && d <= 3;
+  }
+
+  for (int c = 0; c < 3; c++)
+  {
+    for (int s = 0; s < 2; s++)
+    {
+      if (diff)
+      {
+        base[s][c] = etc_expand5(q[s][c]);
+      }
+      else
+      {
+        // Individual mode: two independent 4-bit colours
+        q[s][c]    = (sum[s][c] * 15 + 8 * 255 / 2) / (8 * 255);
+        base[s][c] = etc_expand4(q[s][c]);
+      }
+    }
+  }
+
+  int      table[2];
+  uint8_t  indices[16];
+  uint32_t err = etc_fit_subblock(pixels, base[0], flip, 0, &table[0], indices) +
+                 etc_fit_subblock(pixels, base[1], flip, 1, &table[1], indices);
+
+  for (int c = 0; c < 3; c++)
+  {
+    out[c] = diff ? (uint8_t)((q[0][c] << 3) | ((q[1][c] - q[0][c]) & 7))
+                  : (uint8_t)((q[0][c] << 4) | q[1][c]);
+  }
+  out[3] = (uint8_t)((table[0] << 5) | (table[1] << 2) | (diff << 1) | flip);
+
+  uint32_t msb = 0, lsb = 0;
+  for (int i = 0; i < 16; i++)
+  {
+    msb |= (uint32_t)(indices[i] >> 1) << i;
+    lsb |= (uint32_t)(indices[i] & 1) << i;
+  }
+  out[4] = msb >> 8;
+  out[5] = msb & 0xFF;
+  out[6] = lsb >> 8;
+  out[7] = lsb & 0xFF;
+
+  return err;
+}
+
+// Total size of `levels` ETC levels of a width x height image
+static size_t etc_chain_size(int width, int height, int levels)
+{
+  size_t size = 0;
+  for (int level = 0; level < levels; level++)
+  {
+    size += etc_image_size(image_mip_dim(width, level), image_mip_dim(height, level));
+  }
+  return size;
+}
+
+static void etc_encode_level(const struct decoded_image* image, uint8_t* dst)
+{
+  for (int by = 0; by < image->height; by += 4)
+  {
+    for (int bx = 0; bx < image->width; bx += 4, dst += ETC_BLOCK_BYTES)
+    {
+      int pixels[16][3];
+      etc_fetch_block(image, bx, by, pixels);
+
+      uint8_t  flipped[ETC_BLOCK_BYTES];
+      uint32_t err_cols = etc_encode_block_flip(pixels, false, dst);
+      uint32_t err_rows = etc_encode_block_flip(pixels, true, flipped);
+      if (err_rows < err_cols)
+      {
+        memcpy(dst, flipped, ETC_BLOCK_BYTES);
+      }
+    }
+  }
+}
+
+/*
+ * Encode `base` and every level in `mips` (NULL for just the base) into
+ * `out->data`, malloc()'d and holding the levels back to back.
+ */
+static bool etc2_rgb8_encode(const struct decoded_image* base, const struct image_mips* mips,
+                             struct compressed_image* out)
+{
+  int    levels = mips ? mips->levels : 1;
+  size_t size   = etc_chain_size(base->width, base->height, levels);
+  out->data     = malloc(size);
+  if (!out->data)
+  {
+    return false;
+  }
+  out->size   = size;
+  out->width  = base->width;
+  out->height = base->height;
+  out->levels = levels;
+
+  uint8_t* dst = out->data;
+  for (int level = 0; level < levels; level++)
+  {
+    struct decoded_image image = image_mip_level(base, mips, level);
+    etc_encode_level(&image, dst);
+    dst += etc_image_size(image.width, image.height);
+  }
+
+  return true;
+}
+
+#endif // ETC_ENCODER_H
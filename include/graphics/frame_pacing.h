@@ -0,0 +1,126 @@
+#ifndef FRAME_PACING_H
+#define FRAME_PACING_H
+
+#include "../client_state.h"
+#include "../log.h"
+#include <EGL/egl.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+/*
+ * @FRAME PACING:
+ *
+ * With eglSwapInterval(1) a swap blocks in the driver until the compositor is
+ * ready for another frame, and whichever thread swapped sleeps there. Instead,
+ * every frame we hand over asks for a wl_surface frame callback, and no other
+ * frame is drawn until it arrives:
+ *
+ *   draw -> frame callback -> swap/commit ... done -> wake the renderer -> draw
+ *
+ * Input that arrives in between only updates the snapshot, so the frame that
+ * follows the callback shows the latest state and nothing is drawn only to be
+ * thrown away. [display] present_mode picks the swap interval on top of that:
+ *
+ *   mailbox   : interval 0, paced by frame callbacks (default)
+ *   fifo      : interval 1, paced by frame callbacks, the swap itself waits for vsync too
+ *   immediate : interval 0, no pacing, may draw frames that are never seen
+ *
+ * The callback is dispatched on the event loop, which wakes the render thread
+ * if it has one. That makes frame_callback the one thing both threads touch,
+ * so it is atomic, and the surface size reaches the render thread in the
+ * ui_snapshot instead.
+ *
+ */
+
+static bool frame_pacing_enabled(const struct client_state* state)
+{
+  return state->global_config.present_mode != PRESENT_MODE_IMMEDIATE;
+}
+
+// False while the last frame has not been picked up by the compositor yet
+static bool frame_pacing_ready(const struct client_state* state)
+{
+  return !atomic_load(&state->frame_pending);
+}
+
+static void frame_callback_done(void* data, struct wl_callback* callback, uint32_t time)
+{
+  (void)time;
+  struct client_state* state = data;
+
+  // The render thread only asks for another callback once frame_pending is cleared below
+  struct wl_callback* expected = callback;
+  atomic_compare_exchange_strong(&state->frame_callback, &expected, NULL);
+  wl_callback_destroy(callback);
+  atomic_store(&state->frame_pending, false);
+
+  // The event loop draws right after dispatching, only the render thread needs a nudge
+  if (state->render.running)
+  {
+    uint64_t one = 1;
+    if (write(state->render.wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+      log_message(LOG_LEVEL_ERROR, "[PACING] Failed to wake the render thread: %s",
+                  strerror(errno));
+    }
+  }
+}
+
+static const struct wl_callback_listener frame_callback_listener = {
+  .done = frame_callback_done,
+};
+
+// Right before the swap or commit that hands a frame to the compositor
+static void frame_pacing_request(struct client_state* state)
+{
+  if (!frame_pacing_enabled(state))
+  {
+    return;
+  }
+
+  // The wrapper only pins the new callback to the surface's queue when it is created, that is
+  // the default queue the event loop dispatches; no private queue is needed, as the done event
+  // only comes after the swap or commit that follows, when the listener is long set.
+  struct wl_surface* surface = wl_proxy_create_wrapper(state->wl_surface);
+  if (!surface)
+  {
+    log_message(LOG_LEVEL_ERROR, "[PACING] Failed to wrap the surface, frame is not paced");
+    return;
+  }
+  struct wl_callback* callback = wl_surface_frame(surface);
+  wl_proxy_wrapper_destroy(surface);
+  wl_callback_add_listener(callback, &frame_callback_listener, state);
+
+  atomic_store(&state->frame_pending, true);
+  atomic_store(&state->frame_callback, callback);
+}
+
+// With the EGL context current on the surface
+static void frame_pacing_set_swap_interval(struct client_state* state)
+{
+  EGLint interval = state->global_config.present_mode == PRESENT_MODE_FIFO ? 1 : 0;
+  if (!eglSwapInterval(state->egl_display, interval))
+  {
+    log_message(LOG_LEVEL_WARN, "[PACING] eglSwapInterval(%d) failed: 0x%x", interval,
+                eglGetError());
+    return;
+  }
+  log_message(LOG_LEVEL_DEBUG, "[PACING] Swap interval %d", interval);
+}
+
+// After the render thread is gone, a frame still on its way is not waited for
+static void frame_pacing_release(struct client_state* state)
+{
+  struct wl_callback* callback = atomic_exchange(&state->frame_callback, NULL);
+  if (callback)
+  {
+    wl_callback_destroy(callback);
+  }
+  atomic_store(&state->frame_pending, false);
+}
+
+#endif
@@ -0,0 +1,362 @@
+#ifndef IMAGE_OPS_H
+#define IMAGE_OPS_H
+
+#include "../client_state.h"
+#include "../global_funcs.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * @CPU IMAGE OPERATIONS:
+ *
+ * Small helpers that work on decoded RGBA8 images (struct decoded_image).
+ * None of them touch GL, so they are safe to run on the startup workers.
+ *
+ */
+
+// Area-average `src` down to dst_w x dst_h. `out->pixels` is malloc()'d.
+static bool image_downscale(const struct decoded_image* src, int dst_w, int dst_h,
+                            struct decoded_image* out)
+{
+  out->pixels = malloc((size_t)dst_w * dst_h * 4);
+  if (!out->pixels)
+  {
+    return false;
+  }
+  out->width  = dst_w;
+  out->height = dst_h;
+
+  for (int dy = 0; dy < dst_h; dy++)
+  {
+    int y0 = (int)((int64_t)dy * src->height / dst_h);
+    int y1 = ANVIL_MAX(y0 + 1, (int)((int64_t)(dy + 1) * src->height / dst_h));
+
+    for (int dx = 0; dx < dst_w; dx++)
+    {
+      int x0 = (int)((int64_t)dx * src->width / dst_w);
+      int x1 = ANVIL_MAX(x0 + 1, (int)((int64_t)(dx + 1) * src->width / dst_w));
+
+      uint64_t sum[4] = {0};
+      for (int y = y0; y < y1; y++)
+      {
+        const unsigned char* row = src->pixels + ((size_t)y * src->width + x0) * 4;
+        for (int x = x0; x < x1; x++, row += 4)
+        {
+          sum[0] += row[0];
+          sum[1] += row[1];
+          sum[2] += row[2];
+          sum[3] += row[3];
+        }
+      }
+
+      uint64_t       count = (uint64_t)(x1 - x0) * (y1 - y0);
+      unsigned char* dst   = out->pixels + ((size_t)dy * dst_w + dx) * 4;
+      for (int c = 0; c < 4; c++)
+      {
+        dst[c] = (unsigned char)((sum[c] + count / 2) / count);
+      }
+    }
+  }
+
+  return true;
+}
+
+// 8.24 fixed point reciprocal of a box window, so averaging is a multiply and a shift
+static inline uint32_t image_box_inv(int window)
+{
+  return ((1u << 24) + window / 2) / window;
+}
+
+// One horizontal box blur pass over a row of `len` pixels, edges clamped
+static void image_box_blur_row(unsigned char* line, unsigned char* tmp, int len, int radius)
+{
+  memcpy(tmp, line, (size_t)len * 4);
+
+  uint32_t inv    = image_box_inv(radius * 2 + 1);
+  uint32_t sum[4] = {0};
+  for (int k = -radius; k <= radius; k++)
+  {
+    const unsigned char* px = tmp + (size_t)ANVIL_CLAMP(k, 0, len - 1) * 4;
+    for (int c = 0; c < 4; c++)
+    {
+      sum[c] += px[c];
+    }
+  }
+
+  for (int i = 0; i < len; i++)
+  {
+    unsigned char* dst = line + (size_t)i * 4;
+    for (int c = 0; c < 4; c++)
+    {
+      dst[c] = (unsigned char)((sum[c] * inv + (1u << 23)) >> 24);
+    }
+
+    const unsigned char* out = tmp + (size_t)ANVIL_CLAMP(i - radius, 0, len - 1) * 4;
+    const unsigned char* in  = tmp + (size_t)ANVIL_CLAMP(i + radius + 1, 0, len - 1) * 4;
+    for (int c = 0; c < 4; c++)
+    {
+      sum[c] += in[c] - out[c];
+    }
+  }
+}
+
+/*
+ * One vertical box blur pass. Rather than walking columns (a cache miss per
+ * pixel on a large image), whole rows are added to and removed from running
+ * per-column sums, so every loop is a straight, auto-vectorizable walk over
+ * contiguous bytes. `ring` keeps the original of the last radius + 1 rows,
+ * which are overwritten by then. `sum` is one uint32_t per byte of a row.
+ */
+static void image_box_blur_columns(struct decoded_image* image, int radius, uint32_t* sum,
+                                   unsigned char* ring)
+{
+  size_t         stride    = (size_t)image->width * 4;
+  int            height    = image->height;
+  int            ring_rows = radius + 1;
+  uint32_t       inv       = image_box_inv(radius * 2 + 1);
+  unsigned char* pixels    = image->pixels;
+
+  memset(sum, 0, stride * sizeof(*sum));
+  for (int k = -radius; k <= radius; k++)
+  {
+    const unsigned char* row = pixels + (size_t)ANVIL_CLAMP(k, 0, height - 1) * stride;
+    for (size_t i = 0; i < stride; i++)
+    {
+      sum[i] += row[i];
+    }
+  }
+
+  for (int y = 0; y < height; y++)
+  {
+    unsigned char* row = pixels + (size_t)y * stride;
+    memcpy(ring + (size_t)(y % ring_rows) * stride, row, stride);
+    for (size_t i = 0; i < stride; i++)
+    {
+      row[i] = (unsigned char)((sum[i] * inv + (1u << 23)) >> 24);
+    }
+
+    const unsigned char* out = ring + (size_t)(ANVIL_MAX(y - radius, 0) % ring_rows) * stride;
+    const unsigned char* in  = pixels + (size_t)ANVIL_MIN(y + radius + 1, height - 1) * stride;
+    for (size_t i = 0; i < stride; i++)
+    {
+      sum[i] += in[i] - out[i];
+    }
+  }
+}
+
+// Approximate gaussian blur in place: `passes` separable box blurs of `radius`
+static bool image_box_blur(struct decoded_image* image, int radius, int passes)
+{
+  if (radius <= 0)
+  {
+    return true;
+  }
+
+  size_t         stride = (size_t)image->width * 4;
+  unsigned char* tmp    = malloc(stride);
+  unsigned char* ring   = malloc(stride * (radius + 1));
+  uint32_t*      sum    = malloc(stride * sizeof(uint32_t));
+  if (!tmp || !ring || !sum)
+  {
+    free(tmp);
+    free(ring);
+    free(sum);
+    return false;
+  }
+
+  for (int pass = 0; pass < passes; pass++)
+  {
+    for (int y = 0; y < image->height; y++)
+    {
+      image_box_blur_row(image->pixels + y * stride, tmp, image->width, radius);
+    }
+    image_box_blur_columns(image, radius, sum, ring);
+  }
+
+  free(tmp);
+  free(ring);
+  free(sum);
+  return true;
+}
+
+static inline float image_smoothstep(float edge0, float edge1, float x)
+{
+  float t = ANVIL_CLAMP((x - edge0) / (edge1 - edge0), 0.0f, 1.0f);
+  return t * t * (3.0f - 2.0f * t);
+}
+
+/*
+ * Bake the [bg] effects into `image`: blur first, then desaturate, dim and
+ * vignette in one pass over the pixels.
+ */
+static bool image_apply_effects(struct decoded_image* image, const struct bg_effects* fx)
+{
+  if (!image_box_blur(image, fx->blur_radius, 3))
+  {
+    return false;
+  }
+
+  if (fx->dim <= 0.0f && fx->vignette <= 0.0f && fx->desaturate <= 0.0f)
+  {
+    return true;
+  }
+
+  float cx = (image->width - 1) * 0.5f, cy = (image->height - 1) * 0.5f;
+  float inv_corner = 1.0f / ANVIL_MAX(sqrtf(cx * cx + cy * cy), 1.0f);
+
+  for (int y = 0; y < image->height; y++)
+  {
+    unsigned char* px = image->pixels + (size_t)y * image->width * 4;
+    float          dy = (y - cy) * inv_corner;
+    for (int x = 0; x < image->width; x++, px += 4)
+    {
+      float dx    = (x - cx) * inv_corner;
+      float scale = 1.0f - fx->dim;
+      if (fx->vignette > 0.0f)
+      {
+        scale *= 1.0f - fx->vignette * image_smoothstep(0.4f, 1.0f, sqrtf(dx * dx + dy * dy));
+      }
+
+      float luma = 0.2126f * px[0] + 0.7152f * px[1] + 0.0722f * px[2];
+      for (int c = 0; c < 3; c++)
+      {
+        float v = px[c] + (luma - px[c]) * fx->desaturate;
+        px[c]   = (unsigned char)ANVIL_CLAMP(v * scale + 0.5f, 0.0f, 255.0f);
+      }
+    }
+  }
+
+  return true;
+}
+
+/*
+ * sRGB <-> linear light, so averaging pixels (mip levels) does not darken
+ * edges and highlights the way averaging the encoded values does.
+ * Linear values are 12 bit.
+ */
+static uint16_t       srgb_to_linear_lut[256];
+static uint8_t        linear_to_srgb_lut[4096];
+static pthread_once_t srgb_lut_once = PTHREAD_ONCE_INIT;
+
+static void srgb_lut_init(void)
+{
+  for (int i = 0; i < 256; i++)
+  {
+    float c               = i / 255.0f;
+    float l               = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+    srgb_to_linear_lut[i] = (uint16_t)(l * 4095.0f + 0.5f);
+  }
+  for (int i = 0; i < 4096; i++)
+  {
+    float l               = i / 4095.0f;
+    float c               = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+    linear_to_srgb_lut[i] = (uint8_t)(c * 255.0f + 0.5f);
+  }
+}
+
+static inline int image_mip_count(int width, int height)
+{
+  int levels = 1;
+  for (int size = ANVIL_MAX(width, height); size > 1; size >>= 1)
+  {
+    levels++;
+  }
+  return levels;
+}
+
+static inline int image_mip_dim(int base, int level)
+{
+  return ANVIL_MAX(1, base >> level);
+}
+
+// Byte offset of `level` (>= 1) inside image_mips.data
+static size_t image_mip_offset(int width, int height, int level)
+{
+  size_t offset = 0;
+  for (int l = 1; l < level; l++)
+  {
+    offset += (size_t)image_mip_dim(width, l) * image_mip_dim(height, l) * 4;
+  }
+  return offset;
+}
+
+// One level down: 2x2 box filter in linear light, edges clamped for odd sizes
+static void image_halve_srgb(const unsigned char* src, int sw, int sh, unsigned char* dst, int dw,
+                             int dh)
+{
+  for (int y = 0; y < dh; y++)
+  {
+    const unsigned char* row0 = src + (size_t)ANVIL_MIN(y * 2, sh - 1) * sw * 4;
+    const unsigned char* row1 = src + (size_t)ANVIL_MIN(y * 2 + 1, sh - 1) * sw * 4;
+    for (int x = 0; x < dw; x++, dst += 4)
+    {
+      int x0 = ANVIL_MIN(x * 2, sw - 1) * 4;
+      int x1 = ANVIL_MIN(x * 2 + 1, sw - 1) * 4;
+      for (int c = 0; c < 3; c++)
+      {
+        int sum = srgb_to_linear_lut[row0[x0 + c]] + srgb_to_linear_lut[row0[x1 + c]] +
+                  srgb_to_linear_lut[row1[x0 + c]] + srgb_to_linear_lut[row1[x1 + c]];
+        dst[c]  = linear_to_srgb_lut[(sum + 2) >> 2];
+      }
+      dst[3] = (row0[x0 + 3] + row0[x1 + 3] + row1[x0 + 3] + row1[x1 + 3] + 2) >> 2;
+    }
+  }
+}
+
+// Build the full chain down to 1x1 (GLES2 only samples complete chains)
+static bool image_build_mips(const struct decoded_image* base, struct image_mips* out)
+{
+  out->levels = image_mip_count(base->width, base->height);
+  out->data   = NULL;
+  if (out->levels == 1)
+  {
+    return true;
+  }
+
+  out->data = malloc(image_mip_offset(base->width, base->height, out->levels));
+  if (!out->data)
+  {
+    out->levels = 1;
+    return false;
+  }
+
+  pthread_once(&srgb_lut_once, srgb_lut_init);
+
+  const unsigned char* src = base->pixels;
+  int                  sw = base->width, sh = base->height;
+  for (int level = 1; level < out->levels; level++)
+  {
+    unsigned char* dst = out->data + image_mip_offset(base->width, base->height, level);
+    int            dw  = image_mip_dim(base->width, level);
+    int            dh  = image_mip_dim(base->height, level);
+    image_halve_srgb(src, sw, sh, dst, dw, dh);
+    src = dst;
+    sw  = dw;
+    sh  = dh;
+  }
+
+  return true;
+}
+
+// View of one level as a decoded_image (level 0 is the base itself)
+static struct decoded_image image_mip_level(const struct decoded_image* base,
+                                            const struct image_mips* mips, int level)
+{
+  if (level == 0)
+  {
+    return *base;
+  }
+
+  struct decoded_image view = {
+    .pixels = mips->data + image_mip_offset(base->width, base->height, level),
+    .width  = image_mip_dim(base->width, level),
+    .height = image_mip_dim(base->height, level),
+  };
+  return view;
+}
+
+#endif // IMAGE_OPS_H
@@ -0,0 +1,93 @@
+#ifndef KEYPAD_H
+#define KEYPAD_H
+
+#include "../client_state.h"
+#include "../global_funcs.h"
+#include <stdbool.h>
+
+/*
+ * @PIN KEYPAD:
+ *
+ * Locked in tablet mode there is no keyboard to type on, so while the seat
+ * has a touchscreen a 3x4 keypad sits above the password field:
+ *
+ *   [1] [2] [3]
+ *   [4] [5] [6]
+ *   [7] [8] [9]
+ *   [Del] [0] [OK]
+ *
+ * The layout is a pure function of the surface size. The touch handler lays
+ * it out at the lock surface size to hit test against, the renderers at
+ * their buffer size to draw and damage it; both get the same rectangles and
+ * neither allocates.
+ *
+ */
+
+#define KEYPAD_BACKSPACE   '\b'
+#define KEYPAD_ENTER       '\n'
+#define KEYPAD_LABEL_CHARS "0123456789DelOK" // rasterised up front by the font task
+#define KEYPAD_KEY_ALPHA     0x40             // key backgrounds darken what is behind them
+#define KEYPAD_PRESSED_ALPHA 0x80
+
+static const struct
+{
+  const char* label;
+  char        input;
+} keypad_keys[KEYPAD_KEYS] = {
+  {"1", '1'},                {"2", '2'}, {"3", '3'},
+  {"4", '4'},                {"5", '5'}, {"6", '6'},
+  {"7", '7'},                {"8", '8'}, {"9", '9'},
+  {"Del", KEYPAD_BACKSPACE}, {"0", '0'}, {"OK", KEYPAD_ENTER},
+};
+
+// Lay the keypad out for a width x height surface; false if it already was
+static bool keypad_layout_update(struct keypad_layout* layout, int width, int height)
+{
+  if (layout->width == width && layout->height == height)
+  {
+    return false;
+  }
+  layout->width  = width;
+  layout->height = height;
+
+  // Square keys a ninth of the shorter side, the grid ends just above the password field
+  int side   = ANVIL_CLAMP(ANVIL_MIN(width, height) / 9, 40, 96);
+  int gap    = side / 4;
+  int grid_w = 3 * side + 2 * gap;
+  int grid_h = 4 * side + 3 * gap;
+  int x0     = (width - grid_w) / 2;
+  int y0     = ANVIL_MAX((int)(height * 0.80f) - grid_h, 0);
+
+  layout->bounds = (struct damage_rect){x0, y0, x0 + grid_w, y0 + grid_h};
+  for (int i = 0; i < KEYPAD_KEYS; i++)
+  {
+    struct keypad_key* key = &layout->keys[i];
+    int                x   = x0 + (i % 3) * (side + gap);
+    int                y   = y0 + (i / 3) * (side + gap);
+    key->rect              = (struct damage_rect){x, y, x + side, y + side};
+    key->label             = keypad_keys[i].label;
+    key->input             = keypad_keys[i].input;
+  }
+  return true;
+}
+
+// Key under (x, y) as an index + 1, 0 if none
+static int keypad_hit_test(const struct keypad_layout* layout, int x, int y)
+{
+  const struct damage_rect* bounds = &layout->bounds;
+  if (x < bounds->x0 || x >= bounds->x1 || y < bounds->y0 || y >= bounds->y1)
+  {
+    return 0;
+  }
+  for (int i = 0; i < KEYPAD_KEYS; i++)
+  {
+    const struct damage_rect* rect = &layout->keys[i].rect;
+    if (x >= rect->x0 && x < rect->x1 && y >= rect->y0 && y < rect->y1)
+    {
+      return i + 1;
+    }
+  }
+  return 0; // in a gap between keys
+}
+
+#endif
@@ -0,0 +1,419 @@
+#ifndef PIXEL_KERNELS_H
+#define PIXEL_KERNELS_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define PX_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PX_NEON 1
+#endif
+
+/*
+ * @PIXEL KERNELS:
+ *
+ * Span kernels for the software renderer (soft_render.h). Everything works on
+ * 32 bit pixels; the blends treat all four bytes alike, so they serve RGBA8
+ * and XRGB8888 the same way.
+ *
+ *   convert:     swap R and B and make the pixel opaque (RGBA8 <-> XRGB8888)
+ *   blend:       src over dst with a constant alpha (the background crossfade)
+ *   fill_blend:  a solid colour over dst with a constant alpha (field, dots)
+ *   mask_blend:  a solid colour over dst through an 8 bit coverage mask (text)
+ *
+ * Every blend is dst + (src - dst) * a / 255 with exact rounding, and the
+ * SIMD versions produce bit-identical results to the scalar ones:
+ *
+ *   t = src * a + dst * (255 - a) + 128;   out = (t + (t >> 8)) >> 8
+ *
+ * SSE2 is the x86_64 baseline and NEON is mandatory on aarch64, so those are
+ * picked at compile time; AVX2 is chosen at runtime when the CPU has it.
+ *
+ */
+
+struct pixel_kernels
+{
+  const char* name;
+  void (*convert)(uint32_t* dst, const uint32_t* src, int n);
+  void (*blend)(uint32_t* dst, const uint32_t* src, int n, uint8_t alpha);
+  void (*fill_blend)(uint32_t* dst, int n, uint32_t color, uint8_t alpha);
+  void (*mask_blend)(uint32_t* dst, const uint8_t* mask, int n, uint32_t color, uint8_t alpha);
+};
+
+static struct pixel_kernels px_kernels;
+
+static inline uint32_t px_div255(uint32_t t)
+{
+  t += 128;
+  return (t + (t >> 8)) >> 8;
+}
+
+// px_div255() on two 16 bit lanes at once, a lane never carries into the next
+static inline uint32_t px_div255_x2(uint32_t t)
+{
+  t += 0x00800080u;
+  return ((t + ((t >> 8) & 0x00FF00FFu)) >> 8) & 0x00FF00FFu;
+}
+
+// One pixel, two channels per multiply
+static inline uint32_t px_lerp(uint32_t dst, uint32_t src, uint32_t a)
+{
+  uint32_t ia = 255 - a;
+  uint32_t rb = (src & 0x00FF00FFu) * a + (dst & 0x00FF00FFu) * ia;
+  uint32_t ag = ((src >> 8) & 0x00FF00FFu) * a + ((dst >> 8) & 0x00FF00FFu) * ia;
+  return px_div255_x2(rb) | (px_div255_x2(ag) << 8);
+}
+
+static inline uint32_t px_swap_rb(uint32_t p)
+{
+  return 0xFF000000u | ((p & 0xFF) << 16) | (p & 0xFF00) | ((p >> 16) & 0xFF);
+}
+
+static void px_convert_scalar(uint32_t* dst, const uint32_t* src, int n)
+{
+  for (int i = 0; i < n; i++)
+  {
+    dst[i] = px_swap_rb(src[i]);
+  }
+}
+
+static void px_blend_scalar(uint32_t* dst, const uint32_t* src, int n, uint8_t alpha)
+{
+  for (int i = 0; i < n; i++)
+  {
+    dst[i] = px_lerp(dst[i], src[i], alpha);
+  }
+}
+
+static void px_fill_blend_scalar(uint32_t* dst, int n, uint32_t color, uint8_t alpha)
+{
+  for (int i = 0; i < n; i++)
+  {
+    dst[i] = px_lerp(dst[i], color, alpha);
+  }
+}
+
+static void px_mask_blend_scalar(uint32_t* dst, const uint8_t* mask, int n, uint32_t color,
+                                 uint8_t alpha)
+{
+  for (int i = 0; i < n; i++)
+  {
+    if (mask[i])
+    {
+      dst[i] = px_lerp(dst[i], color, px_div255((uint32_t)mask[i] * alpha));
+    }
+  }
+}
+
+#if PX_X86
+
+/* SSE2: 4 pixels per step, widened to 16 bit lanes two pixels at a time */
+
+// Two pixels widened to 16 bit lanes
+static inline __m128i px_sse2_lerp16(__m128i dst, __m128i src, __m128i a)
+{
+  __m128i ia = _mm_sub_epi16(_mm_set1_epi16(255), a);
+  __m128i t  = _mm_add_epi16(_mm_mullo_epi16(src, a), _mm_mullo_epi16(dst, ia));
+  t          = _mm_add_epi16(t, _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+// `a` holds the alpha of each pixel in all four of its bytes
+static inline __m128i px_sse2_lerp(__m128i dst, __m128i src, __m128i a)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i       lo   = px_sse2_lerp16(_mm_unpacklo_epi8(dst, zero), _mm_unpacklo_epi8(src, zero),
+                                      _mm_unpacklo_epi8(a, zero));
+  __m128i       hi   = px_sse2_lerp16(_mm_unpackhi_epi8(dst, zero), _mm_unpackhi_epi8(src, zero),
+                                      _mm_unpackhi_epi8(a, zero));
+  return _mm_packus_epi16(lo, hi);
+}
+
+static void px_convert_sse2(uint32_t* dst, const uint32_t* src, int n)
+{
+  const __m128i g      = _mm_set1_epi32(0x0000FF00);
+  const __m128i rb     = _mm_set1_epi32(0x000000FF);
+  const __m128i opaque = _mm_set1_epi32((int)0xFF000000u);
+  int           i      = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    __m128i p = _mm_loadu_si128((const __m128i*)(src + i));
+    __m128i r = _mm_or_si128(_mm_and_si128(p, g), opaque);
+    r         = _mm_or_si128(r, _mm_slli_epi32(_mm_and_si128(p, rb), 16));
+    r         = _mm_or_si128(r, _mm_and_si128(_mm_srli_epi32(p, 16), rb));
+    _mm_storeu_si128((__m128i*)(dst + i), r);
+  }
+  px_convert_scalar(dst + i, src + i, n - i);
+}
+
+static void px_blend_sse2(uint32_t* dst, const uint32_t* src, int n, uint8_t alpha)
+{
+  const __m128i a = _mm_set1_epi8((char)alpha);
+  int           i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+    __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+    _mm_storeu_si128((__m128i*)(dst + i), px_sse2_lerp(d, s, a));
+  }
+  px_blend_scalar(dst + i, src + i, n - i, alpha);
+}
+
+static void px_fill_blend_sse2(uint32_t* dst, int n, uint32_t color, uint8_t alpha)
+{
+  const __m128i a = _mm_set1_epi8((char)alpha);
+  const __m128i s = _mm_set1_epi32((int)color);
+  int           i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+    _mm_storeu_si128((__m128i*)(dst + i), px_sse2_lerp(d, s, a));
+  }
+  px_fill_blend_scalar(dst + i, n - i, color, alpha);
+}
+
+static void px_mask_blend_sse2(uint32_t* dst, const uint8_t* mask, int n, uint32_t color,
+                               uint8_t alpha)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i s    = _mm_set1_epi32((int)color);
+  const __m128i mul  = _mm_set1_epi16(alpha);
+  const __m128i c128 = _mm_set1_epi16(128);
+  int           i    = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    uint32_t m4;
+    memcpy(&m4, mask + i, 4);
+    if (!m4)
+    {
+      continue; // most of a text box is empty
+    }
+
+    // coverage * alpha / 255 per pixel, then spread over the pixel's four bytes
+    __m128i m = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)m4), zero);
+    m         = _mm_add_epi16(_mm_mullo_epi16(m, mul), c128);
+    m         = _mm_srli_epi16(_mm_add_epi16(m, _mm_srli_epi16(m, 8)), 8);
+    m         = _mm_unpacklo_epi16(m, zero);
+    m         = _mm_or_si128(m, _mm_slli_epi32(m, 8));
+    m         = _mm_or_si128(m, _mm_slli_epi32(m, 16));
+
+    __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+    _mm_storeu_si128((__m128i*)(dst + i), px_sse2_lerp(d, s, m));
+  }
+  px_mask_blend_scalar(dst + i, mask + i, n - i, color, alpha);
+}
+
+/* AVX2: the same in 256 bit registers, 8 pixels per step */
+
+#define PX_AVX2 __attribute__((target("avx2")))
+
+static PX_AVX2 inline __m256i px_avx2_lerp16(__m256i dst, __m256i src, __m256i a)
+{
+  __m256i ia = _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+  __m256i t  = _mm256_add_epi16(_mm256_mullo_epi16(src, a), _mm256_mullo_epi16(dst, ia));
+  t          = _mm256_add_epi16(t, _mm256_set1_epi16(128));
+  return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+// Unpack and pack both work within 128 bit lanes, so the pixel order survives
+static PX_AVX2 inline __m256i px_avx2_lerp(__m256i dst, __m256i src, __m256i a)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i lo = px_avx2_lerp16(_mm256_unpacklo_epi8(dst, zero), _mm256_unpacklo_epi8(src, zero),
+                              _mm256_unpacklo_epi8(a, zero));
+  __m256i hi = px_avx2_lerp16(_mm256_unpackhi_epi8(dst, zero), _mm256_unpackhi_epi8(src, zero),
+                              _mm256_unpackhi_epi8(a, zero));
+  return _mm256_packus_epi16(lo, hi);
+}
+
+static PX_AVX2 void px_convert_avx2(uint32_t* dst, const uint32_t* src, int n)
+{
+  // Per 128 bit lane, bytes 0..3 of each pixel become 2,1,0 and an opaque 3
+  const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1,
+                                           2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1);
+  const __m256i opaque  = _mm256_set1_epi32((int)0xFF000000u);
+  int           i       = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    __m256i p = _mm256_loadu_si256((const __m256i*)(src + i));
+    p         = _mm256_or_si256(_mm256_shuffle_epi8(p, shuffle), opaque);
+    _mm256_storeu_si256((__m256i*)(dst + i), p);
+  }
+  px_convert_scalar(dst + i, src + i, n - i);
+}
+
+static PX_AVX2 void px_blend_avx2(uint32_t* dst, const uint32_t* src, int n, uint8_t alpha)
+{
+  const __m256i a = _mm256_set1_epi8((char)alpha);
+  int           i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+    __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+    _mm256_storeu_si256((__m256i*)(dst + i), px_avx2_lerp(d, s, a));
+  }
+  px_blend_scalar(dst + i, src + i, n - i, alpha);
+}
+
+static PX_AVX2 void px_fill_blend_avx2(uint32_t* dst, int n, uint32_t color, uint8_t alpha)
+{
+  const __m256i a = _mm256_set1_epi8((char)alpha);
+  const __m256i s = _mm256_set1_epi32((int)color);
+  int           i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+    _mm256_storeu_si256((__m256i*)(dst + i), px_avx2_lerp(d, s, a));
+  }
+  px_fill_blend_scalar(dst + i, n - i, color, alpha);
+}
+
+static PX_AVX2 void px_mask_blend_avx2(uint32_t* dst, const uint8_t* mask, int n, uint32_t color,
+                                       uint8_t alpha)
+{
+  const __m256i s      = _mm256_set1_epi32((int)color);
+  const __m256i mul    = _mm256_set1_epi32(alpha);
+  const __m256i c128   = _mm256_set1_epi32(128);
+  const __m256i spread = _mm256_set1_epi32(0x01010101);
+  int           i      = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    uint64_t m8;
+    memcpy(&m8, mask + i, 8);
+    if (!m8)
+    {
+      continue;
+    }
+
+    __m256i m = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(mask + i)));
+    m         = _mm256_add_epi32(_mm256_mullo_epi32(m, mul), c128);
+    m         = _mm256_srli_epi32(_mm256_add_epi32(m, _mm256_srli_epi32(m, 8)), 8);
+    m         = _mm256_mullo_epi32(m, spread);
+
+    __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+    _mm256_storeu_si256((__m256i*)(dst + i), px_avx2_lerp(d, s, m));
+  }
+  px_mask_blend_scalar(dst + i, mask + i, n - i, color, alpha);
+}
+
+#elif PX_NEON
+
+/* NEON: 4 pixels per step, vmull/vmlal widen and vraddhn narrows with the same rounding */
+
+static inline uint8x16_t px_neon_lerp(uint8x16_t dst, uint8x16_t src, uint8x16_t a)
+{
+  uint8x16_t ia = vmvnq_u8(a); // 255 - a
+  uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(src), vget_low_u8(a)), vget_low_u8(dst),
+                           vget_low_u8(ia));
+  uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(src), vget_high_u8(a)), vget_high_u8(dst),
+                           vget_high_u8(ia));
+  return vcombine_u8(vraddhn_u16(lo, vrshrq_n_u16(lo, 8)), vraddhn_u16(hi, vrshrq_n_u16(hi, 8)));
+}
+
+static void px_convert_neon(uint32_t* dst, const uint32_t* src, int n)
+{
+  int i = 0;
+  for (; i + 16 <= n; i += 16)
+  {
+    uint8x16x4_t p = vld4q_u8((const uint8_t*)(src + i));
+    uint8x16_t   r = p.val[0];
+    p.val[0]       = p.val[2];
+    p.val[2]       = r;
+    p.val[3]       = vdupq_n_u8(0xFF);
+    vst4q_u8((uint8_t*)(dst + i), p);
+  }
+  px_convert_scalar(dst + i, src + i, n - i);
+}
+
+static void px_blend_neon(uint32_t* dst, const uint32_t* src, int n, uint8_t alpha)
+{
+  const uint8x16_t a = vdupq_n_u8(alpha);
+  int              i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    uint8x16_t d = vld1q_u8((const uint8_t*)(dst + i));
+    uint8x16_t s = vld1q_u8((const uint8_t*)(src + i));
+    vst1q_u8((uint8_t*)(dst + i), px_neon_lerp(d, s, a));
+  }
+  px_blend_scalar(dst + i, src + i, n - i, alpha);
+}
+
+static void px_fill_blend_neon(uint32_t* dst, int n, uint32_t color, uint8_t alpha)
+{
+  const uint8x16_t a = vdupq_n_u8(alpha);
+  const uint8x16_t s = vreinterpretq_u8_u32(vdupq_n_u32(color));
+  int              i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    uint8x16_t d = vld1q_u8((const uint8_t*)(dst + i));
+    vst1q_u8((uint8_t*)(dst + i), px_neon_lerp(d, s, a));
+  }
+  px_fill_blend_scalar(dst + i, n - i, color, alpha);
+}
+
+static void px_mask_blend_neon(uint32_t* dst, const uint8_t* mask, int n, uint32_t color,
+                               uint8_t alpha)
+{
+  const uint8x16_t s = vreinterpretq_u8_u32(vdupq_n_u32(color));
+  const uint8x8_t  a = vdup_n_u8(alpha);
+  int              i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    uint8x8_t m = vld1_u8(mask + i);
+    if (!vget_lane_u64(vreinterpret_u64_u8(m), 0))
+    {
+      continue;
+    }
+
+    // coverage * alpha / 255, then each pixel's alpha repeated over its four bytes
+    uint16x8_t   t  = vmull_u8(m, a);
+    uint8x8_t    ma = vraddhn_u16(t, vrshrq_n_u16(t, 8));
+    uint8x8x2_t  z  = vzip_u8(ma, ma);
+    uint16x4x2_t lo = vzip_u16(vreinterpret_u16_u8(z.val[0]), vreinterpret_u16_u8(z.val[0]));
+    uint16x4x2_t hi = vzip_u16(vreinterpret_u16_u8(z.val[1]), vreinterpret_u16_u8(z.val[1]));
+
+    uint8x16_t d0 = vld1q_u8((const uint8_t*)(dst + i));
+    uint8x16_t d1 = vld1q_u8((const uint8_t*)(dst + i + 4));
+    uint8x16_t a0 = vreinterpretq_u8_u16(vcombine_u16(lo.val[0], lo.val[1]));
+    uint8x16_t a1 = vreinterpretq_u8_u16(vcombine_u16(hi.val[0], hi.val[1]));
+    vst1q_u8((uint8_t*)(dst + i), px_neon_lerp(d0, s, a0));
+    vst1q_u8((uint8_t*)(dst + i + 4), px_neon_lerp(d1, s, a1));
+  }
+  px_mask_blend_scalar(dst + i, mask + i, n - i, color, alpha);
+}
+
+#endif
+
+static pthread_once_t pixel_kernels_once = PTHREAD_ONCE_INIT;
+
+static void pixel_kernels_select(void)
+{
+  struct pixel_kernels kernels = {"scalar", px_convert_scalar, px_blend_scalar,
+                                  px_fill_blend_scalar, px_mask_blend_scalar};
+#if PX_X86
+  kernels = (struct pixel_kernels){"sse2", px_convert_sse2, px_blend_sse2, px_fill_blend_sse2,
+                                   px_mask_blend_sse2};
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    kernels = (struct pixel_kernels){"avx2", px_convert_avx2, px_blend_avx2, px_fill_blend_avx2,
+                                     px_mask_blend_avx2};
+  }
+#elif PX_NEON
+  kernels = (struct pixel_kernels){"neon", px_convert_neon, px_blend_neon, px_fill_blend_neon,
+                                   px_mask_blend_neon};
+#endif
+  px_kernels = kernels;
+}
+
+// Pick the widest kernels this CPU runs, `px_kernels` is usable afterwards
+static void pixel_kernels_init(void)
+{
+  pthread_once(&pixel_kernels_once, pixel_kernels_select);
+}
+
+#endif // PIXEL_KERNELS_H
@@ -0,0 +1,263 @@
+#ifndef RENDER_THREAD_H
+#define RENDER_THREAD_H
+
+#include "../client_state.h"
+#include "../config/config.h"
+#include "../global_funcs.h"
+#include "../log.h"
+#include "../startup/startup.h"
+#include "../utf8.h"
+#include "damage.h"
+#include "frame_pacing.h"
+#include <EGL/egl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * @RENDER THREAD:
+ *
+ * Once init_egl() drew the first frame, the EGL context moves to a thread of
+ * its own and every later frame is drawn there. Texture uploads, shader
+ * compiles and swaps blocked on vsync then never hold up reading the next key.
+ *
+ *   event loop:     key -> password buffer -> ui_snapshot -> post -> wake_fd
+ *   render thread:  wake_fd -> take latest -> stream assets -> damage -> draw -> swap
+ *
+ * The event loop never shares anything else with the render thread: a
+ * ui_snapshot is a copy of everything the lock screen shows that comes from
+ * input (password length, failed attempt, clock string, surface size), and the render thread
+ * only ever reads the copy it took. Snapshots go through a triple buffer with
+ * one atomic exchange on each side, so neither thread ever waits on the other;
+ * snapshots posted faster than frames are drawn are simply skipped.
+ *
+ * The render thread sleeps in poll() on the wake eventfd, which frame
+ * callbacks also write to (see frame_pacing.h), with a frame interval timeout
+ * while the background crossfade runs. The software renderer
+ * is cheap enough to stay on the event loop and draws the snapshot directly.
+ *
+ */
+
+#define AUTH_FAIL_SHOWN_NS 1000000000ULL // how long a failed attempt shows the red border
+
+// Drawing itself lives in egl.h
+static void egl_render_frame(struct client_state* state);
+static void egl_fit_window(struct client_state* state, int width, int height);
+static bool render_is_animating(const struct client_state* state);
+
+// Show a failed attempt on the next frames, without holding up input for it
+static void ui_show_auth_failure(struct client_state* state)
+{
+  state->pam.auth_state.fail_until_ns = startup_now_ns() + AUTH_FAIL_SHOWN_NS;
+}
+
+static void ui_snapshot_build(const struct client_state* state, struct ui_snapshot* snapshot)
+{
+  snapshot->password_length    = utf8_strlen(state->pam.password); // one dot per codepoint
+  snapshot->auth_failed        = startup_now_ns() < state->pam.auth_state.fail_until_ns;
+  snapshot->configures         = state->session_lock.configures;
+  snapshot->pointer_hover      = state->pointer_regions.hovered;
+  snapshot->pointer_hover_rect = state->pointer_regions.hovered_rect;
+  snapshot->keypad_visible     = state->touch.seat_touch;
+  snapshot->keypad_pressed     = state->touch.pressed;
+  snapshot->width              = state->output_state.width;
+  snapshot->height             = state->output_state.height;
+  snapshot->time_str[0]        = '\0'; // no clock without a config (the placeholder)
+  if (global_config.time_format)
+  {
+    get_time_string(snapshot->time_str, sizeof(snapshot->time_str), global_config.time_format);
+  }
+}
+
+// Make `snapshot` the one that is drawn, on whichever thread draws
+static void ui_snapshot_apply(struct client_state* state, const struct ui_snapshot* snapshot)
+{
+  // A configure has to be answered with a commit even if nothing on screen changed
+  if (snapshot->configures != state->ui.configures)
+  {
+    damage_add_full(&state->damage);
+  }
+  egl_fit_window(state, snapshot->width, snapshot->height);
+  state->ui = *snapshot;
+}
+
+// Milliseconds until the clock shows another string, -1 without a clock (the placeholder)
+static int ui_clock_next_ms(void)
+{
+  const char* format = global_config.time_format;
+  if (!format)
+  {
+    return -1;
+  }
+
+  // Anything but "H:M" shows seconds, see get_time_string()
+  int64_t         period = strcmp(format, "H:M") == 0 || strcmp(format, "h:m") == 0 ? 60000 : 1000;
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  int64_t now_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+  return (int)(period - now_ms % period) + 1; // wake just past the boundary, not just before it
+}
+
+// Milliseconds until the UI changes by itself (the clock ticking, the failed attempt wearing
+// off), -1 if it will not
+static int ui_next_change_ms(const struct client_state* state)
+{
+  uint64_t now   = startup_now_ns();
+  uint64_t until = state->pam.auth_state.fail_until_ns;
+  int      fail  = until > now ? (int)((until - now + 999999) / 1000000) : -1;
+  int      clock = ui_clock_next_ms();
+  if (fail < 0 || clock < 0)
+  {
+    return ANVIL_MAX(fail, clock);
+  }
+  return ANVIL_MIN(fail, clock);
+}
+
+static void ui_mailbox_init(struct ui_mailbox* mailbox)
+{
+  mailbox->front = 0;
+  atomic_store(&mailbox->middle, 1);
+  mailbox->back = 2;
+}
+
+// Event loop side: publish a snapshot, whatever the render thread did not take yet is replaced
+static void ui_mailbox_post(struct ui_mailbox* mailbox, const struct ui_snapshot* snapshot)
+{
+  mailbox->slots[mailbox->back] = *snapshot;
+  mailbox->back =
+    atomic_exchange_explicit(&mailbox->middle, mailbox->back | UI_MAILBOX_FRESH,
+                             memory_order_acq_rel) &
+    ~UI_MAILBOX_FRESH;
+}
+
+// Render thread side: the latest snapshot, false if nothing was posted since the last take
+static bool ui_mailbox_take(struct ui_mailbox* mailbox, struct ui_snapshot* out)
+{
+  if (!(atomic_load_explicit(&mailbox->middle, memory_order_relaxed) & UI_MAILBOX_FRESH))
+  {
+    return false;
+  }
+
+  mailbox->front =
+    atomic_exchange_explicit(&mailbox->middle, mailbox->front, memory_order_acq_rel) &
+    ~UI_MAILBOX_FRESH;
+  *out = mailbox->slots[mailbox->front];
+  return true;
+}
+
+// EAGAIN only means the counter is already full, the thread wakes up either way
+static void render_thread_wake(struct render_thread* render)
+{
+  uint64_t one = 1;
+  if (write(render->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+  {
+    log_message(LOG_LEVEL_ERROR, "[RENDER] Failed to wake the render thread: %s", strerror(errno));
+  }
+}
+
+static void render_thread_post(struct client_state* state, const struct ui_snapshot* snapshot)
+{
+  ui_mailbox_post(&state->render.mailbox, snapshot);
+  render_thread_wake(&state->render);
+}
+
+static void* render_thread_main(void* data)
+{
+  struct client_state* state = data;
+  if (!eglMakeCurrent(state->egl_display, state->egl_surface, state->egl_surface,
+                      state->egl_context))
+  {
+    log_message(LOG_LEVEL_ERROR, "[RENDER] Failed to make the EGL context current: 0x%x",
+                eglGetError());
+    return NULL;
+  }
+
+  struct pollfd wake = {.fd = state->render.wake_fd, .events = POLLIN};
+  while (!atomic_load(&state->render.stop))
+  {
+    struct ui_snapshot snapshot;
+    if (ui_mailbox_take(&state->render.mailbox, &snapshot))
+    {
+      ui_snapshot_apply(state, &snapshot);
+    }
+    egl_render_frame(state);
+
+    // Keep frames coming while the background fades in, else sleep until the next post or
+    // frame callback
+    int timeout = render_is_animating(state) && frame_pacing_ready(state) ? 16 : -1;
+    if (poll(&wake, 1, timeout) > 0)
+    {
+      uint64_t count;
+      if (read(state->render.wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+      {
+        log_message(LOG_LEVEL_ERROR, "[RENDER] Failed to drain the wake fd: %s", strerror(errno));
+      }
+    }
+  }
+
+  eglMakeCurrent(state->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  eglReleaseThread();
+  return NULL;
+}
+
+/*
+ * Hand the EGL context over to a new render thread. If that fails, frames
+ * keep being drawn right on the event loop, like before.
+ */
+static void render_thread_start(struct client_state* state)
+{
+  struct render_thread* render = &state->render;
+  if (state->egl_surface == EGL_NO_SURFACE)
+  {
+    return;
+  }
+
+  render->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (render->wake_fd < 0)
+  {
+    log_message(LOG_LEVEL_WARN, "[RENDER] No eventfd, rendering on the event loop");
+    return;
+  }
+  ui_mailbox_init(&render->mailbox);
+  atomic_store(&render->stop, false);
+
+  // A context can only be current on one thread at a time
+  eglMakeCurrent(state->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if (pthread_create(&render->thread, NULL, render_thread_main, state) != 0)
+  {
+    log_message(LOG_LEVEL_WARN, "[RENDER] Failed to start the render thread, rendering on the "
+                                "event loop");
+    eglMakeCurrent(state->egl_display, state->egl_surface, state->egl_surface,
+                   state->egl_context);
+    close(render->wake_fd);
+    render->wake_fd = -1;
+    return;
+  }
+  render->running = true;
+  log_message(LOG_LEVEL_DEBUG, "[RENDER] Render thread started");
+}
+
+// Join the render thread, after this the EGL objects can be torn down from the event loop
+static void render_thread_stop(struct client_state* state)
+{
+  struct render_thread* render = &state->render;
+  if (!render->running)
+  {
+    return;
+  }
+
+  atomic_store(&render->stop, true);
+  render_thread_wake(render);
+  pthread_join(render->thread, NULL);
+  close(render->wake_fd);
+  render->wake_fd = -1;
+  render->running = false;
+}
+
+#endif
@@ -0,0 +1,287 @@
+#ifndef SCREEN_BLUR_H
+#define SCREEN_BLUR_H
+
+#include "../client_state.h"
+#include "../global_funcs.h"
+#include "../log.h"
+#include "image_ops.h"
+#include "shaders.h"
+#include <GLES2/gl2.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+/*
+ * @SCREEN BLUR:
+ *
+ * Blurs the captured desktop (see screencopy_handle.h) on the GPU, once,
+ * right after the GL context comes up. This is a dual Kawase blur: a chain of
+ * downsampling passes, each halving the resolution, then as many upsampling
+ * passes back to full size, all rendered into textures through one FBO:
+ *
+ *   capture -> 1/2 -> 1/4 -> ... -> 1/2^n -> ... -> 1/4 -> 1/2
+ *
+ * Every pass reads 5 (down) or 8 (up) bilinear taps, and each level has a
+ * quarter of the pixels of the one above it, so even at 4K the whole chain
+ * costs less than one full screen pass on top of the upload. Each level
+ * roughly doubles the blur radius, so n is picked from [bg] blur_radius; the
+ * result stays at half resolution unless the blur is too small to hide that.
+ *
+ * The first pass also fixes up the capture: wl_shm's (A|X)RGB8888 is BGRA in
+ * memory and the compositor may hand the rows over bottom-up. The last pass
+ * applies the remaining [bg] effects, the result is the background texture.
+ *
+ */
+
+#define SCREEN_BLUR_MAX_PASSES 6
+
+struct screen_blur_program
+{
+  GLuint program;
+  GLint  position;
+  GLint  texture;
+  GLint  half_pixel;
+  GLint  swap_rb;
+  GLint  flip_y;
+  GLint  aspect;
+  GLint  dim;
+  GLint  vignette;
+  GLint  desaturate;
+};
+
+static GLuint screen_blur_shader(const char* shader_runtime_dir, const char* relpath, GLenum type)
+{
+  char* path = ANVIL_SAFE_STR_JOIN(shader_runtime_dir, relpath);
+  if (!path)
+  {
+    return GL_RET_CODE_FAIL;
+  }
+
+  char* source = load_shader_source(path);
+  free(path);
+
+  GLuint shader = glCreateShader(type);
+  glShaderSource(shader, 1, (const char**)&source, NULL);
+  glCompileShader(shader);
+  free(source);
+
+  GLint compile_status;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &compile_status);
+  if (compile_status == GL_FALSE)
+  {
+    log_message(LOG_LEVEL_ERROR, "[SCREEN BLUR] Shader compilation failed: %s", relpath);
+    glDeleteShader(shader);
+    return GL_RET_CODE_FAIL;
+  }
+  return shader;
+}
+
+static bool screen_blur_program_init(struct screen_blur_program* prog,
+                                     const char* shader_runtime_dir, const char* fragment)
+{
+  GLuint vertex_shader =
+    screen_blur_shader(shader_runtime_dir, SHADERS_SCREEN_BLUR_EGL_VERTEX, GL_VERTEX_SHADER);
+  GLuint fragment_shader = screen_blur_shader(shader_runtime_dir, fragment, GL_FRAGMENT_SHADER);
+  if (!vertex_shader || !fragment_shader)
+  {
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+    return false;
+  }
+
+  prog->program = glCreateProgram();
+  glAttachShader(prog->program, vertex_shader);
+  glAttachShader(prog->program, fragment_shader);
+  glLinkProgram(prog->program);
+  glDeleteShader(vertex_shader);
+  glDeleteShader(fragment_shader);
+
+  GLint link_status;
+  glGetProgramiv(prog->program, GL_LINK_STATUS, &link_status);
+  if (link_status == GL_FALSE)
+  {
+    log_message(LOG_LEVEL_ERROR, "[SCREEN BLUR] Shader program linking failed");
+    glDeleteProgram(prog->program);
+    prog->program = 0;
+    return false;
+  }
+
+  // Uniforms the down pass does not have come back as -1, setting those is a no-op
+  prog->position   = glGetAttribLocation(prog->program, "position");
+  prog->texture    = glGetUniformLocation(prog->program, "uTexture");
+  prog->half_pixel = glGetUniformLocation(prog->program, "uHalfPixel");
+  prog->swap_rb    = glGetUniformLocation(prog->program, "uSwapRB");
+  prog->flip_y     = glGetUniformLocation(prog->program, "uFlipY");
+  prog->aspect     = glGetUniformLocation(prog->program, "uAspect");
+  prog->dim        = glGetUniformLocation(prog->program, "uDim");
+  prog->vignette   = glGetUniformLocation(prog->program, "uVignette");
+  prog->desaturate = glGetUniformLocation(prog->program, "uDesaturate");
+  return true;
+}
+
+// Linear and clamped, every level of the chain is sampled in between texels
+static GLuint screen_blur_texture(int width, int height)
+{
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  return texture;
+}
+
+// GLES2 has no GL_UNPACK_ROW_LENGTH, so a padded stride is uploaded row by row
+static GLuint screen_blur_upload_capture(const struct screen_capture* capture)
+{
+  GLuint texture = screen_blur_texture(capture->width, capture->height);
+  if (capture->stride == capture->width * 4)
+  {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, capture->width, capture->height, GL_RGBA,
+                    GL_UNSIGNED_BYTE, capture->data);
+    return texture;
+  }
+
+  for (int y = 0; y < capture->height; y++)
+  {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, capture->width, 1, GL_RGBA, GL_UNSIGNED_BYTE,
+                    (const unsigned char*)capture->data + (size_t)y * capture->stride);
+  }
+  return texture;
+}
+
+// Smallest chain whose blur reaches `radius` pixels (each level ~doubles it), 0 for none
+static int screen_blur_passes(int radius, int width, int height)
+{
+  int passes = radius > 0 ? 1 : 0;
+  while (passes < SCREEN_BLUR_MAX_PASSES && (2 << passes) < radius &&
+         (ANVIL_MIN(width, height) >> (passes + 1)) > 1)
+  {
+    passes++;
+  }
+  return passes;
+}
+
+// Render `src` into `dst` (width x height) through `prog`, taps `offset` half pixels of `dst` apart
+static void screen_blur_pass(const struct screen_blur_program* prog, GLuint src, GLuint dst,
+                             int width, int height, float offset)
+{
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, dst, 0);
+  glViewport(0, 0, width, height);
+  glUseProgram(prog->program);
+  glUniform1i(prog->texture, 0);
+  glUniform2f(prog->half_pixel, offset * 0.5f / width, offset * 0.5f / height);
+  glBindTexture(GL_TEXTURE_2D, src);
+  glVertexAttribPointer(prog->position, 2, GL_FLOAT, GL_FALSE, 0, quad_vertices);
+  glEnableVertexAttribArray(prog->position);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  glDisableVertexAttribArray(prog->position);
+}
+
+/*
+ * Upload `capture`, blur it by `fx->blur_radius` and apply the other [bg]
+ * effects. Returns a texture with the result, 0 on failure.
+ * Leaves the default framebuffer bound with the viewport at the output size.
+ */
+static GLuint screen_blur_capture(const struct client_state*   state,
+                                  const struct screen_capture* capture,
+                                  const struct bg_effects*     fx)
+{
+  const char*                runtime_dir = state->shaderRuntimeDir;
+  struct screen_blur_program down = {0}, up = {0};
+  if (!screen_blur_program_init(&down, runtime_dir, SHADERS_SCREEN_BLUR_DOWN_EGL_FRAG) ||
+      !screen_blur_program_init(&up, runtime_dir, SHADERS_SCREEN_BLUR_UP_EGL_FRAG))
+  {
+    glDeleteProgram(down.program);
+    return 0;
+  }
+
+  int    width  = capture->width;
+  int    height = capture->height;
+  int    passes = screen_blur_passes(fx->blur_radius, width, height);
+  GLuint levels[SCREEN_BLUR_MAX_PASSES + 1];
+  levels[0] = screen_blur_upload_capture(capture);
+  for (int i = 1; i <= passes; i++)
+  {
+    levels[i] = screen_blur_texture(image_mip_dim(width, i), image_mip_dim(height, i));
+  }
+
+  // Once blurred there is nothing left that needs full resolution, the result is
+  // magnified when drawn. Saves the most expensive pass and 3/4 of the texture.
+  int    out    = passes >= 2 ? 1 : 0;
+  int    out_w  = image_mip_dim(width, out);
+  int    out_h  = image_mip_dim(height, out);
+  GLuint result = screen_blur_texture(out_w, out_h);
+
+  GLuint fbo;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glActiveTexture(GL_TEXTURE0);
+  glDisable(GL_BLEND);
+
+  // Only whichever pass reads the capture itself converts it
+  float swap_rb = (capture->format == WL_SHM_FORMAT_XRGB8888 ||
+                   capture->format == WL_SHM_FORMAT_ARGB8888)
+                    ? 1.0f
+                    : 0.0f;
+  float flip_y  = capture->y_invert ? 1.0f : 0.0f;
+  glUseProgram(down.program);
+  glUniform1f(down.swap_rb, passes > 0 ? swap_rb : 0.0f);
+  glUniform1f(down.flip_y, passes > 0 ? flip_y : 0.0f);
+  glUseProgram(up.program);
+  glUniform1f(up.swap_rb, 0.0f);
+  glUniform1f(up.flip_y, 0.0f);
+
+  for (int i = 1; i <= passes; i++)
+  {
+    screen_blur_pass(&down, levels[i - 1], levels[i], image_mip_dim(width, i),
+                     image_mip_dim(height, i), 1.0f);
+    glUniform1f(down.swap_rb, 0.0f);
+    glUniform1f(down.flip_y, 0.0f);
+  }
+  for (int i = passes - 1; i > out; i--)
+  {
+    screen_blur_pass(&up, levels[i + 1], levels[i], image_mip_dim(width, i),
+                     image_mip_dim(height, i), 1.0f);
+  }
+
+  // The last upsample lands in the result, with the remaining effects
+  float diagonal = ANVIL_MAX(sqrtf((float)width * width + (float)height * height), 1.0f);
+  glUseProgram(up.program);
+  glUniform1f(up.swap_rb, passes > 0 ? 0.0f : swap_rb);
+  glUniform1f(up.flip_y, passes > 0 ? 0.0f : flip_y);
+  glUniform2f(up.aspect, width / diagonal, height / diagonal);
+  glUniform1f(up.dim, fx->dim);
+  glUniform1f(up.vignette, fx->vignette);
+  glUniform1f(up.desaturate, fx->desaturate);
+  // With no levels a zero offset collapses all eight taps onto the pixel itself
+  screen_blur_pass(&up, levels[passes > 0 ? out + 1 : 0], result, out_w, out_h,
+                   passes > 0 ? 1.0f : 0.0f);
+
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  GLenum error  = glGetError();
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(1, &fbo);
+  glDeleteTextures(passes + 1, levels);
+  glDeleteProgram(down.program);
+  glDeleteProgram(up.program);
+  glUseProgram(0);
+  glViewport(0, 0, state->output_state.width > 0 ? state->output_state.width : width,
+             state->output_state.height > 0 ? state->output_state.height : height);
+
+  if (status != GL_FRAMEBUFFER_COMPLETE || error != GL_NO_ERROR)
+  {
+    log_message(LOG_LEVEL_ERROR, "[SCREEN BLUR] Blur failed (fbo 0x%x, error 0x%x)", status, error);
+    glDeleteTextures(1, &result);
+    return 0;
+  }
+
+  log_message(LOG_LEVEL_DEBUG, "[SCREEN BLUR] Blurred %dx%d capture with %d levels into %dx%d",
+              width, height, passes, out_w, out_h);
+  return result;
+}
+
+#endif // SCREEN_BLUR_H
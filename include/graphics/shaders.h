@@ -14,7 +14,10 @@
   X(RENDER_TIME_FIELD_EGL_VERTEX, "egl/render_time_box/vertex_shader.glsl")      \
   X(RENDER_TIME_FIELD_EGL_FRAG, "egl/render_time_box/fragment_shader.glsl")      \
   X(TEXTURE_EGL_VERTEX, "egl/texture/vertex_shader.glsl")                        \
-  X(TEXTURE_EGL_FRAG, "egl/texture/fragment_shader.glsl")
+  X(TEXTURE_EGL_FRAG, "egl/texture/fragment_shader.glsl")                        \
+  X(SCREEN_BLUR_EGL_VERTEX, "egl/screen_blur/vertex_shader.glsl")                \
+  X(SCREEN_BLUR_DOWN_EGL_FRAG, "egl/screen_blur/down_fragment_shader.glsl")      \
+  X(SCREEN_BLUR_UP_EGL_FRAG, "egl/screen_blur/up_fragment_shader.glsl")
 
 // Declare extern const char* for each shader path (for future use)
 #define X(name, path) extern const char* SHADER_##name;
@@ -0,0 +1,683 @@
+#ifndef SOFT_RENDER_H
+#define SOFT_RENDER_H
+
+#include "../client_state.h"
+#include "../config/config.h"
+#include "../freetype/freetype.h"
+#include "../freetype/text_layout.h"
+#include "../global_funcs.h"
+#include "../log.h"
+#include "../startup/startup.h"
+#include "../wayland/screencopy_handle.h"
+#include "../wayland/shared_mem_handle.h"
+#include "damage.h"
+#include "egl.h"
+#include "frame_pacing.h"
+#include "image_ops.h"
+#include "pixel_kernels.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+/*
+ * @SOFTWARE RENDERER:
+ *
+ * When init_egl() fails (no GPU, no EGL, a VM without llvmpipe) the lock
+ * screen is drawn on the CPU into two wl_shm buffers instead, alternating
+ * between them as the compositor releases them:
+ *
+ *   background:  prescaled to the output once per asset, copied row by row
+ *                (a constant-alpha blend while the thumbnail fades out)
+ *   time box:    the text mask stretched over the box when the time changes,
+ *                blended through
+ *   password:    field, dots and border as solid or blended spans
+ *
+ * Each buffer remembers how many frames ago it was drawn, so only the damage
+ * since then is redrawn into it (see damage.h). All per-pixel work goes
+ * through the span kernels in pixel_kernels.h. The assets come from the same
+ * startup tasks and stream_in_assets() as on the GPU; only the upload step
+ * differs.
+ *
+ */
+
+/*
+ * Bilinear resampling like GL_LINEAR with clamp-to-edge. Source positions are
+ * 16.16 fixed point; every destination pixel reads source pixel `index` and the
+ * one after it, the latter weighted `weight` / 255.
+ */
+struct soft_taps
+{
+  int*     x;
+  int*     y;
+  uint8_t* wx;
+  uint8_t* wy;
+};
+
+static void soft_taps_axis(int src, int dst, int* index, uint8_t* weight)
+{
+  int64_t step = ((int64_t)src << 16) / dst;
+  for (int i = 0; i < dst; i++)
+  {
+    int64_t pos = ANVIL_CLAMP(((2 * i + 1) * step >> 1) - 0x8000, 0, (int64_t)(src - 1) << 16);
+    index[i]    = (int)(pos >> 16);
+    weight[i]   = (uint8_t)((pos >> 8) & 0xFF);
+  }
+}
+
+// One allocation for both axes, release with free(taps->x)
+static bool soft_taps_init(struct soft_taps* taps, int sw, int sh, int dw, int dh)
+{
+  taps->x = malloc((size_t)(dw + dh) * (sizeof(int) + 1));
+  if (!taps->x)
+  {
+    return false;
+  }
+  taps->y  = taps->x + dw;
+  taps->wx = (uint8_t*)(taps->y + dh);
+  taps->wy = taps->wx + dw;
+  soft_taps_axis(sw, dw, taps->x, taps->wx);
+  soft_taps_axis(sh, dh, taps->y, taps->wy);
+  return true;
+}
+
+// 32 bit pixels, every byte interpolated on its own so any channel order works
+static bool soft_scale(const uint32_t* src, int sw, int sh, uint32_t* dst, int dw, int dh)
+{
+  struct soft_taps taps;
+  if (!soft_taps_init(&taps, sw, sh, dw, dh))
+  {
+    return false;
+  }
+
+  for (int y = 0; y < dh; y++)
+  {
+    const uint32_t* row0 = src + (size_t)taps.y[y] * sw;
+    const uint32_t* row1 = src + (size_t)ANVIL_MIN(taps.y[y] + 1, sh - 1) * sw;
+    uint32_t*       out  = dst + (size_t)y * dw;
+    for (int x = 0; x < dw; x++)
+    {
+      int      x0     = taps.x[x];
+      int      x1     = ANVIL_MIN(x0 + 1, sw - 1);
+      uint32_t top    = px_lerp(row0[x0], row0[x1], taps.wx[x]);
+      uint32_t bottom = px_lerp(row1[x0], row1[x1], taps.wx[x]);
+      out[x]          = px_lerp(top, bottom, taps.wy[y]);
+    }
+  }
+
+  free(taps.x);
+  return true;
+}
+
+// The same for an 8 bit coverage mask
+static bool soft_scale_mask(const unsigned char* src, int sw, int sh, unsigned char* dst, int dw,
+                            int dh)
+{
+  struct soft_taps taps;
+  if (!soft_taps_init(&taps, sw, sh, dw, dh))
+  {
+    return false;
+  }
+
+  for (int y = 0; y < dh; y++)
+  {
+    const unsigned char* row0 = src + (size_t)taps.y[y] * sw;
+    const unsigned char* row1 = src + (size_t)ANVIL_MIN(taps.y[y] + 1, sh - 1) * sw;
+    unsigned char*       out  = dst + (size_t)y * dw;
+    for (int x = 0; x < dw; x++)
+    {
+      int      x0     = taps.x[x];
+      int      x1     = ANVIL_MIN(x0 + 1, sw - 1);
+      uint32_t wx     = taps.wx[x];
+      uint32_t top    = px_div255(row0[x0] * (255 - wx) + row0[x1] * wx);
+      uint32_t bottom = px_div255(row1[x0] * (255 - wx) + row1[x1] * wx);
+      out[x]          = (unsigned char)px_div255(top * (255 - taps.wy[y]) + bottom * taps.wy[y]);
+    }
+  }
+
+  free(taps.x);
+  return true;
+}
+
+/*
+ * Scale an RGBA8 image (from the mip level closest above the output, if
+ * there are mips) to width x height and convert it to XRGB8888.
+ * Returns a malloc()'d buffer, NULL if out of memory.
+ */
+static uint32_t* soft_build_background(const struct decoded_image* image,
+                                       const struct image_mips* mips, int width, int height)
+{
+  struct decoded_image src = *image;
+  if (mips && mips->data)
+  {
+    int level = 0;
+    while (level + 1 < mips->levels && image_mip_dim(image->width, level + 1) >= width &&
+           image_mip_dim(image->height, level + 1) >= height)
+    {
+      level++;
+    }
+    src = image_mip_level(image, mips, level);
+  }
+
+  uint32_t* background = malloc((size_t)width * height * 4);
+  if (!background ||
+      !soft_scale((const uint32_t*)src.pixels, src.width, src.height, background, width, height))
+  {
+    free(background);
+    log_message(LOG_LEVEL_ERROR, "[SOFT] Out of memory scaling the background");
+    return NULL;
+  }
+
+  px_kernels.convert(background, background, width * height);
+  return background;
+}
+
+/*
+ * The screencopy capture as an RGBA8 image with the [bg] effects applied.
+ * As on the GPU, a blurred capture is only kept at half resolution.
+ */
+static bool soft_capture_to_image(const struct screen_capture* capture,
+                                  const struct bg_effects* fx, struct decoded_image* out)
+{
+  struct decoded_image full = {NULL, capture->width, capture->height};
+  full.pixels               = malloc((size_t)capture->width * capture->height * 4);
+  if (!full.pixels)
+  {
+    return false;
+  }
+
+  bool swap_rb = capture->format == WL_SHM_FORMAT_XRGB8888 ||
+                 capture->format == WL_SHM_FORMAT_ARGB8888;
+  for (int y = 0; y < capture->height; y++)
+  {
+    int             src_y = capture->y_invert ? capture->height - 1 - y : y;
+    const uint32_t* src   = (const uint32_t*)((const unsigned char*)capture->data +
+                                            (size_t)src_y * capture->stride);
+    uint32_t*       dst   = (uint32_t*)full.pixels + (size_t)y * capture->width;
+    if (swap_rb)
+    {
+      px_kernels.convert(dst, src, capture->width);
+    }
+    else
+    {
+      memcpy(dst, src, (size_t)capture->width * 4);
+    }
+  }
+
+  struct bg_effects    effects = *fx;
+  struct decoded_image half    = {0};
+  *out                         = full;
+  if (fx->blur_radius >= 2 &&
+      image_downscale(&full, image_mip_dim(full.width, 1), image_mip_dim(full.height, 1), &half))
+  {
+    free(full.pixels);
+    *out = half;
+    effects.blur_radius /= 2;
+  }
+
+  if (!image_apply_effects(out, &effects))
+  {
+    log_message(LOG_LEVEL_WARN, "[SOFT] Out of memory applying background effects");
+  }
+  return true;
+}
+
+static void soft_buffer_release(void* data, struct wl_buffer* wl_buffer)
+{
+  (void)wl_buffer;
+  struct soft_buffer* buffer = data;
+  buffer->busy               = false;
+}
+
+static const struct wl_buffer_listener soft_buffer_listener = {
+  .release = soft_buffer_release,
+};
+
+static void soft_release_buffers(struct soft_renderer* soft)
+{
+  for (int i = 0; i < 2; i++)
+  {
+    if (soft->buffers[i].wl_buffer)
+    {
+      wl_buffer_destroy(soft->buffers[i].wl_buffer);
+    }
+    soft->buffers[i] = (struct soft_buffer){0};
+  }
+  if (soft->map)
+  {
+    munmap(soft->map, soft->map_size);
+    soft->map = NULL;
+  }
+}
+
+// Rescale a prepared XRGB8888 layer after the output changed size
+static void soft_rescale_layer(uint32_t** layer, int old_w, int old_h, int width, int height)
+{
+  if (!*layer)
+  {
+    return;
+  }
+
+  uint32_t* scaled = malloc((size_t)width * height * 4);
+  if (scaled && !soft_scale(*layer, old_w, old_h, scaled, width, height))
+  {
+    ANVIL_SAFE_FREE(scaled);
+  }
+  free(*layer);
+  *layer = scaled;
+}
+
+// Make sure both shm buffers match the output, (re)creating them when it changed size
+static bool soft_render_fit(struct client_state* state)
+{
+  struct soft_renderer* soft = &state->soft;
+  int                   width =
+    state->output_state.width > 0 ? state->output_state.width : __ANVIL_FALLBACK_SCREEN_WIDTH__;
+  int height =
+    state->output_state.height > 0 ? state->output_state.height : __ANVIL_FALLBACK_SCREEN_HEIGHT__;
+  if (soft->map && soft->width == width && soft->height == height)
+  {
+    return true;
+  }
+
+  soft_release_buffers(soft);
+  if (soft->width > 0 && soft->height > 0)
+  {
+    soft_rescale_layer(&soft->background, soft->width, soft->height, width, height);
+    soft_rescale_layer(&soft->thumb, soft->width, soft->height, width, height);
+  }
+  ANVIL_SAFE_FREE(soft->time_mask);
+  soft->time_str[0] = '\0';
+  soft->width       = width;
+  soft->height      = height;
+  damage_reset(&state->damage, width, height);
+
+  int    stride = width * 4;
+  size_t size   = (size_t)stride * height;
+  int    fd     = allocate_shm_file(size * 2);
+  if (fd < 0)
+  {
+    log_message(LOG_LEVEL_ERROR, "[SOFT] Failed to allocate %zu bytes of shm", size * 2);
+    return false;
+  }
+
+  soft->map = mmap(NULL, size * 2, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (soft->map == MAP_FAILED)
+  {
+    soft->map = NULL;
+    close(fd);
+    return false;
+  }
+  soft->map_size = size * 2;
+
+  struct wl_shm_pool* pool = wl_shm_create_pool(state->wl_shm, fd, size * 2);
+  for (int i = 0; i < 2; i++)
+  {
+    struct soft_buffer* buffer = &soft->buffers[i];
+    buffer->pixels             = (uint32_t*)((unsigned char*)soft->map + size * i);
+    buffer->wl_buffer =
+      wl_shm_pool_create_buffer(pool, size * i, width, height, stride, WL_SHM_FORMAT_XRGB8888);
+    wl_buffer_add_listener(buffer->wl_buffer, &soft_buffer_listener, buffer);
+  }
+  wl_shm_pool_destroy(pool);
+  close(fd);
+
+  log_message(LOG_LEVEL_DEBUG, "[SOFT] Allocated 2 shm buffers (%dx%d)", width, height);
+  return true;
+}
+
+// How far the thumbnail has faded into the background, the thumbnail goes once it is done
+static float soft_background_fade(struct client_state* state)
+{
+  struct soft_renderer* soft = &state->soft;
+  if (!soft->thumb || !soft->background)
+  {
+    return 1.0f;
+  }
+
+  float fade = (startup_now_ns() - state->assets.bg_fade_start_ns) / (float)BG_CROSSFADE_NS;
+  if (fade >= 1.0f)
+  {
+    ANVIL_SAFE_FREE(soft->thumb);
+    fade = 1.0f;
+  }
+  return fade;
+}
+
+// Background, or the thumbnail fading into it, or the placeholder colour
+static void soft_draw_background(struct client_state* state, uint32_t* pixels, float fade,
+                                 struct damage_rect clip)
+{
+  struct soft_renderer* soft  = &state->soft;
+  int                   count = clip.x1 - clip.x0;
+  uint8_t               alpha = (uint8_t)(fade * 255.0f + 0.5f);
+
+  for (int y = clip.y0; y < clip.y1; y++)
+  {
+    size_t    offset = (size_t)y * soft->width + clip.x0;
+    uint32_t* row    = pixels + offset;
+    if (soft->thumb)
+    {
+      memcpy(row, soft->thumb + offset, (size_t)count * 4);
+    }
+
+    if (soft->background && fade < 1.0f)
+    {
+      px_kernels.blend(row, soft->background + offset, count, alpha);
+    }
+    else if (soft->background)
+    {
+      memcpy(row, soft->background + offset, (size_t)count * 4);
+    }
+    else if (!soft->thumb)
+    {
+      for (int x = 0; x < count; x++)
+      {
+        row[x] = __ANVIL_PLACEHOLDER_COLOR__;
+      }
+    }
+  }
+}
+
+static void soft_fill_rect(const struct soft_renderer* soft, uint32_t* pixels,
+                           struct damage_rect rect, struct damage_rect clip, uint32_t color,
+                           uint8_t alpha)
+{
+  rect = damage_rect_intersect(rect, clip);
+  for (int y = rect.y0; y < rect.y1; y++)
+  {
+    px_kernels.fill_blend(pixels + (size_t)y * soft->width + rect.x0, rect.x1 - rect.x0, color,
+                          alpha);
+  }
+}
+
+// One pixel wide outline just inside `rect`
+static void soft_outline_rect(const struct soft_renderer* soft, uint32_t* pixels,
+                              struct damage_rect rect, struct damage_rect clip, uint32_t color)
+{
+  if (damage_rect_empty(rect))
+  {
+    return;
+  }
+
+  struct damage_rect top    = {rect.x0, rect.y0, rect.x1, rect.y0 + 1};
+  struct damage_rect bottom = {rect.x0, rect.y1 - 1, rect.x1, rect.y1};
+  struct damage_rect left   = {rect.x0, rect.y0, rect.x0 + 1, rect.y1};
+  struct damage_rect right  = {rect.x1 - 1, rect.y0, rect.x1, rect.y1};
+  soft_fill_rect(soft, pixels, top, clip, color, 255);
+  soft_fill_rect(soft, pixels, bottom, clip, color, 255);
+  soft_fill_rect(soft, pixels, left, clip, color, 255);
+  soft_fill_rect(soft, pixels, right, clip, color, 255);
+}
+
+// Rebuild the clock mask when the time string changed
+static void soft_update_time_box(struct client_state* state)
+{
+  struct soft_renderer* soft = &state->soft;
+
+  const char* time_str = state->ui.time_str;
+  if (strcmp(soft->time_str, time_str) == 0)
+  {
+    return;
+  }
+
+  strcpy(soft->time_str, time_str);
+  ANVIL_SAFE_FREE(soft->time_mask);
+  damage_time_box(state);
+
+  // Like the GL quads, the whole (power of two) text mask is stretched over the box
+  struct damage_rect box = damage_quad_rect(&state->global_config.time_box_vertices[0].x, 4, 0.0f,
+                                            0.0f, soft->width, soft->height);
+
+  const struct text_run* run = text_layout(&glyph_atlas, &text_runs, time_str);
+  int                    mask_w, mask_h;
+  unsigned char*         mask = text_compose_mask(&glyph_atlas, run, &mask_w, &mask_h);
+  soft->time_x                = box.x0;
+  soft->time_y                = box.y0;
+  soft->time_w                = box.x1 - box.x0;
+  soft->time_h                = box.y1 - box.y0;
+  if (mask && soft->time_w > 0 && soft->time_h > 0)
+  {
+    soft->time_mask = malloc((size_t)soft->time_w * soft->time_h);
+    if (soft->time_mask &&
+        !soft_scale_mask(mask, mask_w, mask_h, soft->time_mask, soft->time_w, soft->time_h))
+    {
+      ANVIL_SAFE_FREE(soft->time_mask);
+    }
+  }
+  free(mask);
+}
+
+static void soft_draw_time_box(struct client_state* state, uint32_t* pixels,
+                               struct damage_rect clip)
+{
+  struct soft_renderer* soft = &state->soft;
+  if (!soft->time_mask)
+  {
+    return;
+  }
+
+  struct damage_rect box = {soft->time_x, soft->time_y, soft->time_x + soft->time_w,
+                            soft->time_y + soft->time_h};
+  box                    = damage_rect_intersect(box, clip);
+
+  // An alpha-only texture samples as black, so the clock is black text
+  for (int y = box.y0; y < box.y1; y++)
+  {
+    const unsigned char* mask =
+      soft->time_mask + (size_t)(y - soft->time_y) * soft->time_w + (box.x0 - soft->time_x);
+    px_kernels.mask_blend(pixels + (size_t)y * soft->width + box.x0, mask, box.x1 - box.x0,
+                          0x000000, 255);
+  }
+}
+
+// Same keys and colours as update_keypad_quads(), labels straight from the glyph atlas
+static void soft_draw_keypad(struct client_state* state, uint32_t* pixels, struct damage_rect clip)
+{
+  struct soft_renderer*       soft   = &state->soft;
+  const struct keypad_layout* layout = &state->damage.keypad; // laid out by damage_track_keypad()
+  if (damage_rect_empty(damage_rect_intersect(layout->bounds, clip)))
+  {
+    return;
+  }
+
+  for (int i = 0; i < KEYPAD_KEYS; i++)
+  {
+    const struct keypad_key* key   = &layout->keys[i];
+    uint8_t                  alpha = i + 1 == state->ui.keypad_pressed ? KEYPAD_PRESSED_ALPHA
+                                                                       : KEYPAD_KEY_ALPHA;
+    soft_fill_rect(soft, pixels, key->rect, clip, 0x000000, alpha);
+
+    const struct text_run* run = text_layout_pinned(&glyph_atlas, &text_runs, key->label);
+    int                    x0  = (key->rect.x0 + key->rect.x1 - run->width) / 2;
+    int                    y0  = (key->rect.y0 + key->rect.y1 - run->height) / 2;
+    for (int c = 0; c < run->count; c++)
+    {
+      const struct text_glyph* glyph = &glyph_atlas.glyphs[run->cells[c].glyph];
+      int                      x     = x0 + run->cells[c].x;
+      int                      y     = y0 + run->cells[c].y;
+      struct damage_rect       rect  = damage_rect_intersect(
+        (struct damage_rect){x, y, x + glyph->width, y + glyph->rows}, clip);
+      for (int row = rect.y0; row < rect.y1; row++)
+      {
+        const unsigned char* mask = glyph_atlas.mask +
+                                    (size_t)(glyph->y + row - y) * TEXT_ATLAS_WIDTH + glyph->x +
+                                    (rect.x0 - x);
+        px_kernels.mask_blend(pixels + (size_t)row * soft->width + rect.x0, mask,
+                              rect.x1 - rect.x0, 0x000000, 255);
+      }
+    }
+  }
+}
+
+// Same layout and colours as render_password_field()
+static void soft_draw_password_field(struct client_state* state, uint32_t* pixels,
+                                     struct damage_rect clip)
+{
+  struct soft_renderer* soft         = &state->soft;
+  float                 field_width  = 0.7f;
+  float                 field_height = 0.15f;
+  float                 offset_x     = 0;
+  float                 offset_y     = -0.8f + field_height / 2.0f;
+
+  struct damage_rect field =
+    damage_quad_rect(password_field_vertices, 2, offset_x, offset_y, soft->width, soft->height);
+  soft_fill_rect(soft, pixels, field, clip, 0xFFFFFF, 179);
+
+  float dot_spacing = field_width / (state->ui.password_length + 1);
+  for (int i = 0; i < state->ui.password_length; i++)
+  {
+    float              x_position = offset_x + (i + 1) * dot_spacing - field_width / 2;
+    struct damage_rect dot =
+      damage_quad_rect(dot_vertices, 2, x_position, offset_y, soft->width, soft->height);
+    soft_fill_rect(soft, pixels, dot, clip, 0x4D4D4D, 204);
+  }
+
+  uint32_t border = 0xCCCCCC;
+  if (state->ui.auth_failed)
+  {
+    border = 0xFF0000;
+  }
+  else if (state->ui.password_length > 0)
+  {
+    border = 0x00FF00;
+  }
+  soft_outline_rect(soft, pixels, field, clip, border);
+}
+
+static void soft_render_frame(struct client_state* state)
+{
+  struct soft_renderer* soft = &state->soft;
+  if (!soft_render_fit(state))
+  {
+    return;
+  }
+
+  stream_in_assets(state);
+
+  // The compositor has not shown the last frame yet, its callback brings us back here
+  if (!frame_pacing_ready(state))
+  {
+    return;
+  }
+
+  struct soft_buffer* buffer = NULL;
+  for (int i = 0; i < 2 && !buffer; i++)
+  {
+    buffer = soft->buffers[i].busy ? NULL : &soft->buffers[i];
+  }
+  if (!buffer)
+  {
+    return; // both still with the compositor, its next release brings us back here
+  }
+
+  // Find out what changed, a frame where nothing did is not drawn at all
+  if (state->assets.font_ready)
+  {
+    soft_update_time_box(state);
+  }
+  damage_track_password_field(state);
+  damage_track_pointer_hover(state);
+  damage_track_keypad(state);
+  if (render_is_animating(state))
+  {
+    damage_add_full(&state->damage);
+  }
+  if (!damage_pending(&state->damage))
+  {
+    return;
+  }
+
+  // The buffer still holds the frame from `age` frames ago, only what changed since is redrawn
+  float                       fade    = soft_background_fade(state);
+  const struct damage_region* repaint = damage_begin_frame(&state->damage, buffer->age);
+  struct damage_rect          rects[DAMAGE_MAX_RECTS];
+  int                         count = damage_region_rects(&state->damage, repaint, rects);
+  for (int i = 0; i < count; i++)
+  {
+    soft_draw_background(state, buffer->pixels, fade, rects[i]);
+    soft_draw_time_box(state, buffer->pixels, rects[i]);
+    if (state->assets.font_ready && state->ui.keypad_visible)
+    {
+      soft_draw_keypad(state, buffer->pixels, rects[i]);
+    }
+    soft_draw_password_field(state, buffer->pixels, rects[i]);
+  }
+
+  wl_surface_attach(state->wl_surface, buffer->wl_buffer, 0, 0);
+  count = damage_region_rects(&state->damage, &state->damage.pending, rects);
+  for (int i = 0; i < count; i++)
+  {
+    wl_surface_damage_buffer(state->wl_surface, rects[i].x0, rects[i].y0,
+                             rects[i].x1 - rects[i].x0, rects[i].y1 - rects[i].y0);
+  }
+  frame_pacing_request(state);
+  wl_surface_commit(state->wl_surface);
+  buffer->busy = true;
+
+  for (int i = 0; i < 2; i++)
+  {
+    struct soft_buffer* other = &soft->buffers[i];
+    other->age                = other == buffer ? 1 : other->age + (other->age > 0);
+  }
+  damage_end_frame(&state->damage);
+}
+
+/*
+ * Take over from a failed init_egl(): open the gates it would have opened,
+ * turn a captured screenshot into the background and draw the first frame.
+ */
+static bool soft_render_init(struct client_state* state)
+{
+  int stage = startup_stage_begin("soft-init", false);
+  pixel_kernels_init();
+
+  // Nothing can sample the ETC2 cache, the wallpaper task decodes instead
+  startup_gate_open(STARTUP_TASK_GL_CAPS, -1);
+
+  if (!state->wl_shm || !soft_render_fit(state))
+  {
+    log_message(LOG_LEVEL_ERROR, "[SOFT] Software rendering is unavailable too");
+    startup_gate_open(STARTUP_TASK_SCREENSHOT, -1);
+    startup_stage_end(stage);
+    return false;
+  }
+  state->soft.active = true;
+
+  if (state->screenshot.data)
+  {
+    struct decoded_image shot = {0};
+    if (soft_capture_to_image(&state->screenshot, &global_config.bg_effects, &shot))
+    {
+      state->soft.background =
+        soft_build_background(&shot, NULL, state->soft.width, state->soft.height);
+      free(shot.pixels);
+    }
+    screencopy_release(&state->screenshot);
+  }
+  startup_gate_open(STARTUP_TASK_SCREENSHOT, state->soft.background ? 0 : -1);
+
+  log_message(LOG_LEVEL_INFO, "[SOFT] Rendering on the CPU into wl_shm buffers (%s kernels)",
+              px_kernels.name);
+  startup_stage_end(stage);
+
+  int frame_stage = startup_stage_begin("soft-frame", false);
+  render_lock_screen(state);
+  startup_stage_end(frame_stage);
+  return true;
+}
+
+static void soft_render_destroy(struct client_state* state)
+{
+  struct soft_renderer* soft = &state->soft;
+  soft_release_buffers(soft);
+  ANVIL_SAFE_FREE(soft->background);
+  ANVIL_SAFE_FREE(soft->thumb);
+  ANVIL_SAFE_FREE(soft->time_mask);
+  soft->active = false;
+}
+
+#endif // SOFT_RENDER_H
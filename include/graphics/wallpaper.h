@@ -0,0 +1,138 @@
+#ifndef WALLPAPER_H
+#define WALLPAPER_H
+
+#include "../client_state.h"
+#include "../log.h"
+#include "bg_cache.h"
+#include "egl.h"
+#include "etc_encoder.h"
+#include "image_ops.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+/*
+ * @WALLPAPER PIPELINE:
+ *
+ * Worker-side half of the background: everything here runs on the startup
+ * workers and never touches GL. The main thread picks the results up in
+ * stream_in_assets() (egl.h).
+ *
+ *   thumbnail:  bg cache -> 64x36 blurred RGBA, shown (linearly upscaled) right after lock
+ *   wallpaper:  bg cache -> ETC2 RGB8, if the GL context can sample it
+ *               otherwise decode the full image, apply effects, build mips
+ *   bg-cache:   after a full decode, build whichever of the above was missing
+ *
+ * Once the full image is uploaded the lock screen crossfades from the
+ * thumbnail to it. The ETC2 copy is 8x smaller than RGBA8, both on the GPU
+ * and in upload bandwidth, and skips the image decode entirely.
+ *
+ * The [bg] effects (blur, dim, vignette, desaturate) are baked into the
+ * decoded image once, before anything else is derived from it, and are part
+ * of every cache key. Drawing the background therefore stays a single
+ * textured quad no matter which effects are on.
+ *
+ * Both the decoded image and the ETC2 copy come with a full mip chain,
+ * downsampled in linear light, so a wallpaper larger than the output is
+ * minified through GL_LINEAR_MIPMAP_LINEAR instead of aliasing.
+ *
+ */
+
+#define WALLPAPER_THUMB_KIND   "thumb"
+#define WALLPAPER_THUMB_WIDTH  64
+#define WALLPAPER_THUMB_HEIGHT 36
+#define WALLPAPER_THUMB_BLUR   2 // box radius in thumbnail pixels, applied 3 times
+#define WALLPAPER_ETC_KIND     "etc2"
+
+static bool wallpaper_key(const char* path, const struct bg_effects* fx, uint64_t* key)
+{
+  return bg_cache_key(path, anvil_hash64(fx, sizeof(*fx)), key);
+}
+
+static bool wallpaper_load_thumbnail(const char* path, const struct bg_effects* fx,
+                                     struct decoded_image* out)
+{
+  uint64_t key;
+  return wallpaper_key(path, fx, &key) && bg_cache_load_image(key, WALLPAPER_THUMB_KIND, out);
+}
+
+// Build the thumbnail from a freshly decoded wallpaper so the next lock can show it
+static void wallpaper_store_thumbnail(const char* path, const struct bg_effects* fx,
+                                      const struct decoded_image* full)
+{
+  uint64_t             key;
+  struct decoded_image thumb = {0};
+  if (!wallpaper_key(path, fx, &key) ||
+      !image_downscale(full, WALLPAPER_THUMB_WIDTH, WALLPAPER_THUMB_HEIGHT, &thumb))
+  {
+    return;
+  }
+
+  // Blurred on purpose, hides the blockiness of upscaling 64x36 to the whole output
+  image_box_blur(&thumb, WALLPAPER_THUMB_BLUR, 3);
+  bg_cache_store_image(key, WALLPAPER_THUMB_KIND, &thumb);
+  free(thumb.pixels);
+
+  log_message(LOG_LEVEL_DEBUG, "[WALLPAPER] Cached %dx%d thumbnail for %s", WALLPAPER_THUMB_WIDTH,
+              WALLPAPER_THUMB_HEIGHT, path);
+}
+
+static bool wallpaper_load_etc(const char* path, const struct bg_effects* fx,
+                               struct compressed_image* out)
+{
+  uint64_t               key;
+  struct bg_cache_header hdr;
+  void*                  payload;
+  if (!wallpaper_key(path, fx, &key) || !bg_cache_load(key, WALLPAPER_ETC_KIND, &hdr, &payload))
+  {
+    return false;
+  }
+
+  if (hdr.format != BG_CACHE_FORMAT_ETC2_RGB8 || hdr.width == 0 || hdr.height == 0 ||
+      hdr.levels < 1 || hdr.levels > (uint32_t)image_mip_count(hdr.width, hdr.height) ||
+      etc_chain_size(hdr.width, hdr.height, hdr.levels) != hdr.payload_size)
+  {
+    free(payload);
+    return false;
+  }
+
+  out->data   = payload;
+  out->size   = hdr.payload_size;
+  out->width  = hdr.width;
+  out->height = hdr.height;
+  out->levels = hdr.levels;
+  return true;
+}
+
+static void wallpaper_store_etc(const char* path, const struct bg_effects* fx,
+                                const struct decoded_image* full, const struct image_mips* mips)
+{
+  uint64_t                key;
+  struct compressed_image etc = {0};
+  if (!wallpaper_key(path, fx, &key) || bg_cache_exists(key, WALLPAPER_ETC_KIND) ||
+      !etc2_rgb8_encode(full, mips, &etc))
+  {
+    return;
+  }
+
+  struct bg_cache_header hdr = {0};
+  hdr.format                 = BG_CACHE_FORMAT_ETC2_RGB8;
+  hdr.width                  = etc.width;
+  hdr.height                 = etc.height;
+  hdr.levels                 = etc.levels;
+  hdr.payload_size           = etc.size;
+  bg_cache_store(key, WALLPAPER_ETC_KIND, &hdr, etc.data);
+  free(etc.data);
+
+  log_message(LOG_LEVEL_DEBUG, "[WALLPAPER] Cached ETC2 copy of %s (%zu bytes)", path, etc.size);
+}
+
+// Bake the [bg] effects into a freshly decoded wallpaper
+static void wallpaper_apply_effects(struct decoded_image* image, const struct bg_effects* fx)
+{
+  if (!image_apply_effects(image, fx))
+  {
+    log_message(LOG_LEVEL_WARN, "[WALLPAPER] Out of memory applying background effects");
+  }
+}
+
+#endif // WALLPAPER_H
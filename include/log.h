@@ -82,11 +82,15 @@ void log_message(enum log_importance verbosity, const char* fmt, ...)
   va_list args;
   va_start(args, fmt);
 
+  // Startup tasks log from worker threads, keep each message in one piece
+  flockfile(stderr);
+
   // Prefix the time to the log message
-  time_t     t       = time(NULL);
-  struct tm* tm_info = localtime(&t);
-  char       buffer[26];
-  strftime(buffer, sizeof(buffer), "[%F %T] - ", tm_info);
+  time_t    t = time(NULL);
+  struct tm tm_info;
+  char      buffer[26];
+  localtime_r(&t, &tm_info);
+  strftime(buffer, sizeof(buffer), "[%F %T] - ", &tm_info);
   fprintf(stderr, "%s", buffer);
 
   unsigned c = (verbosity < LOG_IMPORTANCE_LAST) ? verbosity : LOG_IMPORTANCE_LAST - 1;
@@ -104,6 +108,7 @@ void log_message(enum log_importance verbosity, const char* fmt, ...)
   }
 
   fprintf(stderr, "\n");
+  funlockfile(stderr);
   va_end(args);
 }
 
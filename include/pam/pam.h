@@ -2,13 +2,30 @@
 #define TEST_PAM_H
 
 #include "../log.h"
+#include "../startup/startup.h"
 #include "password_buffer.h"
 #include <security/pam_appl.h>
 #include <security/pam_misc.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+static char* pam_conv_password; // what the conversation answers with, in the secure arena
+
+// Map the secure arena and carve the live input buffer out of it, once before any input
+static char* pam_secure_init(void)
+{
+  if (!secure_arena_init(&secure_arena, 2 * PAM_PASSWORD_SIZE))
+  {
+    return NULL;
+  }
+  char* input       = secure_arena_alloc(&secure_arena, PAM_PASSWORD_SIZE);
+  pam_conv_password = secure_arena_alloc(&secure_arena, PAM_PASSWORD_SIZE);
+  return pam_conv_password ? input : NULL;
+}
+
 static int pam_conv_func(int num_msg, const struct pam_message** msg, struct pam_response** resp,
                          void* appdata_ptr)
 {
@@ -19,7 +36,7 @@ static int pam_conv_func(int num_msg, const struct pam_message** msg, struct pam
   {
     if (msg[i]->msg_style == PAM_PROMPT_ECHO_OFF)
     {
-      // Use the provided password for echo-off prompts
+      // Use the provided password for echo-off prompts; libpam wipes and frees the copy
       reply[i].resp         = strdup(password);
       reply[i].resp_retcode = 0;
     }
@@ -34,53 +51,121 @@ static int pam_conv_func(int num_msg, const struct pam_message** msg, struct pam
   return PAM_SUCCESS;
 }
 
-// Function to authenticate the user with PAM
-int authenticate_user(const char* username, const char* input_password)
+/*
+ * @PAM SESSION:
+ *
+ * pam_start() reads the service's stack from /etc/pam.d and dlopen()s every
+ * module in it; with pam_sss or pam_systemd_home that alone is 100+ ms. There
+ * is one handle for the whole lock session, started on a startup worker as
+ * soon as the config names the service, while the user is still typing. It
+ * is reused for every retry and only ended once an attempt unlocks:
+ *
+ *   worker: pam_start(service) ............ (waits config, runs while locking)
+ *   Enter:  [wait for the worker] -> pam_authenticate -> failed? keep the handle
+ *                                                     -> pam_acct_mgmt -> pam_end, unlock
+ *
+ * libpam clears the authentication token at the end of every
+ * pam_authenticate(), so a retry never sees the previous password. A handle
+ * the stack gave up on (PAM_ABORT, PAM_MAXTRIES) is ended and started again
+ * inline on the next attempt.
+ *
+ * Every attempt logs where its time went: waiting for the worker, starting a
+ * handle inline, and the check itself. The worker shows up as "pam" in the
+ * startup timeline.
+ *
+ */
+
+static pam_handle_t* pam_handle;
+static char          pam_service[PAM_SERVICE_MAX] = PAM_DEFAULT_SERVICE;
+static int           pam_attempts;
+
+static void pam_session_end(int status)
 {
-  // Create a secure password buffer
-  char* password = password_buffer_create(strlen(input_password) + 1);
-  if (!password)
+  if (pam_handle)
   {
-    log_message(LOG_LEVEL_ERROR, "Failed to create secure password buffer.");
-    return 0;
+    pam_end(pam_handle, status);
+    pam_handle = NULL;
   }
+}
 
-  // Copy the input password into the secure buffer
-  strncpy(password, input_password, strlen(input_password) + 1);
-
-  struct pam_conv pam_conversation = {pam_conv_func, (void*)password}; // Pass password here
-  pam_handle_t*   pamh             = NULL;
-  int             pam_status       = pam_start("login", username, &pam_conversation, &pamh);
+// Start the handle for `service` (NULL keeps the last one) if it is not running yet
+static bool pam_session_start(const char* service, const char* username)
+{
+  if (service && *service)
+  {
+    snprintf(pam_service, sizeof(pam_service), "%s", service);
+  }
+  if (pam_handle)
+  {
+    return true;
+  }
 
+  // The conversation always answers from the arena copy, whichever attempt is running
+  struct pam_conv pam_conversation = {pam_conv_func, (void*)pam_conv_password};
+  uint64_t        start            = startup_now_ns();
+  int             pam_status = pam_start(pam_service, username, &pam_conversation, &pam_handle);
   if (pam_status != PAM_SUCCESS)
   {
-    log_message(LOG_LEVEL_ERROR, "PAM start failed: %s", pam_strerror(pamh, pam_status));
-    password_buffer_destroy(password, strlen(input_password) + 1); // Clean up
-    return 0;
+    log_message(LOG_LEVEL_ERROR, "PAM start failed: %s", pam_strerror(pam_handle, pam_status));
+    pam_handle = NULL;
+    return false;
   }
+  log_message(LOG_LEVEL_DEBUG, "[PAM] Started service '%s' in %.2f ms", pam_service,
+              (startup_now_ns() - start) / 1e6);
+  return true;
+}
+
+// Check `input_password` with the running handle, ending it once it unlocked
+static int pam_session_verify(const char* input_password)
+{
+  // The conversation reads from its own copy in the secure arena, wiped once PAM is done
+  size_t length = strnlen(input_password, PAM_PASSWORD_SIZE - 1);
+  memcpy(pam_conv_password, input_password, length);
+  pam_conv_password[length] = '\0';
 
-  pam_status = pam_authenticate(pamh, 0);
+  int pam_status = pam_authenticate(pam_handle, 0);
+  secure_wipe(pam_conv_password, PAM_PASSWORD_SIZE);
   if (pam_status != PAM_SUCCESS)
   {
-    log_message(LOG_LEVEL_ERROR, "PAM authentication failed: %s", pam_strerror(pamh, pam_status));
-    pam_end(pamh, pam_status);
-    password_buffer_destroy(password, strlen(input_password) + 1); // Clean up
+    log_message(LOG_LEVEL_ERROR, "PAM authentication failed: %s",
+                pam_strerror(pam_handle, pam_status));
+    if (pam_status == PAM_ABORT || pam_status == PAM_MAXTRIES)
+    {
+      pam_session_end(pam_status);
+    }
     return 0;
   }
 
-  pam_status = pam_acct_mgmt(pamh, 0);
+  pam_status = pam_acct_mgmt(pam_handle, 0);
   if (pam_status != PAM_SUCCESS)
   {
     log_message(LOG_LEVEL_ERROR, "PAM account management failed: %s",
-                pam_strerror(pamh, pam_status));
-    pam_end(pamh, pam_status);
-    password_buffer_destroy(password, strlen(input_password) + 1); // Clean up
+                pam_strerror(pam_handle, pam_status));
     return 0;
   }
 
-  pam_end(pamh, PAM_SUCCESS);
-  password_buffer_destroy(password, strlen(input_password) + 1); // Clean up
+  pam_session_end(PAM_SUCCESS);
   return 1;
 }
 
+// Function to authenticate the user with PAM
+int authenticate_user(const char* username, const char* input_password)
+{
+  // Enter may beat the warm-up; waiting for it is still cheaper than a second pam_start()
+  uint64_t begin = startup_now_ns();
+  startup_task_wait(STARTUP_TASK_PAM);
+  uint64_t warmed  = startup_now_ns();
+  bool     started = pam_session_start(NULL, username);
+  uint64_t ready   = startup_now_ns();
+  int      result  = started ? pam_session_verify(input_password) : 0;
+  uint64_t end     = startup_now_ns();
+
+  log_message(LOG_LEVEL_INFO,
+              "[PAM] Attempt %d %s in %.2f ms: %.2f ms waiting for the warm-up, %.2f ms starting "
+              "PAM, %.2f ms checking",
+              ++pam_attempts, result ? "succeeded" : "failed", (end - begin) / 1e6,
+              (warmed - begin) / 1e6, (ready - warmed) / 1e6, (end - ready) / 1e6);
+  return result;
+}
+
 #endif // TEST_PAM_H
@@ -1,6 +1,8 @@
 #ifndef PWD_BUF_H
 #define PWD_BUF_H
 
+#include "../log.h"
+#include "../memory/anvil_mem.h"
 #include <errno.h>
 #include <limits.h>
 #include <stdbool.h>
@@ -64,45 +66,113 @@ static bool password_buffer_unlock(char* addr, size_t size)
   return true;
 }
 
-// Create a secure password buffer
-char* password_buffer_create(size_t size)
+/*
+ * @SECURE ARENA:
+ *
+ * Everything the password passes through on our side lives in one mapping,
+ * made once at startup and reused by every attempt:
+ *
+ *   [ guard page ][ input buffer | PAM conversation copy | ... ][ guard page ]
+ *     PROT_NONE     mlock()ed, MADV_DONTDUMP                     PROT_NONE
+ *
+ * It is never swapped out and never ends up in a core dump, and running off
+ * either end faults instead of reading or writing a neighbour. Whatever held
+ * a password is wiped with ANVIL_MEMZERO, which the compiler cannot drop.
+ *
+ * The responses the conversation function hands back are the one exception:
+ * libpam takes them over and free()s them (overwriting them first), so those
+ * have to come from malloc.
+ *
+ */
+
+struct secure_arena
+{
+  unsigned char* map; // including the guard pages
+  size_t         map_size;
+  unsigned char* base;
+  size_t         size;
+  size_t         used;
+  bool           locked; // mlock() succeeded
+};
+
+static struct secure_arena secure_arena;
+
+// Wipe `size` bytes in a way the compiler has to keep
+static void secure_wipe(void* buffer, size_t size)
 {
-  void* buffer;
-  int   result = posix_memalign(&buffer, get_page_size(), size);
-  if (result)
+  if (buffer)
   {
-    errno = result; // posix_memalign doesn't set errno according to the man page
-    log_message(LOG_LEVEL_ERROR, "Failed to allocate password buffer");
-    return NULL;
+    ANVIL_MEMZERO(buffer, size);
   }
+}
+
+static bool secure_arena_init(struct secure_arena* arena, size_t size)
+{
+  size_t page  = (size_t)get_page_size();
+  size_t pages = (size + page - 1) / page;
 
-  if (!password_buffer_lock(buffer, size))
+  arena->map_size = (pages + 2) * page;
+  arena->map      = mmap(NULL, arena->map_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (arena->map == MAP_FAILED)
   {
-    free(buffer);
-    return NULL;
+    arena->map = NULL;
+    log_message(LOG_LEVEL_ERROR, "[SECURE] Failed to map the password arena: %s", strerror(errno));
+    return false;
+  }
+  arena->base = arena->map + page;
+  arena->size = pages * page;
+  arena->used = 0;
+  if (mprotect(arena->base, arena->size, PROT_READ | PROT_WRITE) != 0)
+  {
+    log_message(LOG_LEVEL_ERROR, "[SECURE] Failed to open the password arena: %s",
+                strerror(errno));
+    munmap(arena->map, arena->map_size);
+    arena->map = NULL;
+    return false;
   }
 
-  return (char*)buffer;
+  if (madvise(arena->base, arena->size, MADV_DONTDUMP) != 0)
+  {
+    log_message(LOG_LEVEL_WARN, "[SECURE] Password arena may show up in core dumps: %s",
+                strerror(errno));
+  }
+  arena->locked = password_buffer_lock((char*)arena->base, arena->size) && mlock_supported;
+  if (!arena->locked)
+  {
+    log_message(LOG_LEVEL_WARN, "[SECURE] Password arena is not locked, it may be swapped out");
+  }
+  log_message(LOG_LEVEL_DEBUG, "[SECURE] Password arena of %zu bytes between guard pages",
+              arena->size);
+  return true;
 }
 
-// Clear the buffer securely
-void clear_buffer(char* buffer, size_t size)
+// `size` zeroed bytes for the life of the arena, NULL once it is full
+static void* secure_arena_alloc(struct secure_arena* arena, size_t size)
 {
-  if (buffer)
+  size = (size + 15) & ~(size_t)15;
+  if (!arena->base || arena->used + size > arena->size)
   {
-    memset(buffer, 0, size); // Clear the buffer
+    log_message(LOG_LEVEL_ERROR, "[SECURE] Password arena is full");
+    return NULL;
   }
+  void* buffer = arena->base + arena->used;
+  arena->used += size;
+  return buffer;
 }
 
-// Destroy the password buffer securely
-void password_buffer_destroy(char* buffer, size_t size)
+static void secure_arena_destroy(struct secure_arena* arena)
 {
-  if (buffer)
+  if (!arena->map)
+  {
+    return;
+  }
+  secure_wipe(arena->base, arena->size);
+  if (arena->locked)
   {
-    clear_buffer(buffer, size);
-    password_buffer_unlock(buffer, size);
-    free(buffer);
+    password_buffer_unlock((char*)arena->base, arena->size);
   }
+  munmap(arena->map, arena->map_size);
+  memset(arena, 0, sizeof(*arena));
 }
 
 #endif
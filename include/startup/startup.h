@@ -0,0 +1,370 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include "../client_state.h"
+#include "../global_funcs.h"
+#include "../log.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * @STARTUP TASK GRAPH:
+ *
+ * Most of what anvilock does before its first frame is independent:
+ *
+ *   main:    wayland roundtrip -> xkb -> [config] -> screencopy -> lock -> shaders -> EGL -> frames
+ *                                                          {font, thumbnail, wallpaper} ^
+ *   worker:  config parse
+ *   worker:  (waits config) FT_Init_FreeType + FT_New_Face
+ *   worker:  (waits config, screenshot) cached wallpaper thumbnail
+ *   worker:  (waits config, screenshot) cached ETC2 wallpaper, (waits gl-caps) else full decode
+ *   worker:  (waits wallpaper) build missing bg cache entries from the decoded image
+ *   worker:  (waits config) pam_start, dlopen()s the PAM stack while the user types
+ *   worker:  compositor keymap compile, key events are queued until it is in
+ *   gate:    gl-caps, opened by the main thread once the GL context is up
+ *   gate:    screenshot, opened once a captured desktop is (or is not) the background
+ *
+ * A [name] on the main thread is where it joins the corresponding task, a
+ * {name} is streamed into whichever frame comes after it finished.
+ *
+ * Gates are tasks without a thread: they are declared up front so workers can
+ * wait on them, and the main thread completes them with startup_gate_open().
+ *
+ * The screencopy stage only runs with [bg] mode = "screenshot", which is why
+ * the main thread joins the config before locking; that task is a cache hit
+ * almost always and done well before the Wayland roundtrip anyway.
+ *
+ * Each worker task runs on its own thread and signals completion through a
+ * mutex/condvar pair. Anything that consumes a task's output must call
+ * startup_task_wait() first; that also provides the memory barrier for
+ * whatever the task wrote into client_state.
+ *
+ * The main thread never has to block on a task though: every completion also
+ * bumps startup_wake_fd, which the event loop polls next to the Wayland fd,
+ * so finished assets can be picked up with startup_task_poll() and streamed
+ * into the next frame.
+ *
+ * Every task and main-thread stage is timed, and startup_report() logs the
+ * whole timeline once the lock screen is complete.
+ *
+ */
+
+enum startup_task_id
+{
+  STARTUP_TASK_CONFIG,
+  STARTUP_TASK_FONT,
+  STARTUP_TASK_THUMBNAIL,
+  STARTUP_TASK_WALLPAPER,
+  STARTUP_TASK_BG_CACHE,
+  STARTUP_TASK_PAM,
+  STARTUP_TASK_GL_CAPS,    // gate
+  STARTUP_TASK_SCREENSHOT, // gate
+  STARTUP_TASK_KEYMAP,     // launched by the first wl_keyboard.keymap event
+  STARTUP_TASK_COUNT
+};
+
+typedef int (*startup_task_fn)(struct client_state* state);
+
+struct startup_task
+{
+  const char*          name;
+  startup_task_fn      fn;
+  struct client_state* state;
+  pthread_t            thread;
+  pthread_mutex_t      lock;
+  pthread_cond_t       cond;
+  bool                 launched;
+  bool                 gate;
+  bool                 done;
+  int                  result;
+};
+
+#define STARTUP_MAX_STAGES 16
+
+struct startup_stage
+{
+  const char* name;
+  bool        worker;
+  uint64_t    start_ns;
+  uint64_t    end_ns;
+};
+
+static struct startup_task startup_tasks[STARTUP_TASK_COUNT];
+
+// Readable whenever a task finished since the last startup_drain_wake()
+static int startup_wake_fd = -1;
+
+static struct
+{
+  pthread_mutex_t      lock;
+  uint64_t             epoch_ns;
+  int                  count;
+  struct startup_stage stages[STARTUP_MAX_STAGES];
+} startup_timeline = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static uint64_t startup_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Begin timing a stage; returns a handle for startup_stage_end()
+static int startup_stage_begin(const char* name, bool worker)
+{
+  pthread_mutex_lock(&startup_timeline.lock);
+  int idx = -1;
+  if (startup_timeline.count < STARTUP_MAX_STAGES)
+  {
+    idx                                   = startup_timeline.count++;
+    startup_timeline.stages[idx].name     = name;
+    startup_timeline.stages[idx].worker   = worker;
+    startup_timeline.stages[idx].start_ns = startup_now_ns();
+    startup_timeline.stages[idx].end_ns   = 0;
+  }
+  pthread_mutex_unlock(&startup_timeline.lock);
+  return idx;
+}
+
+static void startup_stage_end(int idx)
+{
+  if (idx < 0)
+  {
+    return;
+  }
+  pthread_mutex_lock(&startup_timeline.lock);
+  startup_timeline.stages[idx].end_ns = startup_now_ns();
+  pthread_mutex_unlock(&startup_timeline.lock);
+}
+
+// Publish a task's result to its waiters and the event loop
+static void startup_task_complete(struct startup_task* task, int ret)
+{
+  pthread_mutex_lock(&task->lock);
+  task->result = ret;
+  task->done   = true;
+  pthread_cond_broadcast(&task->cond);
+  pthread_mutex_unlock(&task->lock);
+
+  if (startup_wake_fd >= 0)
+  {
+    // EAGAIN only means the counter is already full, the loop wakes up either way
+    uint64_t one = 1;
+    if (write(startup_wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+      log_message(LOG_LEVEL_ERROR, "[STARTUP] Failed to wake the event loop: %s", strerror(errno));
+    }
+  }
+}
+
+static void* startup_task_thread(void* arg)
+{
+  struct startup_task* task  = arg;
+  int                  stage = startup_stage_begin(task->name, true);
+  int                  ret   = task->fn(task->state);
+  startup_stage_end(stage);
+
+  startup_task_complete(task, ret);
+  return NULL;
+}
+
+// Reset the timeline; everything in the report is relative to this call
+static void startup_begin(void)
+{
+  startup_timeline.epoch_ns = startup_now_ns();
+  startup_timeline.count    = 0;
+
+  if (startup_wake_fd < 0)
+  {
+    startup_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  }
+}
+
+static void startup_drain_wake(void)
+{
+  uint64_t count;
+  if (startup_wake_fd >= 0)
+  {
+    // EAGAIN: a poll woke up for another fd and nothing finished since the last drain
+    if (read(startup_wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    {
+      log_message(LOG_LEVEL_ERROR, "[STARTUP] Failed to drain the wake fd: %s", strerror(errno));
+    }
+  }
+}
+
+// Declare a gate, i.e. a task the main thread completes itself with startup_gate_open()
+static void startup_gate_declare(enum startup_task_id id, const char* name)
+{
+  struct startup_task* task = &startup_tasks[id];
+  task->name                = name;
+  task->gate                = true;
+  task->done                = false;
+  task->result              = -1;
+  pthread_mutex_init(&task->lock, NULL);
+  pthread_cond_init(&task->cond, NULL);
+}
+
+static void startup_gate_open(enum startup_task_id id, int result)
+{
+  struct startup_task* task = &startup_tasks[id];
+  if (!task->gate)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&task->lock);
+  task->result = result;
+  task->done   = true;
+  pthread_cond_broadcast(&task->cond);
+  pthread_mutex_unlock(&task->lock);
+}
+
+static void startup_task_spawn(enum startup_task_id id, const char* name, startup_task_fn fn,
+                               struct client_state* state, bool inline_ok)
+{
+  struct startup_task* task = &startup_tasks[id];
+  task->name                = name;
+  task->fn                  = fn;
+  task->state               = state;
+  task->done                = false;
+  task->result              = -1;
+  pthread_mutex_init(&task->lock, NULL);
+  pthread_cond_init(&task->cond, NULL);
+
+  if (pthread_create(&task->thread, NULL, startup_task_thread, task) != 0)
+  {
+    if (!inline_ok)
+    {
+      log_message(LOG_LEVEL_WARN, "[STARTUP] Unable to spawn worker for '%s', skipping it.", name);
+      startup_task_complete(task, -1);
+      return;
+    }
+    log_message(LOG_LEVEL_WARN, "[STARTUP] Unable to spawn worker for '%s', running inline.",
+                name);
+    startup_task_thread(task);
+    return;
+  }
+  task->launched = true;
+}
+
+// Kick off a task on a worker thread. Falls back to running it inline if no thread can be made.
+static void startup_task_launch(enum startup_task_id id, const char* name, startup_task_fn fn,
+                                struct client_state* state)
+{
+  startup_task_spawn(id, name, fn, state, true);
+}
+
+/*
+ * Same for a task that waits on a gate. Only the main thread opens gates, so
+ * such a task cannot run inline; without a worker it fails right away and
+ * whatever waits on it takes its fallback.
+ */
+static void startup_task_launch_gated(enum startup_task_id id, const char* name,
+                                      startup_task_fn fn, struct client_state* state)
+{
+  startup_task_spawn(id, name, fn, state, false);
+}
+
+// Block until a task finished; returns its result (0 on success)
+static int startup_task_wait(enum startup_task_id id)
+{
+  struct startup_task* task = &startup_tasks[id];
+  if (!task->name)
+  {
+    return -1; // never launched or declared
+  }
+
+  pthread_mutex_lock(&task->lock);
+  while (!task->done)
+  {
+    pthread_cond_wait(&task->cond, &task->lock);
+  }
+  int ret = task->result;
+  pthread_mutex_unlock(&task->lock);
+  return ret;
+}
+
+// Non-blocking check; true once the task finished, with its result in *result
+static bool startup_task_poll(enum startup_task_id id, int* result)
+{
+  struct startup_task* task = &startup_tasks[id];
+  if (!task->name)
+  {
+    *result = -1;
+    return true;
+  }
+
+  pthread_mutex_lock(&task->lock);
+  bool done = task->done;
+  *result   = task->result;
+  pthread_mutex_unlock(&task->lock);
+  return done;
+}
+
+// Join every worker, used before tearing down anything they might still touch
+static void startup_join_all(void)
+{
+  // Workers may be blocked on a gate we never got to open
+  for (int i = 0; i < STARTUP_TASK_COUNT; i++)
+  {
+    if (startup_tasks[i].gate)
+    {
+      pthread_mutex_lock(&startup_tasks[i].lock);
+      bool done = startup_tasks[i].done;
+      pthread_mutex_unlock(&startup_tasks[i].lock);
+      if (!done)
+      {
+        startup_gate_open(i, -1);
+      }
+    }
+  }
+
+  for (int i = 0; i < STARTUP_TASK_COUNT; i++)
+  {
+    struct startup_task* task = &startup_tasks[i];
+    if (task->launched)
+    {
+      pthread_join(task->thread, NULL);
+      pthread_mutex_destroy(&task->lock);
+      pthread_cond_destroy(&task->cond);
+      task->launched = false;
+    }
+  }
+
+  if (startup_wake_fd >= 0)
+  {
+    close(startup_wake_fd);
+    startup_wake_fd = -1;
+  }
+}
+
+// Log the startup timeline, in ms since startup_begin()
+static void startup_report(void)
+{
+  pthread_mutex_lock(&startup_timeline.lock);
+  uint64_t epoch = startup_timeline.epoch_ns;
+  uint64_t last  = epoch;
+
+  log_message(LOG_LEVEL_INFO, "[STARTUP] %-12s %-6s %9s %9s %9s", "stage", "thread", "start",
+              "end", "took");
+  for (int i = 0; i < startup_timeline.count; i++)
+  {
+    struct startup_stage* stage = &startup_timeline.stages[i];
+    uint64_t              end   = stage->end_ns ? stage->end_ns : stage->start_ns;
+    last                        = ANVIL_MAX(last, end);
+    log_message(LOG_LEVEL_INFO, "[STARTUP] %-12s %-6s %7.2fms %7.2fms %7.2fms", stage->name,
+                stage->worker ? "worker" : "main", (stage->start_ns - epoch) / 1e6,
+                (end - epoch) / 1e6, (end - stage->start_ns) / 1e6);
+  }
+  log_message(LOG_LEVEL_INFO, "[STARTUP] lock screen complete after %.2fms", (last - epoch) / 1e6);
+  pthread_mutex_unlock(&startup_timeline.lock);
+}
+
+#endif // STARTUP_H
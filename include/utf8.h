@@ -0,0 +1,88 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * @NOTE:
+ *
+ * UTF-8 codecs, revived from deprecated/unicode.h. The password buffer holds
+ * UTF-8 as typed (xkb_state_key_get_utf8()), one dot is shown per codepoint
+ * and backspace removes a whole codepoint. Text layout walks its strings by
+ * codepoint too.
+ *
+ */
+
+// Bytes of the last codepoint in the NUL terminated `str`, 0 if it is empty
+static inline int utf8_last_size(const char* str)
+{
+  int         len = 0;
+  const char* pos = strchr(str, '\0');
+  while (pos > str)
+  {
+    --pos;
+    ++len;
+    if ((*pos & 0xc0) != 0x80)
+    {
+      return len;
+    }
+  }
+  return 0;
+}
+
+// Decode the codepoint at *s and advance past it, '?' for an invalid lead byte
+static inline uint32_t utf8_decode(const char** s)
+{
+  const unsigned char* p     = (const unsigned char*)*s;
+  uint32_t             ch    = 0;
+  int                  extra = 0;
+
+  if (*p < 0x80)
+  {
+    ch    = *p;
+    extra = 0;
+  }
+  else if ((*p & 0xE0) == 0xC0)
+  {
+    ch    = *p & 0x1F;
+    extra = 1;
+  }
+  else if ((*p & 0xF0) == 0xE0)
+  {
+    ch    = *p & 0x0F;
+    extra = 2;
+  }
+  else if ((*p & 0xF8) == 0xF0)
+  {
+    ch    = *p & 0x07;
+    extra = 3;
+  }
+  else
+  {
+    *s += 1;
+    return '?'; // Invalid UTF-8 sequence, return a placeholder
+  }
+
+  *s += 1;
+  while (extra-- > 0 && (**s & 0xC0) == 0x80) // a truncated sequence stops at the NUL
+  {
+    ch = (ch << 6) | (*(*s)++ & 0x3F);
+  }
+
+  return ch;
+}
+
+static inline int utf8_strlen(const char* s)
+{
+  int count = 0;
+  while (*s)
+  {
+    utf8_decode(&s); // Advance by one UTF-8 character
+    count++;
+  }
+  return count;
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef INPUT_QUEUE_H
+#define INPUT_QUEUE_H
+
+#include "../client_state.h"
+#include "../log.h"
+#include "../startup/startup.h"
+#include <stdbool.h>
+#include <string.h>
+
+/*
+ * @INPUT QUEUE:
+ *
+ * A password manager, or a fast typist, can hand us twenty keys in a single
+ * Wayland read. Handlers therefore only record what happened; once the read
+ * is dispatched the whole batch is applied in the order it arrived, and the
+ * event loop renders one frame for all of it:
+ *
+ *   wl_display_dispatch_pending -> key, modifiers, key, pointer frame, touch frame ... -> queue
+ *   input_queue_flush           -> password / xkb_state / pointer / keypad, in order
+ *   event loop                  -> render_lock_screen, once
+ *
+ * Keyboard events are held back while the first keymap is still compiling
+ * (see wl_keyboard_handle.h), and everything behind them with them so the
+ * order never changes; keypad taps type into the same password, so they
+ * wait too. If that fills the queue, the event loop waits for the keymap
+ * rather than drop a key. Pointer frames only move the hover and go
+ * straight through.
+ * Once the session is unlocked the rest is dropped.
+ *
+ */
+
+// Applying events lives with their handlers
+static void keyboard_apply_event(struct client_state* state, const struct input_event* event);
+static void pointer_apply_frame(struct client_state* state, const struct pointer_event* event);
+static void touch_apply_frame(struct client_state* state, const struct touch_event* event);
+static void keymap_loader_adopt(struct client_state* state, int result);
+
+static void input_queue_flush(struct client_state* state)
+{
+  struct input_queue* queue   = &state->input_queue;
+  int                 applied = 0;
+  for (; applied < queue->count; applied++)
+  {
+    const struct input_event* event = &queue->events[applied];
+    if (state->pam.auth_state.auth_success)
+    {
+      applied = queue->count;
+      break;
+    }
+    if (event->type == INPUT_EVENT_POINTER_FRAME)
+    {
+      pointer_apply_frame(state, &event->pointer);
+    }
+    else if (state->keymap_loader.pending)
+    {
+      break;
+    }
+    else if (event->type == INPUT_EVENT_TOUCH_FRAME)
+    {
+      touch_apply_frame(state, &event->touch);
+    }
+    else
+    {
+      keyboard_apply_event(state, event);
+    }
+  }
+
+  queue->count -= applied;
+  memmove(queue->events, queue->events + applied, queue->count * sizeof(queue->events[0]));
+}
+
+static void input_queue_push(struct client_state* state, const struct input_event* event)
+{
+  struct input_queue* queue = &state->input_queue;
+  if (queue->count == INPUT_QUEUE_SIZE)
+  {
+    input_queue_flush(state); // a huge batch, apply what we have so far
+  }
+  if (queue->count == INPUT_QUEUE_SIZE && state->keymap_loader.pending)
+  {
+    // Still full, so held back behind the keymap: typed-ahead keys are part of the password
+    // and must not be lost, wait for the keymap instead (it falls back if the worker failed)
+    log_message(LOG_LEVEL_WARN, "[INPUT] Input queue is full, waiting for the keymap");
+    keymap_loader_adopt(state, startup_task_wait(STARTUP_TASK_KEYMAP));
+    input_queue_flush(state);
+  }
+  if (queue->count == INPUT_QUEUE_SIZE)
+  {
+    // Nothing holds events back any more, so a flush always empties the queue
+    log_message(LOG_LEVEL_ERROR, "[INPUT] Input queue is still full, dropping an event");
+    return;
+  }
+  queue->events[queue->count++] = *event;
+}
+
+#endif
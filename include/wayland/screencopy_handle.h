@@ -0,0 +1,229 @@
+#ifndef SCREENCOPY_HANDLE_H
+#define SCREENCOPY_HANDLE_H
+
+#include "../../protocols/src/wlr-screencopy-unstable-v1-client-protocol.c"
+#include "../../protocols/wlr-screencopy-unstable-v1-client-protocol.h"
+#include "../client_state.h"
+#include "../log.h"
+#include "shared_mem_handle.h"
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+/*
+ * @SCREENSHOT BACKGROUND:
+ *
+ * With [bg] mode = "screenshot" the background is the desktop being locked.
+ * It has to be copied before the session lock hides it, so this runs on the
+ * main thread right before initiate_session_lock():
+ *
+ *   capture_output -> buffer (format, size) -> copy into our wl_shm buffer -> ready
+ *
+ * That is one compositor frame. The pixels stay mapped in state->screenshot
+ * until the GL context exists; blurring and uploading them happens in
+ * screen_blur.h.
+ *
+ */
+
+// wl_shm formats we can upload as is: 8 bits per channel, alpha (if any) ignored
+static bool screencopy_format_supported(uint32_t format)
+{
+  return format == WL_SHM_FORMAT_XRGB8888 || format == WL_SHM_FORMAT_ARGB8888 ||
+         format == WL_SHM_FORMAT_XBGR8888 || format == WL_SHM_FORMAT_ABGR8888;
+}
+
+static void screencopy_release(struct screen_capture* capture)
+{
+  if (capture->data)
+  {
+    munmap(capture->data, capture->size);
+    capture->data = NULL;
+  }
+  if (capture->buffer)
+  {
+    wl_buffer_destroy(capture->buffer);
+    capture->buffer = NULL;
+  }
+}
+
+// Allocate the shm buffer the compositor announced and ask for the copy
+static void screencopy_start_copy(struct zwlr_screencopy_frame_v1* frame,
+                                  struct client_state*             state)
+{
+  struct screen_capture* capture = &state->screenshot;
+  if (capture->buffer || capture->done)
+  {
+    return;
+  }
+
+  if (!screencopy_format_supported(capture->format) || capture->width <= 0 ||
+      capture->height <= 0)
+  {
+    log_message(LOG_LEVEL_WARN, "[SCREENCOPY] No usable shm format offered (0x%08x)",
+                capture->format);
+    capture->done = true;
+    return;
+  }
+
+  capture->size = (size_t)capture->stride * capture->height;
+  int fd        = allocate_shm_file(capture->size);
+  if (fd < 0)
+  {
+    capture->done = true;
+    return;
+  }
+
+  capture->data = mmap(NULL, capture->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (capture->data == MAP_FAILED)
+  {
+    capture->data = NULL;
+    capture->done = true;
+    close(fd);
+    return;
+  }
+
+  struct wl_shm_pool* pool = wl_shm_create_pool(state->wl_shm, fd, capture->size);
+  capture->buffer          = wl_shm_pool_create_buffer(pool, 0, capture->width, capture->height,
+                                                       capture->stride, capture->format);
+  wl_shm_pool_destroy(pool);
+  close(fd);
+
+  zwlr_screencopy_frame_v1_copy(frame, capture->buffer);
+}
+
+static void screencopy_handle_buffer(void* data, struct zwlr_screencopy_frame_v1* frame,
+                                     uint32_t format, uint32_t width, uint32_t height,
+                                     uint32_t stride)
+{
+  struct client_state*   state   = data;
+  struct screen_capture* capture = &state->screenshot;
+
+  // Take the first format we can use; v3 may announce several before buffer_done
+  if (!screencopy_format_supported(capture->format) || capture->width == 0)
+  {
+    capture->format = format;
+    capture->width  = width;
+    capture->height = height;
+    capture->stride = stride;
+  }
+
+  // Before v3 there is exactly one buffer event and no buffer_done
+  if (zwlr_screencopy_frame_v1_get_version(frame) < 3)
+  {
+    screencopy_start_copy(frame, state);
+  }
+}
+
+static void screencopy_handle_buffer_done(void* data, struct zwlr_screencopy_frame_v1* frame)
+{
+  screencopy_start_copy(frame, data);
+}
+
+static void screencopy_handle_flags(void* data, struct zwlr_screencopy_frame_v1* frame,
+                                    uint32_t flags)
+{
+  (void)frame;
+  struct client_state* state = data;
+  state->screenshot.y_invert = flags & ZWLR_SCREENCOPY_FRAME_V1_FLAGS_Y_INVERT;
+}
+
+static void screencopy_handle_ready(void* data, struct zwlr_screencopy_frame_v1* frame,
+                                    uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec)
+{
+  // The presentation time does not matter for a background
+  (void)frame;
+  (void)tv_sec_hi;
+  (void)tv_sec_lo;
+  (void)tv_nsec;
+  struct client_state* state = data;
+  state->screenshot.done     = true;
+}
+
+static void screencopy_handle_failed(void* data, struct zwlr_screencopy_frame_v1* frame)
+{
+  (void)frame;
+  struct client_state* state = data;
+  log_message(LOG_LEVEL_WARN, "[SCREENCOPY] Compositor failed to copy the output");
+  screencopy_release(&state->screenshot);
+  state->screenshot.done = true;
+}
+
+static void screencopy_handle_damage(void* data, struct zwlr_screencopy_frame_v1* frame,
+                                     uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+  // Only sent for copy_with_damage, which we never use
+  (void)data;
+  (void)frame;
+  (void)x;
+  (void)y;
+  (void)width;
+  (void)height;
+}
+
+static void screencopy_handle_linux_dmabuf(void* data, struct zwlr_screencopy_frame_v1* frame,
+                                           uint32_t format, uint32_t width, uint32_t height)
+{
+  // wl_shm is enough for a single frame
+  (void)data;
+  (void)frame;
+  (void)format;
+  (void)width;
+  (void)height;
+}
+
+static const struct zwlr_screencopy_frame_v1_listener screencopy_frame_listener = {
+  .buffer       = screencopy_handle_buffer,
+  .flags        = screencopy_handle_flags,
+  .ready        = screencopy_handle_ready,
+  .failed       = screencopy_handle_failed,
+  .damage       = screencopy_handle_damage,
+  .linux_dmabuf = screencopy_handle_linux_dmabuf,
+  .buffer_done  = screencopy_handle_buffer_done,
+};
+
+/*
+ * Copy the current contents of the output into state->screenshot, blocking
+ * until the compositor answers. Returns false (and leaves nothing mapped) if
+ * screencopy is unavailable or the capture failed.
+ */
+static bool screencopy_capture_output(struct client_state* state)
+{
+  struct screen_capture* capture = &state->screenshot;
+  if (!state->screencopy_manager || !state->output_state.wl_output || !state->wl_shm)
+  {
+    log_message(LOG_LEVEL_WARN, "[SCREENCOPY] Compositor does not offer %s, using the wallpaper",
+                zwlr_screencopy_manager_v1_interface.name);
+    return false;
+  }
+
+  struct zwlr_screencopy_frame_v1* frame = zwlr_screencopy_manager_v1_capture_output(
+    state->screencopy_manager, 0, state->output_state.wl_output);
+  zwlr_screencopy_frame_v1_add_listener(frame, &screencopy_frame_listener, state);
+
+  while (!capture->done)
+  {
+    if (wl_display_dispatch(state->wl_display) == -1)
+    {
+      break;
+    }
+  }
+  zwlr_screencopy_frame_v1_destroy(frame);
+
+  if (!capture->done || !capture->data)
+  {
+    screencopy_release(capture);
+    return false;
+  }
+
+  // The pixels are ours now, only the mapping is needed from here on
+  wl_buffer_destroy(capture->buffer);
+  capture->buffer = NULL;
+
+  log_message(LOG_LEVEL_INFO, "[SCREENCOPY] Captured %dx%d output (format 0x%08x%s)",
+              capture->width, capture->height, capture->format,
+              capture->y_invert ? ", y-inverted" : "");
+  return true;
+}
+
+#endif // SCREENCOPY_HANDLE_H
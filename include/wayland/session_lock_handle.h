@@ -39,6 +39,28 @@ static const struct ext_session_lock_v1_listener ext_session_lock_v1_listener =
   .finished = ext_session_lock_v1_handle_finished,
 };
 
+// Cheap wl_shm frame in the placeholder colour, replaced by the first EGL swap
+static void commit_placeholder_frame(struct client_state* state, uint32_t width, uint32_t height)
+{
+  if (!state->wl_shm)
+  {
+    return;
+  }
+
+  struct wl_buffer* buffer =
+    create_solid_shm_buffer(state->wl_shm, width, height, __ANVIL_PLACEHOLDER_COLOR__);
+  if (!buffer)
+  {
+    log_message(LOG_LEVEL_WARN, "[LOCK] No placeholder frame, waiting for EGL instead");
+    return;
+  }
+
+  wl_surface_attach(state->wl_surface, buffer, 0, 0);
+  wl_surface_damage_buffer(state->wl_surface, 0, 0, width, height);
+  wl_surface_commit(state->wl_surface);
+  log_message(LOG_LEVEL_INFO, "[LOCK] Placeholder frame committed (%ux%u)", width, height);
+}
+
 // Listener callback for ext-session-lock surface configuration
 static void
 ext_session_lock_surface_v1_handle_configure(void*                               data,
@@ -56,7 +78,17 @@ ext_session_lock_surface_v1_handle_configure(void*
   // Mark surface as dirty for re-rendering
   state->session_lock.surface_dirty = true;
 
-  // Render the lock screen once the surface is configured
+  // Until a renderer is up, put a solid frame on screen right away so the
+  // session locks without waiting for any assets
+  if (state->egl_surface == EGL_NO_SURFACE && !state->soft.active)
+  {
+    commit_placeholder_frame(state, width, height);
+    return;
+  }
+
+  // Render the lock screen once the surface is configured, the configure has to be answered
+  // with a commit even if nothing on it changed
+  state->session_lock.configures++;
   render_lock_screen(state);
 }
 
@@ -86,14 +118,14 @@ static void create_lock_surface(struct client_state* state)
   ext_session_lock_surface_v1_add_listener(state->session_lock.ext_session_lock_surface,
                                            &ext_session_lock_surface_v1_listener, state);
 
-  init_egl(state);
-
-  // Add Wayland listeners for input devices
+  // Add Wayland listeners for input devices; the pointer gets its own once something binds it
   wl_keyboard_add_listener(state->wl_keyboard, &wl_keyboard_listener, state);
-  wl_pointer_add_listener(state->wl_pointer, &wl_pointer_listener, state);
 
   // Mark the surface as created
   state->session_lock.surface_created = true;
+
+  // Wait for the configure, which commits the placeholder frame
+  wl_display_roundtrip(state->wl_display);
 }
 
 // Function to initiate the session lock process
@@ -104,9 +136,8 @@ static void initiate_session_lock(struct client_state* state)
     ext_session_lock_manager_v1_lock(state->session_lock.ext_session_lock_manager);
   assert(state->session_lock.ext_session_lock);
 
-  // Create the lock surface and trigger lock screen rendering
+  // Create the lock surface, it shows a placeholder until init_egl() takes over
   create_lock_surface(state);
-  render_lock_screen(state);
 }
 
 // Function to unlock and destroy the session lock
@@ -1,6 +1,11 @@
 #ifndef WL_BUF_HANDLER_H
 #define WL_BUF_HANDLER_H
 
+#include "../log.h"
+#include "shared_mem_handle.h"
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <wayland-client.h>
 
 static void wl_buffer_release(void* data, struct wl_buffer* wl_buffer)
@@ -13,4 +18,44 @@ static const struct wl_buffer_listener wl_buffer_listener = {
   .release = wl_buffer_release,
 };
 
+// Single-colour XRGB8888 buffer, destroyed again once the compositor releases it
+static struct wl_buffer* create_solid_shm_buffer(struct wl_shm* shm, int width, int height,
+                                                 uint32_t xrgb)
+{
+  int    stride = width * 4;
+  size_t size   = (size_t)stride * height;
+
+  int fd = allocate_shm_file(size);
+  if (fd < 0)
+  {
+    log_message(LOG_LEVEL_ERROR, "Failed to allocate %zu bytes of shm", size);
+    return NULL;
+  }
+
+  // A freshly truncated shm file already reads back as zeroes, i.e. black
+  if (xrgb & 0x00FFFFFF)
+  {
+    uint32_t* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+    {
+      close(fd);
+      return NULL;
+    }
+    for (size_t i = 0; i < size / 4; i++)
+    {
+      data[i] = xrgb;
+    }
+    munmap(data, size);
+  }
+
+  struct wl_shm_pool* pool   = wl_shm_create_pool(shm, fd, size);
+  struct wl_buffer*   buffer =
+    wl_shm_pool_create_buffer(pool, 0, width, height, stride, WL_SHM_FORMAT_XRGB8888);
+  wl_shm_pool_destroy(pool);
+  close(fd);
+
+  wl_buffer_add_listener(buffer, &wl_buffer_listener, NULL);
+  return buffer;
+}
+
 #endif
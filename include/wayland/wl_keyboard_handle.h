@@ -2,44 +2,157 @@
 #define WL_KB_HANDLER_H
 
 #include "../client_state.h"
+#include "../startup/startup.h"
+#include "../utf8.h"
+#include "input_queue.h"
 #include "xdg_surface_handle.h"
 #include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/timerfd.h>
 #include <time.h>
 #include <wayland-client.h>
+#include <xkbcommon/xkbcommon-compose.h>
 #include <xkbcommon/xkbcommon.h>
 
-static bool            backspace_held = false;
-static bool            ctrl_held      = false;
-static struct timespec last_backspace_time;
+static bool ctrl_held = false;
 
-#define BACKSPACE_REPEAT_DELAY_MS 200 // Initial delay before repeating (in ms)
-#define BACKSPACE_REPEAT_RATE_MS  50  // Repeat rate while holding (in ms)
+// Until the compositor sends wl_keyboard.repeat_info, the usual desktop defaults
+#define KEY_REPEAT_DEFAULT_RATE  25  // repeats per second
+#define KEY_REPEAT_DEFAULT_DELAY 600 // ms
+
+/*
+ * @KEYMAP:
+ *
+ * The compositor sends its keymap as text as soon as we bind the keyboard,
+ * long before anyone types. Compiling it is the most expensive thing xkb
+ * does, so the first one is compiled on a startup worker with its own
+ * xkb_context while the main thread carries on locking the session:
+ *
+ *   wl_keyboard.keymap -> copy text -> worker: compile -> wake fd -> install + xkb_state
+ *   wl_keyboard.key / modifiers ------> input queue, held back ---------------^ applied in order
+ *
+ * A keymap whose text hashes the same as the one in use (compositors resend
+ * it on every enter) is not compiled again. Later changes, e.g. a layout
+ * switch, are compiled inline as before.
+ *
+ */
+
+/*
+ * @KEY REPEAT:
+ *
+ * Wayland leaves key repeat to the client. Whichever key was pressed last
+ * repeats, if the keymap says it does, through one timerfd that the event
+ * loop polls next to the Wayland fd:
+ *
+ *   press -> arm(delay, 1000 / rate) ... timer readable -> N expirations -> N repeats
+ *   release / leave / another press -> disarm or re-arm
+ *
+ * All expirations that piled up since the last poll are applied at once and
+ * only change the password; the event loop renders once after dispatching,
+ * so a burst of repeats is still a single frame.
+ *
+ */
+static void key_repeat_init(struct client_state* state)
+{
+  state->key_repeat.rate     = KEY_REPEAT_DEFAULT_RATE;
+  state->key_repeat.delay    = KEY_REPEAT_DEFAULT_DELAY;
+  state->key_repeat.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (state->key_repeat.timer_fd < 0)
+  {
+    log_message(LOG_LEVEL_WARN, "[REPEAT] timerfd_create failed, keys will not repeat: %s",
+                strerror(errno));
+  }
+}
+
+static void key_repeat_arm(struct client_state* state, int delay_ms, int interval_ms)
+{
+  struct itimerspec spec = {
+    .it_interval = {interval_ms / 1000, (long)(interval_ms % 1000) * 1000000},
+    .it_value    = {delay_ms / 1000, (long)(delay_ms % 1000) * 1000000},
+  };
+  if (state->key_repeat.timer_fd >= 0 &&
+      timerfd_settime(state->key_repeat.timer_fd, 0, &spec, NULL) < 0)
+  {
+    log_message(LOG_LEVEL_ERROR, "[REPEAT] timerfd_settime failed: %s", strerror(errno));
+  }
+}
+
+static void key_repeat_stop(struct client_state* state)
+{
+  if (state->key_repeat.keycode)
+  {
+    state->key_repeat.keycode = 0;
+    key_repeat_arm(state, 0, 0);
+  }
+}
+
+static void key_repeat_start(struct client_state* state, uint32_t keycode)
+{
+  struct key_repeat* repeat = &state->key_repeat;
+  if (repeat->rate <= 0 || !xkb_keymap_key_repeats(state->xkb_keymap, keycode))
+  {
+    key_repeat_stop(state);
+    return;
+  }
+
+  // A zero delay would disarm the timer, the first repeat comes after one interval then
+  int interval    = ANVIL_MAX(1000 / repeat->rate, 1);
+  repeat->keycode = keycode;
+  key_repeat_arm(state, repeat->delay > 0 ? repeat->delay : interval, interval);
+}
+
+static void key_repeat_release(struct client_state* state)
+{
+  if (state->key_repeat.timer_fd >= 0)
+  {
+    close(state->key_repeat.timer_fd);
+    state->key_repeat.timer_fd = -1;
+  }
+}
 
 static void wl_keyboard_leave(void* data, struct wl_keyboard* wl_keyboard, uint32_t serial,
                               struct wl_surface* surface)
 {
-  log_message(LOG_LEVEL_DEBUG, "keyboard leave");
+  // Queued too, a key pressed earlier in the same batch must not start repeating after it
+  struct input_event event = {.type = INPUT_EVENT_KEYBOARD_LEAVE, .keyboard.serial = serial};
+  input_queue_push(data, &event);
 }
 
 static void wl_keyboard_modifiers(void* data, struct wl_keyboard* wl_keyboard, uint32_t serial,
                                   uint32_t mods_depressed, uint32_t mods_latched,
                                   uint32_t mods_locked, uint32_t group)
 {
-  struct client_state* client_state = data;
-  xkb_state_update_mask(client_state->xkb_state, mods_depressed, mods_latched, mods_locked, 0, 0,
-                        group);
+  struct input_event event = {.type     = INPUT_EVENT_MODIFIERS,
+                              .keyboard = {.serial    = serial,
+                                           .depressed = mods_depressed,
+                                           .latched   = mods_latched,
+                                           .locked    = mods_locked,
+                                           .group     = group}};
+  input_queue_push(data, &event);
 }
 
 static void wl_keyboard_repeat_info(void* data, struct wl_keyboard* wl_keyboard, int32_t rate,
                                     int32_t delay)
 {
-  /* meh */
+  struct client_state* client_state = data;
+  client_state->key_repeat.rate     = rate;
+  client_state->key_repeat.delay    = delay;
+  log_message(LOG_LEVEL_DEBUG, "[REPEAT] %d repeats per second after %d ms", rate, delay);
+
+  // Takes effect with the next press
+  key_repeat_stop(client_state);
 }
 
 static void wl_keyboard_enter(void* data, struct wl_keyboard* wl_keyboard, uint32_t serial,
                               struct wl_surface* surface, struct wl_array* keys)
 {
   struct client_state* client_state = data;
+  key_repeat_stop(client_state);
+  if (!client_state->xkb_state)
+  {
+    return;
+  }
   log_message(LOG_LEVEL_DEBUG, "keyboard enter; keys pressed are:");
   uint32_t* key;
   wl_array_for_each(key, keys)
@@ -53,9 +166,11 @@ static void wl_keyboard_enter(void* data, struct wl_keyboard* wl_keyboard, uint3
   }
 }
 
-static long time_diff_ms(struct timespec* start, struct timespec* end)
+// Forget the whole password, nothing of it stays behind in the buffer
+static void password_clear(struct client_state* client_state)
 {
-  return (end->tv_sec - start->tv_sec) * 1000 + (end->tv_nsec - start->tv_nsec) / 1000000;
+  secure_wipe(client_state->pam.password, PAM_PASSWORD_SIZE);
+  client_state->pam.password_index = 0;
 }
 
 static void handle_backspace(struct client_state* client_state, bool ctrl_backspace)
@@ -63,42 +178,173 @@ static void handle_backspace(struct client_state* client_state, bool ctrl_backsp
   if (ctrl_backspace)
   {
     // Clear the entire password buffer
-    client_state->pam.password_index = 0;
+    password_clear(client_state);
   }
   else if (client_state->pam.password_index > 0)
   {
-    // Remove one character
-    client_state->pam.password_index--;
+    // Remove one character, however many bytes it took
+    int index                        = client_state->pam.password_index;
+    client_state->pam.password_index = index - utf8_last_size(client_state->pam.password);
+    secure_wipe(client_state->pam.password + client_state->pam.password_index,
+                index - client_state->pam.password_index);
   }
-  client_state->pam.password[client_state->pam.password_index] = '\0';
+}
 
-  // Render the updated lock screen here instead of using draw_lock_screen
-  render_lock_screen(client_state);
+/*
+ * @NOTE:
+ *
+ * Dead keys and Compose sequences go through xkb_compose. Parsing the
+ * locale's Compose file takes a while and most passwords never need it,
+ * so the table is only loaded when the first dead key or Compose key is
+ * pressed, never at startup. libxkbcommon cannot serialise a compiled
+ * table, so there is nothing to cache on disk either.
+ *
+ */
+static bool keysym_starts_compose(xkb_keysym_t sym)
+{
+  return sym == XKB_KEY_Multi_key ||
+         (sym >= XKB_KEY_dead_grave && sym <= XKB_KEY_dead_longsolidusoverlay);
 }
 
-static void handle_backspace_repeat(struct client_state* client_state)
+static const char* compose_locale(void)
 {
-  if (backspace_held)
+  const char* names[] = {"LC_ALL", "LC_CTYPE", "LANG"};
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
   {
-    struct timespec current_time;
-    clock_gettime(CLOCK_MONOTONIC, &current_time);
+    const char* locale = getenv(names[i]);
+    if (locale && *locale)
+    {
+      return locale;
+    }
+  }
+  return "C";
+}
 
-    long time_since_last_backspace = time_diff_ms(&last_backspace_time, &current_time);
+static void load_compose_table(struct client_state* client_state)
+{
+  client_state->xkb_compose_tried = true;
 
-    if (time_since_last_backspace >= BACKSPACE_REPEAT_RATE_MS)
+  uint64_t    start  = startup_now_ns();
+  const char* locale = compose_locale();
+  client_state->xkb_compose_table = xkb_compose_table_new_from_locale(
+    client_state->xkb_context, locale, XKB_COMPOSE_COMPILE_NO_FLAGS);
+  if (!client_state->xkb_compose_table)
+  {
+    log_message(LOG_LEVEL_WARN, "[COMPOSE] No compose table for '%s', dead keys type nothing",
+                locale);
+    return;
+  }
+
+  client_state->xkb_compose_state =
+    xkb_compose_state_new(client_state->xkb_compose_table, XKB_COMPOSE_STATE_NO_FLAGS);
+  log_message(LOG_LEVEL_DEBUG, "[COMPOSE] Loaded compose table for '%s' in %.2f ms", locale,
+              (startup_now_ns() - start) / 1e6);
+}
+
+// Append `size` bytes of UTF-8 to the password
+static void password_append(struct client_state* client_state, const char* text, int size)
+{
+  // Return, Tab, Escape and Ctrl+<key> type control characters, those are not part of a password
+  if (size <= 0 || (unsigned char)text[0] < 0x20 || text[0] == 0x7f)
+  {
+    return;
+  }
+
+  // A codepoint is never split, the buffer stays valid UTF-8
+  char* password = client_state->pam.password;
+  int   index    = client_state->pam.password_index;
+  if (index + size >= PAM_PASSWORD_SIZE)
+  {
+    return;
+  }
+  memcpy(password + index, text, size);
+  password[index + size]           = '\0';
+  client_state->pam.password_index = index + size;
+}
+
+// Type whatever `keycode` produces, after it went through any Compose sequence in progress
+static void handle_text_input(struct client_state* client_state, uint32_t keycode,
+                              xkb_keysym_t sym)
+{
+  if (!client_state->xkb_compose_tried && keysym_starts_compose(sym))
+  {
+    load_compose_table(client_state);
+  }
+
+  char                      text[16];
+  struct xkb_compose_state* compose = client_state->xkb_compose_state;
+  if (compose && xkb_compose_state_feed(compose, sym) == XKB_COMPOSE_FEED_ACCEPTED)
+  {
+    enum xkb_compose_status status = xkb_compose_state_get_status(compose);
+    if (status == XKB_COMPOSE_COMPOSING)
     {
-      handle_backspace(client_state, false);
-      last_backspace_time = current_time;
+      return; // wait for the rest of the sequence
+    }
+    if (status == XKB_COMPOSE_COMPOSED)
+    {
+      int size = xkb_compose_state_get_utf8(compose, text, sizeof(text));
+      xkb_compose_state_reset(compose);
+      if (size < (int)sizeof(text))
+      {
+        password_append(client_state, text, size);
+      }
+      return;
+    }
+    if (status == XKB_COMPOSE_CANCELLED)
+    {
+      xkb_compose_state_reset(compose); // the key that broke the sequence types nothing
+      return;
     }
   }
+
+  int size = xkb_state_key_get_utf8(client_state->xkb_state, keycode, text, sizeof(text));
+  if (size < (int)sizeof(text))
+  {
+    password_append(client_state, text, size);
+  }
+}
+
+// Return, or OK on the touch keypad
+static void password_submit(struct client_state* client_state)
+{
+  if (client_state->pam.password_index == 0)
+  {
+    return;
+  }
+  client_state->pam.password[client_state->pam.password_index] = '\0';
+
+  if (authenticate_user(client_state->pam.username, client_state->pam.password))
+  {
+    log_message(LOG_LEVEL_AUTH, "Authentication successful.");
+    client_state->pam.auth_state.auth_success = true;
+    password_clear(client_state);
+  }
+  else
+  {
+    log_message(LOG_LEVEL_AUTH, "Authentication failed. Try again.");
+    password_clear(client_state);
+
+    // The red border stays up for a moment, input keeps flowing meanwhile
+    ui_show_auth_failure(client_state);
+  }
+
+  client_state->pam.first_enter_press = false;
 }
 
 static void wl_keyboard_key(void* data, struct wl_keyboard* wl_keyboard, uint32_t serial,
                             uint32_t time, uint32_t key, uint32_t state)
 {
-  struct client_state* client_state = data;
-  uint32_t             keycode      = key + 8;
-  xkb_keysym_t         sym          = xkb_state_key_get_one_sym(client_state->xkb_state, keycode);
+  struct input_event event = {
+    .type     = INPUT_EVENT_KEY,
+    .keyboard = {.serial = serial, .time = time, .key = key, .state = state},
+  };
+  input_queue_push(data, &event);
+}
+
+static void keyboard_apply_key(struct client_state* client_state, uint32_t key, uint32_t state)
+{
+  uint32_t     keycode = key + 8;
+  xkb_keysym_t sym     = xkb_state_key_get_one_sym(client_state->xkb_state, keycode);
 
   if (state == WL_KEYBOARD_KEY_STATE_PRESSED)
   {
@@ -109,82 +355,237 @@ static void wl_keyboard_key(void* data, struct wl_keyboard* wl_keyboard, uint32_
     else if (sym == XKB_KEY_BackSpace)
     {
       handle_backspace(client_state, ctrl_held);
-      clock_gettime(CLOCK_MONOTONIC, &last_backspace_time);
-      backspace_held = true;
     }
-    else if (sym >= XKB_KEY_space && sym <= XKB_KEY_asciitilde &&
-             client_state->pam.password_index < sizeof(client_state->pam.password) - 1)
+    else
     {
-      client_state->pam.password[client_state->pam.password_index++] = (char)sym;
-      // Render the updated lock screen here instead of using draw_lock_screen
-      render_lock_screen(client_state);
+      handle_text_input(client_state, keycode, sym);
     }
+    key_repeat_start(client_state, keycode);
   }
   else if (state == WL_KEYBOARD_KEY_STATE_RELEASED)
   {
+    if (keycode == client_state->key_repeat.keycode)
+    {
+      key_repeat_stop(client_state);
+    }
+
     if (sym == XKB_KEY_Control_L || sym == XKB_KEY_Control_R)
     {
       ctrl_held = false;
     }
     else if (sym == XKB_KEY_BackSpace)
     {
-      backspace_held = false;
       if (ctrl_held)
       {
-        client_state->pam.password_index = 0;
+        password_clear(client_state);
       }
     }
     else if (sym == XKB_KEY_Return)
     {
-      if (client_state->pam.password_index > 0)
-      {
-        client_state->pam.password[client_state->pam.password_index] = '\0';
-
-        if (authenticate_user(client_state->pam.username, client_state->pam.password))
-        {
-          log_message(LOG_LEVEL_AUTH, "Authentication successful.");
-          client_state->pam.auth_state.auth_success = true;
-        }
-        else
-        {
-          log_message(LOG_LEVEL_AUTH, "Authentication failed. Try again.");
-          client_state->pam.password_index = 0;
-          client_state->pam.password[0]    = '\0';
-
-          // Render the updated lock screen here instead of using draw_lock_screen
-          client_state->pam.auth_state.auth_failed = true;
-          render_lock_screen(client_state);
-          client_state->pam.auth_state.auth_failed = false;
-        }
-
-        client_state->pam.first_enter_press = false;
-      }
+      password_submit(client_state);
     }
   }
+}
 
-  if (state == WL_KEYBOARD_KEY_STATE_PRESSED)
-    render_lock_screen(client_state);
+// One queued keyboard event, see input_queue.h; the event loop renders after the whole batch
+static void keyboard_apply_event(struct client_state* client_state, const struct input_event* event)
+{
+  const struct keyboard_event* keyboard = &event->keyboard;
+  if (event->type == INPUT_EVENT_KEYBOARD_LEAVE)
+  {
+    log_message(LOG_LEVEL_DEBUG, "keyboard leave");
+    key_repeat_stop(client_state); // the release of a held key goes elsewhere now
+    return;
+  }
+  if (!client_state->xkb_state)
+  {
+    return; // no usable keymap
+  }
+
+  if (event->type == INPUT_EVENT_MODIFIERS)
+  {
+    xkb_state_update_mask(client_state->xkb_state, keyboard->depressed, keyboard->latched,
+                          keyboard->locked, 0, 0, keyboard->group);
+  }
+  else if (event->type == INPUT_EVENT_KEY)
+  {
+    keyboard_apply_key(client_state, keyboard->key, keyboard->state);
+  }
+}
+
+// Startup task: runs on a worker, so it gets an xkb_context of its own
+static int startup_compile_keymap(struct client_state* state)
+{
+  struct keymap_loader* loader  = &state->keymap_loader;
+  struct xkb_context*   context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+  if (!context)
+  {
+    return -1;
+  }
+
+  loader->result = xkb_keymap_new_from_string(context, loader->string, XKB_KEYMAP_FORMAT_TEXT_V1,
+                                              XKB_KEYMAP_COMPILE_NO_FLAGS);
+  xkb_context_unref(context);
+  return loader->result ? 0 : -1;
+}
+
+static void keymap_install(struct client_state* client_state, struct xkb_keymap* xkb_keymap)
+{
+  struct xkb_state* xkb_state = xkb_keymap ? xkb_state_new(xkb_keymap) : NULL;
+  xkb_keymap_unref(client_state->xkb_keymap);
+  xkb_state_unref(client_state->xkb_state);
+  client_state->xkb_keymap = xkb_keymap;
+  client_state->xkb_state  = xkb_state;
+}
+
+// The worker could not compile the keymap: try it once more here, else fall back to the
+// RMLVO defaults so the password can still be typed
+static struct xkb_keymap* keymap_loader_fallback(struct client_state* client_state)
+{
+  struct keymap_loader* loader     = &client_state->keymap_loader;
+  struct xkb_keymap*    xkb_keymap = NULL;
+  if (loader->string)
+  {
+    xkb_keymap = xkb_keymap_new_from_string(client_state->xkb_context, loader->string,
+                                            XKB_KEYMAP_FORMAT_TEXT_V1,
+                                            XKB_KEYMAP_COMPILE_NO_FLAGS);
+  }
+  if (xkb_keymap)
+  {
+    log_message(LOG_LEVEL_WARN, "[KEYMAP] Worker failed, compiled the keymap on the event loop");
+    return xkb_keymap;
+  }
+
+  // Not the compositor's keymap, a resend of it has to be compiled again
+  loader->hash = 0;
+  xkb_keymap   = xkb_keymap_new_from_names(client_state->xkb_context, NULL,
+                                           XKB_KEYMAP_COMPILE_NO_FLAGS);
+  if (xkb_keymap)
+  {
+    log_message(LOG_LEVEL_ERROR,
+                "[KEYMAP] Failed to compile the compositor's keymap, using the default layout");
+  }
+  else
+  {
+    log_message(LOG_LEVEL_ERROR, "[KEYMAP] Failed to compile any keymap, keys are ignored");
+  }
+  return xkb_keymap;
+}
+
+// Install the keymap the worker compiled, the input queue lets keyboard events through again
+static void keymap_loader_adopt(struct client_state* client_state, int result)
+{
+  struct keymap_loader* loader = &client_state->keymap_loader;
+  loader->pending              = false;
+  if (result != 0)
+  {
+    keymap_install(client_state, keymap_loader_fallback(client_state));
+  }
+  else
+  {
+    keymap_install(client_state, loader->result);
+  }
+  loader->result = NULL;
+  ANVIL_SAFE_FREE(loader->string);
+}
+
+// Called from the event loop whenever a startup task finished
+static void keymap_loader_finish(struct client_state* client_state)
+{
+  int result;
+  if (client_state->keymap_loader.pending && startup_task_poll(STARTUP_TASK_KEYMAP, &result))
+  {
+    keymap_loader_adopt(client_state, result);
+  }
 }
 
 static void wl_keyboard_keymap(void* data, struct wl_keyboard* wl_keyboard, uint32_t format,
                                int32_t fd, uint32_t size)
 {
-  struct client_state* client_state = data;
+  struct client_state*  client_state = data;
+  struct keymap_loader* loader       = &client_state->keymap_loader;
   assert(format == WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1);
 
   char* map_shm = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
   assert(map_shm != MAP_FAILED);
+  close(fd);
+
+  // The text is NUL-terminated, `size` includes the terminator
+  uint64_t hash = anvil_hash64(map_shm, strnlen(map_shm, size));
+  if (hash == loader->hash && (loader->pending || client_state->xkb_keymap))
+  {
+    log_message(LOG_LEVEL_DEBUG, "[KEYMAP] Keymap unchanged, keeping the compiled one");
+    munmap(map_shm, size);
+    return;
+  }
+  loader->hash = hash;
 
+  // The first keymap is compiled off the event loop, once
+  if (!loader->pending && !client_state->xkb_keymap && !startup_tasks[STARTUP_TASK_KEYMAP].name)
+  {
+    loader->string = strndup(map_shm, size);
+    if (loader->string)
+    {
+      munmap(map_shm, size);
+      loader->pending = true;
+      startup_task_launch(STARTUP_TASK_KEYMAP, "keymap", startup_compile_keymap, client_state);
+      return;
+    }
+  }
+
+  // A newer keymap replaces whatever the worker is still compiling, and input that came
+  // before it is still read with the keymap it was typed on
+  if (loader->pending)
+  {
+    keymap_loader_adopt(client_state, startup_task_wait(STARTUP_TASK_KEYMAP));
+  }
+  input_queue_flush(client_state);
+
+  uint64_t           start      = startup_now_ns();
   struct xkb_keymap* xkb_keymap = xkb_keymap_new_from_string(
     client_state->xkb_context, map_shm, XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
   munmap(map_shm, size);
-  close(fd);
+  if (!xkb_keymap)
+  {
+    log_message(LOG_LEVEL_ERROR, "[KEYMAP] Failed to compile the compositor's keymap");
+    loader->hash = 0;
+    return;
+  }
+  log_message(LOG_LEVEL_DEBUG, "[KEYMAP] Compiled keymap in %.2f ms",
+              (startup_now_ns() - start) / 1e6);
+  keymap_install(client_state, xkb_keymap);
+}
 
-  struct xkb_state* xkb_state = xkb_state_new(xkb_keymap);
-  xkb_keymap_unref(client_state->xkb_keymap);
-  xkb_state_unref(client_state->xkb_state);
-  client_state->xkb_keymap = xkb_keymap;
-  client_state->xkb_state  = xkb_state;
+// The repeat timer expired, apply every repeat that is due; the event loop renders afterwards
+static void key_repeat_dispatch(struct client_state* client_state)
+{
+  uint64_t expirations;
+  if (read(client_state->key_repeat.timer_fd, &expirations, sizeof(expirations)) !=
+      sizeof(expirations))
+  {
+    return;
+  }
+
+  // The release of the key may be waiting in the queue
+  input_queue_flush(client_state);
+  if (!client_state->key_repeat.keycode || !client_state->xkb_state)
+  {
+    return;
+  }
+
+  uint32_t     keycode = client_state->key_repeat.keycode;
+  xkb_keysym_t sym     = xkb_state_key_get_one_sym(client_state->xkb_state, keycode);
+  for (uint64_t i = 0; i < expirations; i++)
+  {
+    if (sym == XKB_KEY_BackSpace)
+    {
+      handle_backspace(client_state, ctrl_held);
+    }
+    else
+    {
+      handle_text_input(client_state, keycode, sym);
+    }
+  }
 }
 
 static const struct wl_keyboard_listener wl_keyboard_listener = {
@@ -3,18 +3,36 @@
 
 #include "../client_state.h"
 #include "../log.h"
+#include "input_queue.h"
 #include <wayland-client.h>
 
+/*
+ * @POINTER:
+ *
+ * The pointer only matters over something that reacts to it, a show-password
+ * toggle or a power menu say. Those put a rectangle in state->pointer_regions
+ * and call pointer_update_subscription(); only while at least one region
+ * exists is the seat's wl_pointer bound at all. Nothing on the lock screen is
+ * clickable yet, so the compositor sends us nothing and mouse movement over
+ * the lock screen costs nothing.
+ *
+ *   enter/leave/motion/button ... frame -> input queue -> hit test -> hovered changed?
+ *                                                                         |
+ *                        next frame: damage the old and the new region <-'
+ *
+ * A hit test is a walk over at most POINTER_MAX_REGIONS rectangles. Motion
+ * that stays within the same region does nothing else; moving onto or off one
+ * damages just the two regions involved. A button pressed and released over
+ * the same region activates it.
+ *
+ */
+
 enum pointer_event_mask
 {
-  POINTER_EVENT_ENTER         = 1 << 0,
-  POINTER_EVENT_LEAVE         = 1 << 1,
-  POINTER_EVENT_MOTION        = 1 << 2,
-  POINTER_EVENT_BUTTON        = 1 << 3,
-  POINTER_EVENT_AXIS          = 1 << 4,
-  POINTER_EVENT_AXIS_SOURCE   = 1 << 5,
-  POINTER_EVENT_AXIS_STOP     = 1 << 6,
-  POINTER_EVENT_AXIS_DISCRETE = 1 << 7,
+  POINTER_EVENT_ENTER  = 1 << 0,
+  POINTER_EVENT_LEAVE  = 1 << 1,
+  POINTER_EVENT_MOTION = 1 << 2,
+  POINTER_EVENT_BUTTON = 1 << 3,
 };
 
 static void wl_pointer_enter(void* data, struct wl_pointer* wl_pointer, uint32_t serial,
@@ -23,7 +41,7 @@ static void wl_pointer_enter(void* data, struct wl_pointer* wl_pointer, uint32_t
   struct client_state* client_state = data;
   client_state->pointer_event.event_mask |= POINTER_EVENT_ENTER;
   client_state->pointer_event.serial    = serial;
-  client_state->pointer_event.surface_x = surface_x,
+  client_state->pointer_event.surface_x = surface_x;
   client_state->pointer_event.surface_y = surface_y;
 }
 
@@ -41,7 +59,7 @@ static void wl_pointer_motion(void* data, struct wl_pointer* wl_pointer, uint32_
   struct client_state* client_state = data;
   client_state->pointer_event.event_mask |= POINTER_EVENT_MOTION;
   client_state->pointer_event.time      = time;
-  client_state->pointer_event.surface_x = surface_x,
+  client_state->pointer_event.surface_x = surface_x;
   client_state->pointer_event.surface_y = surface_y;
 }
 
@@ -52,126 +70,151 @@ static void wl_pointer_button(void* data, struct wl_pointer* wl_pointer, uint32_
   client_state->pointer_event.event_mask |= POINTER_EVENT_BUTTON;
   client_state->pointer_event.time   = time;
   client_state->pointer_event.serial = serial;
-  client_state->pointer_event.button = button, client_state->pointer_event.state = state;
+  client_state->pointer_event.button = button;
+  client_state->pointer_event.state  = state;
 }
 
+// Nothing on the lock screen scrolls
 static void wl_pointer_axis(void* data, struct wl_pointer* wl_pointer, uint32_t time, uint32_t axis,
                             wl_fixed_t value)
 {
-  struct client_state* client_state = data;
-  client_state->pointer_event.event_mask |= POINTER_EVENT_AXIS;
-  client_state->pointer_event.time             = time;
-  client_state->pointer_event.axes[axis].valid = true;
-  client_state->pointer_event.axes[axis].value = value;
 }
 
 static void wl_pointer_axis_source(void* data, struct wl_pointer* wl_pointer, uint32_t axis_source)
 {
-  struct client_state* client_state = data;
-  client_state->pointer_event.event_mask |= POINTER_EVENT_AXIS_SOURCE;
-  client_state->pointer_event.axis_source = axis_source;
 }
 
 static void wl_pointer_axis_stop(void* data, struct wl_pointer* wl_pointer, uint32_t time,
                                  uint32_t axis)
 {
-  struct client_state* client_state = data;
-  client_state->pointer_event.time  = time;
-  client_state->pointer_event.event_mask |= POINTER_EVENT_AXIS_STOP;
-  client_state->pointer_event.axes[axis].valid = true;
 }
 
 static void wl_pointer_axis_discrete(void* data, struct wl_pointer* wl_pointer, uint32_t axis,
                                      int32_t discrete)
 {
-  struct client_state* client_state = data;
-  client_state->pointer_event.event_mask |= POINTER_EVENT_AXIS_DISCRETE;
-  client_state->pointer_event.axes[axis].valid    = true;
-  client_state->pointer_event.axes[axis].discrete = discrete;
 }
 
+// The events since the last frame belong together, they are queued as one
 static void wl_pointer_frame(void* data, struct wl_pointer* wl_pointer)
 {
-  struct client_state*  client_state = data;
-  struct pointer_event* event        = &client_state->pointer_event;
-  log_message(LOG_LEVEL_DEBUG, "pointer frame @ %d: ", event->time);
+  struct client_state* client_state = data;
+  if (client_state->pointer_event.event_mask)
+  {
+    struct input_event event = {.type    = INPUT_EVENT_POINTER_FRAME,
+                                .pointer = client_state->pointer_event};
+    input_queue_push(client_state, &event);
+  }
+  ANVIL_MEMZERO(&client_state->pointer_event, sizeof(client_state->pointer_event));
+}
 
-  if (event->event_mask & POINTER_EVENT_ENTER)
+static const struct wl_pointer_listener wl_pointer_listener = {
+  .enter         = wl_pointer_enter,
+  .leave         = wl_pointer_leave,
+  .motion        = wl_pointer_motion,
+  .button        = wl_pointer_button,
+  .axis          = wl_pointer_axis,
+  .frame         = wl_pointer_frame,
+  .axis_source   = wl_pointer_axis_source,
+  .axis_stop     = wl_pointer_axis_stop,
+  .axis_discrete = wl_pointer_axis_discrete,
+};
+
+static void pointer_set_hovered(struct client_state* state, const struct pointer_region* region)
+{
+  struct pointer_regions* regions = &state->pointer_regions;
+  regions->hovered                = region ? region->id : 0;
+  regions->hovered_rect           = region ? region->rect : (struct damage_rect){0};
+}
+
+// Bind the seat's pointer while something can use it, let go of it otherwise
+static void pointer_update_subscription(struct client_state* state)
+{
+  struct pointer_regions* regions = &state->pointer_regions;
+  bool                    wanted  = regions->seat_pointer && regions->count > 0;
+  if (wanted && state->wl_pointer == NULL)
+  {
+    state->wl_pointer = wl_seat_get_pointer(state->wl_seat);
+    wl_pointer_add_listener(state->wl_pointer, &wl_pointer_listener, state);
+    log_message(LOG_LEVEL_DEBUG, "[POINTER] Listening to the pointer, %d regions", regions->count);
+  }
+  else if (!wanted && state->wl_pointer != NULL)
   {
-    log_message(LOG_LEVEL_DEBUG, "entered %f, %f", wl_fixed_to_double(event->surface_x),
-                wl_fixed_to_double(event->surface_y));
+    wl_pointer_release(state->wl_pointer);
+    state->wl_pointer = NULL;
+    pointer_set_hovered(state, NULL);
+    regions->pressed = 0;
+    log_message(LOG_LEVEL_DEBUG, "[POINTER] Pointer released, nothing uses it");
   }
+}
 
-  if (event->event_mask & POINTER_EVENT_LEAVE)
+static const struct pointer_region* pointer_hit_test(const struct client_state* state, int x,
+                                                     int y)
+{
+  const struct pointer_regions* regions = &state->pointer_regions;
+  for (int i = 0; i < regions->count; i++)
   {
-    log_message(LOG_LEVEL_DEBUG, "pointer on leave");
+    const struct damage_rect* rect = &regions->regions[i].rect;
+    if (x >= rect->x0 && x < rect->x1 && y >= rect->y0 && y < rect->y1)
+    {
+      return &regions->regions[i];
+    }
   }
+  return NULL;
+}
 
-  if (event->event_mask & POINTER_EVENT_MOTION)
+static struct pointer_region* pointer_region_find(struct client_state* state, int id)
+{
+  for (int i = 0; i < state->pointer_regions.count; i++)
   {
-    log_message(LOG_LEVEL_DEBUG, "motion %f, %f", wl_fixed_to_double(event->surface_x),
-                wl_fixed_to_double(event->surface_y));
+    if (state->pointer_regions.regions[i].id == id)
+    {
+      return &state->pointer_regions.regions[i];
+    }
   }
+  return NULL;
+}
 
-  if (event->event_mask & POINTER_EVENT_BUTTON)
+// One queued pointer frame, see input_queue.h
+static void pointer_apply_frame(struct client_state* client_state,
+                                const struct pointer_event* event)
+{
+  struct pointer_regions*      regions = &client_state->pointer_regions;
+  const struct pointer_region* hit     = NULL;
+  if (!(event->event_mask & POINTER_EVENT_LEAVE) || (event->event_mask & POINTER_EVENT_ENTER))
   {
-    char* state = event->state == WL_POINTER_BUTTON_STATE_RELEASED ? "released" : "pressed";
-    log_message(LOG_LEVEL_DEBUG, "[DEBUG] button %d %s", event->button, state);
+    hit = pointer_hit_test(client_state, wl_fixed_to_int(event->surface_x),
+                           wl_fixed_to_int(event->surface_y));
   }
 
-  uint32_t axis_events = POINTER_EVENT_AXIS | POINTER_EVENT_AXIS_SOURCE | POINTER_EVENT_AXIS_STOP |
-                         POINTER_EVENT_AXIS_DISCRETE;
-  char* axis_name[2] = {
-    [WL_POINTER_AXIS_VERTICAL_SCROLL]   = "vertical",
-    [WL_POINTER_AXIS_HORIZONTAL_SCROLL] = "horizontal",
-  };
-  char* axis_source[4] = {
-    [WL_POINTER_AXIS_SOURCE_WHEEL]      = "wheel",
-    [WL_POINTER_AXIS_SOURCE_FINGER]     = "finger",
-    [WL_POINTER_AXIS_SOURCE_CONTINUOUS] = "continuous",
-    [WL_POINTER_AXIS_SOURCE_WHEEL_TILT] = "wheel tilt",
-  };
-  if (event->event_mask & axis_events)
+  // A frame with only a button in it happened where the pointer already was
+  if (event->event_mask & (POINTER_EVENT_ENTER | POINTER_EVENT_LEAVE | POINTER_EVENT_MOTION))
   {
-    for (size_t i = 0; i < 2; ++i)
+    if ((hit ? hit->id : 0) != regions->hovered)
     {
-      if (!event->axes[i].valid)
-      {
-        continue;
-      }
-      log_message(LOG_LEVEL_DEBUG, "%s axis", axis_name[i]);
-      if (event->event_mask & POINTER_EVENT_AXIS)
-      {
-        log_message(LOG_LEVEL_DEBUG, "value %f ", wl_fixed_to_double(event->axes[i].value));
-      }
-      if (event->event_mask & POINTER_EVENT_AXIS_DISCRETE)
-      {
-        log_message(LOG_LEVEL_DEBUG, "discrete %d ", event->axes[i].discrete);
-      }
-      if (event->event_mask & POINTER_EVENT_AXIS_SOURCE)
-      {
-        log_message(LOG_LEVEL_DEBUG, "via %s ", axis_source[event->axis_source]);
-      }
-      if (event->event_mask & POINTER_EVENT_AXIS_STOP)
+      pointer_set_hovered(client_state, hit);
+    }
+  }
+
+  if (event->event_mask & POINTER_EVENT_BUTTON)
+  {
+    if (event->state == WL_POINTER_BUTTON_STATE_PRESSED)
+    {
+      regions->pressed = regions->hovered;
+    }
+    else if (regions->pressed && regions->pressed == regions->hovered)
+    {
+      struct pointer_region* region = pointer_region_find(client_state, regions->pressed);
+      regions->pressed              = 0;
+      if (region && region->activate)
       {
-        log_message(LOG_LEVEL_INFO, "pointer axis event: (stopped) ");
+        region->activate(client_state, region->id);
       }
     }
+    else
+    {
+      regions->pressed = 0;
+    }
   }
-
-  ANVIL_MEMZERO(event, sizeof(*event));
 }
 
-static const struct wl_pointer_listener wl_pointer_listener = {
-  .enter         = wl_pointer_enter,
-  .leave         = wl_pointer_leave,
-  .motion        = wl_pointer_motion,
-  .button        = wl_pointer_button,
-  .axis          = wl_pointer_axis,
-  .frame         = wl_pointer_frame,
-  .axis_source   = wl_pointer_axis_source,
-  .axis_stop     = wl_pointer_axis_stop,
-  .axis_discrete = wl_pointer_axis_discrete,
-};
-
 #endif
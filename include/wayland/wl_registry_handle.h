@@ -3,7 +3,9 @@
 
 #include "../../protocols/ext-session-lock-client-protocol.h"
 #include "../../protocols/src/ext-session-lock-client-protocol.c"
+#include "../global_funcs.h"
 #include "../log.h"
+#include "screencopy_handle.h"
 #include "wl_output_handle.h"
 #include "wl_seat_handle.h"
 #include "xdg_wm_base_handle.h"
@@ -45,6 +47,13 @@ static void registry_global(void* data, struct wl_registry* wl_registry, uint32_
       wl_registry_bind(wl_registry, name, &ext_session_lock_manager_v1_interface, 1);
     log_message(LOG_LEVEL_INFO, "ext_session_lock_manager interface bound.");
   }
+  else if (strcmp(interface, zwlr_screencopy_manager_v1_interface.name) == 0)
+  {
+    state->screencopy_manager = wl_registry_bind(wl_registry, name,
+                                                 &zwlr_screencopy_manager_v1_interface,
+                                                 ANVIL_MIN(version, 3));
+    log_message(LOG_LEVEL_INFO, "Screencopy manager interface bound.");
+  }
   else if (strcmp(interface, wl_output_interface.name) == 0)
   {
     state->output_state.wl_output =
@@ -1,25 +1,17 @@
 #ifndef WL_SEAT_HANDLER_H
 #define WL_SEAT_HANDLER_H
 
+#include "wl_touch_handle.h"
 #include <wayland-client.h>
 
 static void wl_seat_capabilities(void* data, struct wl_seat* wl_seat, uint32_t capabilities)
 {
   struct client_state* state = data;
-  /* TODO */
 
-  bool have_pointer = capabilities & WL_SEAT_CAPABILITY_POINTER;
-
-  if (have_pointer && state->wl_pointer == NULL)
-  {
-    state->wl_pointer = wl_seat_get_pointer(state->wl_seat);
-    wl_pointer_add_listener(state->wl_pointer, &wl_pointer_listener, state);
-  }
-  else if (!have_pointer && state->wl_pointer != NULL)
-  {
-    wl_pointer_release(state->wl_pointer);
-    state->wl_pointer = NULL;
-  }
+  // Only bound while a pointer region exists, see wl_pointer_handle.h
+  state->pointer_regions.seat_pointer = capabilities & WL_SEAT_CAPABILITY_POINTER;
+  pointer_update_subscription(state);
+  touch_update_capability(state, capabilities & WL_SEAT_CAPABILITY_TOUCH);
 
   bool have_keyboard = capabilities & WL_SEAT_CAPABILITY_KEYBOARD;
 
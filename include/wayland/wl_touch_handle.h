@@ -0,0 +1,216 @@
+#ifndef WL_TOUCH_HANDLER_H
+#define WL_TOUCH_HANDLER_H
+
+#include "../client_state.h"
+#include "../graphics/keypad.h"
+#include "../log.h"
+#include "input_queue.h"
+#include "wl_keyboard_handle.h"
+#include <wayland-client.h>
+
+/*
+ * @TOUCH:
+ *
+ * A touchscreen reports every finger separately and then closes the group
+ * with wl_touch.frame. Down, motion and up only update the pending frame;
+ * the frame is queued as one input event, so a finger dragging across the
+ * keypad costs one hit test and at most one redraw per compositor frame,
+ * however many motion events it came with:
+ *
+ *   down/motion/up ... frame -> input queue -> hit test the keypad -> pressed key changed?
+ *                                                                          |
+ *                                    next frame: damage the old and new key <-'
+ *
+ * Only the first finger down on the keypad counts. Lifting it over the key
+ * it is on types that key; sliding off first, or a wl_touch.cancel (the
+ * compositor recognised a gesture), types nothing.
+ *
+ */
+
+// The pending point for `id`, a new one if it has none yet. NULL if the frame is full.
+static struct touch_point* touch_pending_point(struct client_state* state, int32_t id)
+{
+  struct touch_event* pending = &state->touch.pending;
+  for (int i = 0; i < pending->count; i++)
+  {
+    if (pending->points[i].id == id)
+    {
+      return &pending->points[i];
+    }
+  }
+  if (pending->count == TOUCH_MAX_POINTS)
+  {
+    return NULL;
+  }
+  struct touch_point* point = &pending->points[pending->count++];
+  point->id                 = id;
+  point->flags              = 0;
+  return point;
+}
+
+static void wl_touch_down(void* data, struct wl_touch* wl_touch, uint32_t serial, uint32_t time,
+                          struct wl_surface* surface, int32_t id, wl_fixed_t x, wl_fixed_t y)
+{
+  struct touch_point* point = touch_pending_point(data, id);
+  if (point)
+  {
+    point->flags |= TOUCH_POINT_DOWN;
+    point->x      = x;
+    point->y      = y;
+  }
+}
+
+static void wl_touch_up(void* data, struct wl_touch* wl_touch, uint32_t serial, uint32_t time,
+                        int32_t id)
+{
+  struct touch_point* point = touch_pending_point(data, id);
+  if (point)
+  {
+    point->flags |= TOUCH_POINT_UP;
+  }
+}
+
+static void wl_touch_motion(void* data, struct wl_touch* wl_touch, uint32_t time, int32_t id,
+                            wl_fixed_t x, wl_fixed_t y)
+{
+  // Only the last position before the frame matters
+  struct touch_point* point = touch_pending_point(data, id);
+  if (point)
+  {
+    point->flags |= TOUCH_POINT_MOTION;
+    point->x      = x;
+    point->y      = y;
+  }
+}
+
+static void wl_touch_frame(void* data, struct wl_touch* wl_touch)
+{
+  struct client_state* client_state = data;
+  if (client_state->touch.pending.count > 0)
+  {
+    struct input_event event = {.type  = INPUT_EVENT_TOUCH_FRAME,
+                                .touch = client_state->touch.pending};
+    input_queue_push(client_state, &event);
+  }
+  client_state->touch.pending.count = 0;
+}
+
+static void wl_touch_cancel(void* data, struct wl_touch* wl_touch)
+{
+  struct client_state* client_state = data;
+  struct input_event   event        = {.type = INPUT_EVENT_TOUCH_FRAME, .touch = {.cancel = true}};
+  input_queue_push(client_state, &event);
+  client_state->touch.pending.count = 0;
+}
+
+// Contact shape and orientation do not matter for tapping keys
+static void wl_touch_shape(void* data, struct wl_touch* wl_touch, int32_t id, wl_fixed_t major,
+                           wl_fixed_t minor)
+{
+}
+
+static void wl_touch_orientation(void* data, struct wl_touch* wl_touch, int32_t id,
+                                 wl_fixed_t orientation)
+{
+}
+
+static const struct wl_touch_listener wl_touch_listener = {
+  .down        = wl_touch_down,
+  .up          = wl_touch_up,
+  .motion      = wl_touch_motion,
+  .frame       = wl_touch_frame,
+  .cancel      = wl_touch_cancel,
+  .shape       = wl_touch_shape,
+  .orientation = wl_touch_orientation,
+};
+
+static void keypad_activate(struct client_state* state, const struct keypad_key* key)
+{
+  if (key->input == KEYPAD_BACKSPACE)
+  {
+    handle_backspace(state, false);
+  }
+  else if (key->input == KEYPAD_ENTER)
+  {
+    password_submit(state);
+  }
+  else
+  {
+    password_append(state, &key->input, 1);
+  }
+}
+
+// One queued touch frame, see input_queue.h
+static void touch_apply_frame(struct client_state* client_state, const struct touch_event* event)
+{
+  struct touch_state* touch = &client_state->touch;
+  keypad_layout_update(&touch->layout, client_state->output_state.width,
+                       client_state->output_state.height);
+  if (event->cancel)
+  {
+    touch->tracking = false;
+    touch->pressed  = 0;
+    return;
+  }
+
+  for (int i = 0; i < event->count; i++)
+  {
+    const struct touch_point* point = &event->points[i];
+    int                       hit   = keypad_hit_test(&touch->layout, wl_fixed_to_int(point->x),
+                                                      wl_fixed_to_int(point->y));
+    if (!touch->tracking)
+    {
+      if ((point->flags & TOUCH_POINT_DOWN) && hit)
+      {
+        touch->tracking    = true;
+        touch->tracking_id = point->id;
+        touch->pressed     = hit;
+      }
+      else
+      {
+        continue;
+      }
+    }
+    else if (point->id != touch->tracking_id)
+    {
+      continue; // a second finger
+    }
+    else if (point->flags & TOUCH_POINT_MOTION)
+    {
+      touch->pressed = hit;
+    }
+
+    if (point->flags & TOUCH_POINT_UP)
+    {
+      int pressed     = touch->pressed;
+      touch->tracking = false;
+      touch->pressed  = 0;
+      if (pressed)
+      {
+        keypad_activate(client_state, &touch->layout.keys[pressed - 1]);
+      }
+    }
+  }
+}
+
+// Bind the seat's touchscreen while it has one, the keypad is shown meanwhile
+static void touch_update_capability(struct client_state* state, bool have_touch)
+{
+  state->touch.seat_touch = have_touch;
+  if (have_touch && state->wl_touch == NULL)
+  {
+    state->wl_touch = wl_seat_get_touch(state->wl_seat);
+    wl_touch_add_listener(state->wl_touch, &wl_touch_listener, state);
+    log_message(LOG_LEVEL_DEBUG, "[TOUCH] Seat has a touchscreen, showing the keypad");
+  }
+  else if (!have_touch && state->wl_touch != NULL)
+  {
+    wl_touch_release(state->wl_touch);
+    state->wl_touch            = NULL;
+    state->touch.pending.count = 0;
+    state->touch.tracking      = false;
+    state->touch.pressed       = 0;
+  }
+}
+
+#endif
@@ -17,8 +17,13 @@ static void xdg_surface_configure(void* data, struct xdg_surface* xdg_surface, u
   struct client_state* state = data;
   xdg_surface_ack_configure(xdg_surface, serial);
 
+  // The render thread owns the context, it only needs to hear about the new state
+  if (state->render.running)
+  {
+    render_lock_screen(state);
+  }
   // Ensure EGL and Wayland surface setup is ready before binding the context
-  if (state->egl_display && state->egl_surface && state->egl_context)
+  else if (state->egl_display && state->egl_surface && state->egl_context)
   {
     // Check if the current EGL context and surface match the ones we're trying to use
     if (eglGetCurrentContext() != state->egl_context ||
@@ -32,17 +37,10 @@ static void xdg_surface_configure(void* data, struct xdg_surface* xdg_surface, u
       }
     }
 
-    // Render the lock screen (if not done in another function) and commit
-    render_lock_screen(state); // Assuming render_lock_screen calls eglSwapBuffers
+    // The frame's eglSwapBuffers commits the surface, nothing else may attach or commit here
+    render_lock_screen(state);
 
     state->session_lock.surface_dirty = true;
-
-    // Surface commit to ensure Wayland knows of the new state
-    wl_surface_commit(state->wl_surface);
-    if (!eglSwapBuffers(state->egl_display, state->egl_surface))
-    {
-      log_message(LOG_LEVEL_ERROR, "Failed to swap EGL buffers");
-    }
   }
   else
   {
@@ -0,0 +1,20 @@
+#ifdef GL_FRAGMENT_PRECISION_HIGH
+precision highp float;
+#else
+precision mediump float;
+#endif
+varying vec2 vTexCoord;
+uniform sampler2D uTexture;
+uniform vec2 uHalfPixel;
+uniform float uSwapRB;
+
+// Dual Kawase downsample: centre plus the four diagonal corners
+void main() {
+    vec3 sum = texture2D(uTexture, vTexCoord).rgb * 4.0;
+    sum += texture2D(uTexture, vTexCoord - uHalfPixel).rgb;
+    sum += texture2D(uTexture, vTexCoord + uHalfPixel).rgb;
+    sum += texture2D(uTexture, vTexCoord + vec2(uHalfPixel.x, -uHalfPixel.y)).rgb;
+    sum += texture2D(uTexture, vTexCoord - vec2(uHalfPixel.x, -uHalfPixel.y)).rgb;
+    sum /= 8.0;
+    gl_FragColor = vec4(mix(sum, sum.bgr, uSwapRB), 1.0);
+}
@@ -0,0 +1,34 @@
+#ifdef GL_FRAGMENT_PRECISION_HIGH
+precision highp float;
+#else
+precision mediump float;
+#endif
+varying vec2 vTexCoord;
+uniform sampler2D uTexture;
+uniform vec2 uHalfPixel;
+uniform float uSwapRB;
+uniform vec2 uAspect;
+uniform float uDim;
+uniform float uVignette;
+uniform float uDesaturate;
+
+// Dual Kawase upsample: a ring of eight taps, the diagonals weighted double
+void main() {
+    vec2 hp = uHalfPixel;
+    vec3 sum = texture2D(uTexture, vTexCoord + vec2(-hp.x * 2.0, 0.0)).rgb;
+    sum += texture2D(uTexture, vTexCoord + vec2(-hp.x, hp.y)).rgb * 2.0;
+    sum += texture2D(uTexture, vTexCoord + vec2(0.0, hp.y * 2.0)).rgb;
+    sum += texture2D(uTexture, vTexCoord + vec2(hp.x, hp.y)).rgb * 2.0;
+    sum += texture2D(uTexture, vTexCoord + vec2(hp.x * 2.0, 0.0)).rgb;
+    sum += texture2D(uTexture, vTexCoord + vec2(hp.x, -hp.y)).rgb * 2.0;
+    sum += texture2D(uTexture, vTexCoord + vec2(0.0, -hp.y * 2.0)).rgb;
+    sum += texture2D(uTexture, vTexCoord + vec2(-hp.x, -hp.y)).rgb * 2.0;
+    vec3 color = mix(sum, sum.bgr, uSwapRB) / 12.0;
+
+    // Same [bg] effects as image_apply_effects(), only non-zero on the last pass
+    float luma = dot(color, vec3(0.2126, 0.7152, 0.0722));
+    color = mix(color, vec3(luma), uDesaturate);
+    float dist = length((vTexCoord - 0.5) * 2.0 * uAspect);
+    float scale = (1.0 - uDim) * (1.0 - uVignette * smoothstep(0.4, 1.0, dist));
+    gl_FragColor = vec4(color * scale, 1.0);
+}
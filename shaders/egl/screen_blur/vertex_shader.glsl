@@ -0,0 +1,9 @@
+attribute vec2 position;
+uniform float uFlipY;
+varying vec2 vTexCoord;
+void main() {
+    // Texture rows map to framebuffer rows 1:1, so passes never flip the image
+    vec2 uv = position * 0.5 + 0.5;
+    vTexCoord = vec2(uv.x, mix(uv.y, 1.0 - uv.y, uFlipY));
+    gl_Position = vec4(position, 0.0, 1.0);
+}
@@ -93,71 +93,72 @@
 
 int main(int argc, char* argv[])
 {
-  struct client_state state = {0};
+  // 0 is a valid fd (stdin), the ones not open yet are -1
+  struct client_state state = {.key_repeat.timer_fd = -1};
 
   // Initialize logging
   state.pam.username = getlogin();
   log_message(LOG_LEVEL_TRACE, "Session found for user @ [%s]", state.pam.username);
 
-  // Initialize Wayland
-  if (initialize_wayland(&state) != 0)
+  // The password only ever lives in the locked arena, set up before any key can arrive
+  state.pam.password = pam_secure_init();
+  if (!state.pam.password)
   {
-    cleanup(&state);
+    log_message(LOG_LEVEL_ERROR, "Failed to set up secure memory for the password.");
     return 1;
   }
 
-  // Initialize XKB for keyboard input
-  if (initialize_xkb(&state) != 0)
-  {
-    cleanup(&state);
-    return 1;
-  }
+  // Config parsing, font loading and wallpaper decoding run on workers from here on
+  launch_startup_tasks(&state);
 
-  // Initialize FreeType for font rendering
-  if (initialize_freetype(&state) != 0)
+  // Initialize Wayland
+  int stage = startup_stage_begin("wayland", false);
+  if (initialize_wayland(&state) != 0)
   {
     cleanup(&state);
     return 1;
   }
+  startup_stage_end(stage);
 
-  if (initialize_configs(&state) != 0)
+  // Initialize XKB for keyboard input
+  stage = startup_stage_begin("xkb", false);
+  if (initialize_xkb(&state) != 0)
   {
     cleanup(&state);
     return 1;
   }
+  startup_stage_end(stage);
 
-  init_debug(&state);
-
-  // Set the home directory
-  state.homeDir = ANVIL_GET_HOME_DIR();
-  log_message(LOG_LEVEL_TRACE, "Found @HOME at: %s", state.homeDir);
+  // Commit the surface to make it visible
+  wl_surface_commit(state.wl_surface);
 
-  state.shaderRuntimeDir = find_shader_runtime(state.homeDir);
+  // A screenshot background has to be taken before the lock hides the desktop
+  capture_screen_background(&state);
 
-  log_message(LOG_LEVEL_INFO, "[SHADERS] Setting shader runtime directory to: '%s'",
-              state.shaderRuntimeDir);
+  // Lock right away, the lock surface shows a solid placeholder until EGL is up
+  stage = startup_stage_begin("lock", false);
+  initiate_session_lock(&state);
+  startup_stage_end(stage);
 
-  if (!state.shaderRuntimeDir)
+  // The session is locked from here on. Whatever fails now leaves a plainer lock screen,
+  // at worst the placeholder, but never an unlocked session; the password still works.
+  if (initialize_configs(&state) != 0)
   {
-    log_message(LOG_LEVEL_ERROR, "[SHADERS] Could not find shaders runtime. Exiting with code 1.");
-    cleanup(&state);
-    return 1;
+    log_message(LOG_LEVEL_ERROR, "[LOCK] No usable config, staying on the placeholder.");
+  }
+  else
+  {
+    init_debug(&state);
+    if (!initialize_renderer(&state))
+    {
+      log_message(LOG_LEVEL_ERROR, "[LOCK] No renderer, staying on the placeholder.");
+    }
   }
-
-  initialize_shaders(state.shaderRuntimeDir);
-
-  // Commit the surface to make it visible
-  wl_surface_commit(state.wl_surface);
 
   // Event loop to handle input and manage session state
   state.pam.auth_state.auth_success = false;
-  while (!state.pam.auth_state.auth_success && wl_display_dispatch(state.wl_display) != -1)
+  while (!state.pam.auth_state.auth_success && dispatch_events(&state) != -1)
   {
-    state.pam.auth_state.auth_failed = false;
-    if (!state.session_lock.surface_created)
-    {
-      initiate_session_lock(&state);
-    }
     render_lock_screen(&state);
   }
 
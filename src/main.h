@@ -1,16 +1,25 @@
 #pragma once
 
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
 
 #include "../include/client_state.h"
 #include "../include/config/config.h"
 #include "../include/freetype/freetype.h"
+#include "../include/freetype/text_layout.h"
+#include "../include/graphics/render_thread.h"
 #include "../include/graphics/shaders.h"
+#include "../include/graphics/soft_render.h"
+#include "../include/graphics/wallpaper.h"
 #include "../include/log.h"
 #include "../include/pam/pam.h"
+#include "../include/startup/startup.h"
+#include "../include/wayland/screencopy_handle.h"
 #include "../include/wayland/session_lock_handle.h"
 #include "../include/wayland/wl_registry_handle.h"
 #include "../include/wayland/xdg_surface_handle.h"
+#include <errno.h>
+#include <poll.h>
 
 static int initialize_wayland(struct client_state* state)
 {
@@ -44,44 +53,261 @@ static int initialize_xkb(struct client_state* state)
     return -1;
   }
 
-  state->xkb_keymap =
-    xkb_keymap_new_from_names(state->xkb_context, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
-  if (!state->xkb_keymap)
+  // No default keymap: the compositor sends the one in use before any key, and compiling one
+  // here only to throw it away costs as much as compiling the real one
+  key_repeat_init(state);
+  return 0;
+}
+
+/*
+ * Startup tasks, these run on worker threads (see startup.h).
+ *
+ * They must not touch Wayland or EGL, and must only hand results to the
+ * main thread through client_state / the config and FreeType globals.
+ */
+static int startup_load_config(struct client_state* state)
+{
+  if (load_config() != CONFIG_LOAD_SUCCESS)
+  {
+    log_message(LOG_LEVEL_ERROR, "Failed to load config file");
+    return -1;
+  }
+  return 0;
+}
+
+static int startup_load_font(struct client_state* state)
+{
+  if (startup_task_wait(STARTUP_TASK_CONFIG) != 0)
   {
-    log_message(LOG_LEVEL_ERROR, "Failed to create XKB keymap\n");
     return -1;
   }
 
-  state->xkb_state = xkb_state_new(state->xkb_keymap);
-  if (!state->xkb_state)
+  if (!init_freetype(get_config()->font_path))
   {
-    log_message(LOG_LEVEL_ERROR, "Failed to create XKB state\n");
+    log_message(LOG_LEVEL_ERROR, "Initializing FreeType2 was unsuccessful.");
     return -1;
   }
 
+  // Every glyph the clock and the keypad will ever show, at every subpixel offset, so no frame
+  // rasterises
+  if (!text_atlas_init(&glyph_atlas))
+  {
+    return -1;
+  }
+  text_atlas_warm(&glyph_atlas, CLOCK_CHARS);
+  text_atlas_warm(&glyph_atlas, KEYPAD_LABEL_CHARS);
+  text_atlas_swatch(&glyph_atlas, KEYPAD_KEY_ALPHA);
+  text_atlas_swatch(&glyph_atlas, KEYPAD_PRESSED_ALPHA);
   return 0;
 }
 
-static int initialize_freetype(struct client_state* state)
+// In screenshot mode the wallpaper is only needed if the captured desktop did not make it
+static bool startup_wallpaper_needed(void)
+{
+  return get_config()->bg_mode != BG_MODE_SCREENSHOT ||
+         startup_task_wait(STARTUP_TASK_SCREENSHOT) != 0;
+}
+
+static int startup_load_thumbnail(struct client_state* state)
 {
-  int ft = init_freetype();
-  if (ft != 0)
+  if (startup_task_wait(STARTUP_TASK_CONFIG) != 0 || !startup_wallpaper_needed())
+  {
+    return -1;
+  }
+
+  const char* background_path = get_config()->bg_path;
+  if (!background_path || !wallpaper_load_thumbnail(background_path, &get_config()->bg_effects,
+                                                      &state->thumbnail))
   {
-    return 0;
+    return -1;
   }
-  log_message(LOG_LEVEL_ERROR, "Initializing FreeType2 was unsuccessful.");
-  return -1;
+  return 0;
 }
 
-static int initialize_configs(struct client_state* state)
+static int startup_decode_wallpaper(struct client_state* state)
+{
+  if (startup_task_wait(STARTUP_TASK_CONFIG) != 0 || !startup_wallpaper_needed())
+  {
+    return -1;
+  }
+
+  const char* background_path = get_config()->bg_path;
+  if (!background_path)
+  {
+    return -1;
+  }
+
+  // A cached ETC2 copy needs no decode at all, as long as GL can sample it
+  const struct bg_effects* fx = &get_config()->bg_effects;
+  if (wallpaper_load_etc(background_path, fx, &state->wallpaper_etc))
+  {
+    if (startup_task_wait(STARTUP_TASK_GL_CAPS) == 0)
+    {
+      return 0;
+    }
+    ANVIL_SAFE_FREE(state->wallpaper_etc.data);
+  }
+
+  if (!decode_image(background_path, &state->wallpaper))
+  {
+    return -1;
+  }
+
+  log_message(LOG_LEVEL_TRACE, "Decoded wallpaper %s (%dx%d)", background_path,
+              state->wallpaper.width, state->wallpaper.height);
+
+  wallpaper_apply_effects(&state->wallpaper, fx);
+  image_build_mips(&state->wallpaper, &state->wallpaper_mips);
+  return 0;
+}
+
+// Runs after a full decode, off the critical path: the wallpaper is already on screen
+static int startup_build_bg_cache(struct client_state* state)
+{
+  if (startup_task_wait(STARTUP_TASK_WALLPAPER) != 0 || !state->wallpaper.pixels)
+  {
+    return 0; // nothing decoded, so nothing missing
+  }
+
+  const char*              background_path = get_config()->bg_path;
+  const struct bg_effects* fx              = &get_config()->bg_effects;
+  if (startup_task_wait(STARTUP_TASK_THUMBNAIL) != 0)
+  {
+    wallpaper_store_thumbnail(background_path, fx, &state->wallpaper);
+  }
+  if (startup_task_wait(STARTUP_TASK_GL_CAPS) == 0)
+  {
+    wallpaper_store_etc(background_path, fx, &state->wallpaper, &state->wallpaper_mips);
+  }
+  return 0;
+}
+
+// Load the PAM stack now, so Enter only has to check the password (see pam.h)
+static int startup_warm_pam(struct client_state* state)
+{
+  if (startup_task_wait(STARTUP_TASK_CONFIG) != 0)
+  {
+    return -1;
+  }
+  return pam_session_start(get_config()->pam_service, state->pam.username) ? 0 : -1;
+}
+
+static void launch_startup_tasks(struct client_state* state)
+{
+  startup_begin();
+
+  // Workers may wait on a gate as soon as they start, so every gate exists before the first one
+  startup_gate_declare(STARTUP_TASK_GL_CAPS, "gl-caps");
+  startup_gate_declare(STARTUP_TASK_SCREENSHOT, "screenshot");
+
+  startup_task_launch(STARTUP_TASK_CONFIG, "config", startup_load_config, state);
+  startup_task_launch(STARTUP_TASK_PAM, "pam", startup_warm_pam, state);
+  startup_task_launch(STARTUP_TASK_FONT, "font", startup_load_font, state);
+  startup_task_launch_gated(STARTUP_TASK_THUMBNAIL, "thumbnail", startup_load_thumbnail, state);
+  startup_task_launch_gated(STARTUP_TASK_WALLPAPER, "wallpaper", startup_decode_wallpaper, state);
+  startup_task_launch_gated(STARTUP_TASK_BG_CACHE, "bg-cache", startup_build_bg_cache, state);
+}
+
+/*
+ * [bg] mode = "screenshot": copy the output while the desktop is still on it.
+ *
+ * This runs before the lock, so only a config the cache says is in
+ * screenshot mode is waited for; any other mode locks without waiting on the
+ * parse. A cache one edit behind is off by one lock at worst; without any
+ * cache blob (the very first lock) nothing is captured and the wallpaper
+ * stands in once.
+ */
+static void capture_screen_background(struct client_state* state)
+{
+  int cached_mode;
+  if (!config_cache_peek_bg_mode(&cached_mode) || cached_mode != BG_MODE_SCREENSHOT)
+  {
+    return;
+  }
+  if (startup_task_wait(STARTUP_TASK_CONFIG) != 0 || get_config()->bg_mode != BG_MODE_SCREENSHOT)
+  {
+    return;
+  }
+
+  int stage = startup_stage_begin("screencopy", false);
+  screencopy_capture_output(state);
+  startup_stage_end(stage);
+}
+
+// One round of wl_display_dispatch(), that also returns when a startup task
+// finishes so the caller can render the asset it produced, or a held key repeats.
+// poll() skips the negative fds of anything that is not there.
+static int dispatch_events(struct client_state* state)
 {
-  int loadConfig = load_config();
+  // poll() skips the negative fds, i.e. the ones that could not be created
+  struct wl_display* display = state->wl_display;
+  struct pollfd      fds[3]  = {
+    {.fd = wl_display_get_fd(display), .events = POLLIN},
+    {.fd = startup_wake_fd, .events = POLLIN},
+    {.fd = state->key_repeat.timer_fd, .events = POLLIN},
+  };
+
+  while (wl_display_prepare_read(display) != 0)
+  {
+    if (wl_display_dispatch_pending(display) < 0)
+    {
+      return -1;
+    }
+  }
+  wl_display_flush(display);
+
+  // Wake up when the UI changes by itself, and keep frames coming while something on screen
+  // animates unless the render thread paces those itself
+  int timeout = ui_next_change_ms(state);
+  if (!state->render.running && render_is_animating(state))
+  {
+    timeout = timeout < 0 ? 16 : ANVIL_MIN(timeout, 16);
+  }
+  if (poll(fds, 3, timeout) < 0)
+  {
+    wl_display_cancel_read(display);
+    return errno == EINTR ? 0 : -1;
+  }
+
+  if (fds[0].revents & POLLIN)
+  {
+    if (wl_display_read_events(display) < 0)
+    {
+      return -1;
+    }
+  }
+  else
+  {
+    wl_display_cancel_read(display);
+  }
+
+  if (startup_wake_fd >= 0 && (fds[1].revents & POLLIN))
+  {
+    startup_drain_wake();
+    keymap_loader_finish(state);
+  }
 
-  if (loadConfig == CONFIG_LOAD_SUCCESS)
+  if (state->key_repeat.timer_fd >= 0 && (fds[2].revents & POLLIN))
   {
-    state->global_config = *get_config();
+    key_repeat_dispatch(state);
   }
 
+  // Everything this read brought in is applied in one go, the caller renders once for all of it
+  int ret = wl_display_dispatch_pending(display);
+  input_queue_flush(state);
+  return ret;
+}
+
+static int initialize_configs(struct client_state* state)
+{
+  // Parsed on a worker while we were talking to the compositor
+  if (startup_task_wait(STARTUP_TASK_CONFIG) != 0)
+  {
+    return -1;
+  }
+
+  state->global_config = *get_config();
+
   const char* background_path =
     state->global_config.bg_path; // Get the background path from the loaded TOML config
   if (!background_path || background_path == NULL)
@@ -116,44 +342,111 @@ static int initialize_configs(struct client_state* state)
 }
 
 // Check if the shader file exists
-static void shader_exist(const char* relfilepath, const char* shader_runtime_dir)
+static bool shader_exist(const char* relfilepath, const char* shader_runtime_dir)
 {
   char* abs_filepath = ANVIL_SAFE_STR_JOIN(shader_runtime_dir, relfilepath);
-  FILE* file         = fopen(abs_filepath, "r");
+  FILE* file         = abs_filepath ? fopen(abs_filepath, "r") : NULL;
   if (!file)
   {
     log_message(LOG_LEVEL_ERROR, "[SHADERS] Failed to open shader file: %s", abs_filepath);
-    exit(EXIT_FAILURE);
-  }
-  else
-  {
-    log_message(LOG_LEVEL_TRACE, "[SHADERS] Preloaded shader '%s' successfully.", relfilepath);
+    free(abs_filepath);
+    return false;
   }
+  log_message(LOG_LEVEL_TRACE, "[SHADERS] Preloaded shader '%s' successfully.", relfilepath);
+  fclose(file);
+  free(abs_filepath);
+  return true;
 }
 
-// Initialize shaders by checking all of them
-static void initialize_shaders(const char* shader_runtime_dir)
+// Initialize shaders by checking all of them, false if any is missing
+static bool initialize_shaders(const char* shader_runtime_dir)
 {
+  bool found = true;
 // Iterate over all shader paths and check if they exist
 #define X(name, path)                                                 \
   log_message(LOG_LEVEL_DEBUG, "[SHADERS] Loading shader %s.", path); \
-  shader_exist(path, shader_runtime_dir);
+  found = shader_exist(path, shader_runtime_dir) && found;
 
   SHADER_PATHS // Expands to all shaders
 #undef X
 
+  if (found)
+  {
     log_message(LOG_LEVEL_INFO, "[SHADERS] Found and initialized all shaders.");
+  }
+  return found;
+}
+
+// Replace the placeholder with the lock screen, false if nothing can draw it
+static bool initialize_renderer(struct client_state* state)
+{
+  // Set the home directory
+  state->homeDir = ANVIL_GET_HOME_DIR();
+  log_message(LOG_LEVEL_TRACE, "Found @HOME at: %s", state->homeDir);
+
+  state->shaderRuntimeDir = find_shader_runtime(state->homeDir);
+
+  log_message(LOG_LEVEL_INFO, "[SHADERS] Setting shader runtime directory to: '%s'",
+              state->shaderRuntimeDir);
+
+  // Only the GL path needs the shaders, the software renderer draws the same screen without them
+  int  stage   = startup_stage_begin("shaders", false);
+  bool have_gl = state->shaderRuntimeDir && initialize_shaders(state->shaderRuntimeDir);
+  startup_stage_end(stage);
+  if (!have_gl)
+  {
+    log_message(LOG_LEVEL_ERROR, "[SHADERS] Could not find shaders runtime, skipping EGL.");
+  }
+
+  // EGL lock screen, assets stream in as they finish.
+  // Without a usable GPU the same lock screen is drawn on the CPU instead.
+  if (!(have_gl && init_egl(state)) && !soft_render_init(state))
+  {
+    return false;
+  }
+
+  // Later frames are drawn on their own thread, input only hands it snapshots
+  render_thread_start(state);
+  return true;
 }
 
 static void cleanup(struct client_state* state)
 {
-  unlock_and_destroy_session_lock(state);
-  eglDestroySurface(state->egl_display, state->egl_surface);
-  eglDestroyContext(state->egl_display, state->egl_context);
-  eglTerminate(state->egl_display);
+  // The render thread may still be uploading what the workers produced
+  render_thread_stop(state);
+  frame_pacing_release(state);
+  key_repeat_release(state);
+
+  // Workers may still be decoding if we bail out early
+  startup_join_all();
+  free_decoded_image(&state->wallpaper);
+  ANVIL_SAFE_FREE(state->wallpaper_mips.data);
+  free_decoded_image(&state->thumbnail);
+  ANVIL_SAFE_FREE(state->wallpaper_etc.data);
+  screencopy_release(&state->screenshot);
+
+  // Only a successful attempt unlocks; any other exit leaves the compositor holding the lock
+  if (state->pam.auth_state.auth_success)
+  {
+    unlock_and_destroy_session_lock(state);
+  }
+  else if (state->session_lock.ext_session_lock)
+  {
+    log_message(LOG_LEVEL_WARN, "[LOCK] Exiting without unlocking, the session stays locked.");
+  }
+  if (state->egl_display != EGL_NO_DISPLAY)
+  {
+    eglDestroySurface(state->egl_display, state->egl_surface);
+    eglDestroyContext(state->egl_display, state->egl_context);
+    eglTerminate(state->egl_display);
+  }
+  soft_render_destroy(state);
   wl_display_roundtrip(state->wl_display);
   wl_display_disconnect(state->wl_display);
 
+  text_atlas_free(&glyph_atlas);
+  pam_session_end(PAM_ABORT); // still open only if we never unlocked
+  secure_arena_destroy(&secure_arena);
   FT_Done_Face(ft_face);
   FT_Done_FreeType(ft_library);
 
@@ -25,15 +25,21 @@
 
 */
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE /* MAP_ANONYMOUS */
 #include "toml.h"
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 static void *(*ppmalloc)(size_t) = malloc;
 static void (*ppfree)(void *) = free;
@@ -320,6 +326,11 @@ struct toml_table_t {
   /* tables in the table */
   int ntab;
   toml_table_t **tab;
+
+  /* root only: the file mapping owned by toml_parse_mmap(). raw values
+   * anywhere in the tree are spans into it and must not be freed. */
+  const char *map;
+  size_t mapsz;
 };
 
 static inline void xfree(const void *x) {
@@ -356,6 +367,7 @@ struct context_t {
   char *stop;
   char *errbuf;
   int errbufsz;
+  int borrow; /* raw values are spans into start[], not copies */
 
   token_t tok;
   toml_table_t *root;
@@ -1031,7 +1043,9 @@ static int parse_array(context_t *ctx, toml_array_t *arr) {
       if (!newval)
         return e_outofmemory(ctx, FLINE);
 
-      if (!(newval->val = STRNDUP(val, vlen)))
+      if (ctx->borrow)
+        newval->val = val;
+      else if (!(newval->val = STRNDUP(val, vlen)))
         return e_outofmemory(ctx, FLINE);
 
       newval->valtype = valtype(newval->val);
@@ -1155,7 +1169,9 @@ static int parse_keyval(context_t *ctx, toml_table_t *tab) {
     token_t val = ctx->tok;
 
     assert(keyval->val == 0);
-    if (!(keyval->val = STRNDUP(val.ptr, val.len)))
+    if (ctx->borrow)
+      keyval->val = val.ptr;
+    else if (!(keyval->val = STRNDUP(val.ptr, val.len)))
       return e_outofmemory(ctx, FLINE);
 
     if (next_token(ctx, 1))
@@ -1399,7 +1415,14 @@ static int parse_select(context_t *ctx) {
   return 0;
 }
 
-toml_table_t *toml_parse(char *conf, char *errbuf, int errbufsz) {
+static void xfree_tab(toml_table_t *p, int borrowed);
+
+/* Parse conf[0..stop). conf must be NUL terminated at stop. If borrow is
+ * set, raw values are left pointing into conf instead of being copied, so
+ * conf must outlive the returned table.
+ */
+static toml_table_t *parse_buffer(char *conf, char *stop, int borrow,
+                                  char *errbuf, int errbufsz) {
   context_t ctx;
 
   // clear errbuf
@@ -1411,9 +1434,10 @@ toml_table_t *toml_parse(char *conf, char *errbuf, int errbufsz) {
   // init context
   memset(&ctx, 0, sizeof(ctx));
   ctx.start = conf;
-  ctx.stop = ctx.start + strlen(conf);
+  ctx.stop = stop;
   ctx.errbuf = errbuf;
   ctx.errbufsz = errbufsz;
+  ctx.borrow = borrow;
 
   // start with an artificial newline of length 0
   ctx.tok.tok = NEWLINE;
@@ -1473,10 +1497,14 @@ fail:
   // Something bad has happened. Free resources and return error.
   for (int i = 0; i < ctx.tpath.top; i++)
     xfree(ctx.tpath.key[i]);
-  toml_free(ctx.root);
+  xfree_tab(ctx.root, borrow);
   return 0;
 }
 
+toml_table_t *toml_parse(char *conf, char *errbuf, int errbufsz) {
+  return parse_buffer(conf, conf + strlen(conf), 0, errbuf, errbufsz);
+}
+
 toml_table_t *toml_parse_file(FILE *fp, char *errbuf, int errbufsz) {
   int bufsz = 0;
   char *buf = 0;
@@ -1528,17 +1556,70 @@ toml_table_t *toml_parse_file(FILE *fp, char *errbuf, int errbufsz) {
   return ret;
 }
 
-static void xfree_kval(toml_keyval_t *p) {
+toml_table_t *toml_parse_mmap(const char *path, char *errbuf, int errbufsz) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    snprintf(errbuf, errbufsz, "%s", strerror(errno));
+    return 0;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st)) {
+    snprintf(errbuf, errbufsz, "%s", strerror(errno));
+    close(fd);
+    return 0;
+  }
+  if (st.st_size >= INT_MAX) {
+    snprintf(errbuf, errbufsz, "file too large");
+    close(fd);
+    return 0;
+  }
+
+  /* Reserve at least one zero-filled page past EOF and map the file over
+   * the front of it. The tokenizer relies on a NUL terminator, and this
+   * provides one even when the file size is a multiple of the page size.
+   */
+  size_t len = st.st_size;
+  size_t pgsz = sysconf(_SC_PAGESIZE);
+  size_t mapsz = (len / pgsz + 1) * pgsz;
+  char *map =
+      mmap(0, mapsz, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) {
+    snprintf(errbuf, errbufsz, "%s", strerror(errno));
+    close(fd);
+    return 0;
+  }
+  if (len && mmap(map, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) ==
+                 MAP_FAILED) {
+    snprintf(errbuf, errbufsz, "%s", strerror(errno));
+    munmap(map, mapsz);
+    close(fd);
+    return 0;
+  }
+  close(fd);
+
+  /* parse in place; raw values stay spans into the mapping */
+  toml_table_t *ret =
+      parse_buffer(map, map + strnlen(map, len), 1, errbuf, errbufsz);
+  if (!ret) {
+    munmap(map, mapsz);
+    return 0;
+  }
+  ret->map = map;
+  ret->mapsz = mapsz;
+  return ret;
+}
+
+static void xfree_kval(toml_keyval_t *p, int borrowed) {
   if (!p)
     return;
   xfree(p->key);
-  xfree(p->val);
+  if (!borrowed)
+    xfree(p->val);
   xfree(p);
 }
 
-static void xfree_tab(toml_table_t *p);
-
-static void xfree_arr(toml_array_t *p) {
+static void xfree_arr(toml_array_t *p, int borrowed) {
   if (!p)
     return;
 
@@ -1546,18 +1627,19 @@ static void xfree_arr(toml_array_t *p) {
   const int n = p->nitem;
   for (int i = 0; i < n; i++) {
     toml_arritem_t *a = &p->item[i];
-    if (a->val)
-      xfree(a->val);
-    else if (a->arr)
-      xfree_arr(a->arr);
+    if (a->val) {
+      if (!borrowed)
+        xfree(a->val);
+    } else if (a->arr)
+      xfree_arr(a->arr, borrowed);
     else if (a->tab)
-      xfree_tab(a->tab);
+      xfree_tab(a->tab, borrowed);
   }
   xfree(p->item);
   xfree(p);
 }
 
-static void xfree_tab(toml_table_t *p) {
+static void xfree_tab(toml_table_t *p, int borrowed) {
   int i;
 
   if (!p)
@@ -1566,21 +1648,30 @@ static void xfree_tab(toml_table_t *p) {
   xfree(p->key);
 
   for (i = 0; i < p->nkval; i++)
-    xfree_kval(p->kval[i]);
+    xfree_kval(p->kval[i], borrowed);
   xfree(p->kval);
 
   for (i = 0; i < p->narr; i++)
-    xfree_arr(p->arr[i]);
+    xfree_arr(p->arr[i], borrowed);
   xfree(p->arr);
 
   for (i = 0; i < p->ntab; i++)
-    xfree_tab(p->tab[i]);
+    xfree_tab(p->tab[i], borrowed);
   xfree(p->tab);
 
   xfree(p);
 }
 
-void toml_free(toml_table_t *tab) { xfree_tab(tab); }
+void toml_free(toml_table_t *tab) {
+  if (!tab)
+    return;
+
+  const char *map = tab->map;
+  size_t mapsz = tab->mapsz;
+  xfree_tab(tab, map != 0);
+  if (map)
+    munmap((void *)(intptr_t)map, mapsz);
+}
 
 static void set_token(context_t *ctx, tokentype_t tok, int lineno, char *ptr,
                       int len) {
@@ -1963,11 +2054,84 @@ toml_table_t *toml_table_at(const toml_array_t *arr, int idx) {
 
 static int parse_millisec(const char *p, const char **endp);
 
+/* Return the length of the raw value at src. Raw values from toml_parse()
+ * are NUL terminated copies, but those from toml_parse_mmap() are spans
+ * that run on into the rest of the document, so rescan the token using the
+ * same rules as scan_string() to find where it ends.
+ */
+static int raw_len(const char *src) {
+  const char *p = src;
+
+  if (0 == strncmp(p, "'''", 3) || 0 == strncmp(p, "\"\"\"", 3)) {
+    const char delim[4] = {p[0], p[0], p[0], 0};
+    const char *q = p + 3;
+    for (;;) {
+      if (0 == (q = strstr(q, delim)))
+        return strlen(src);
+      if (p[0] == '"' && q[-1] == '\\') {
+        q++;
+        continue;
+      }
+      while (q[3] == p[0])
+        q++;
+      return q + 3 - src;
+    }
+  }
+
+  if ('\'' == *p) {
+    for (p++; *p && *p != '\n' && *p != '\''; p++)
+      ;
+    return (*p == '\'' ? p + 1 : p) - src;
+  }
+
+  if ('"' == *p) {
+    for (p++; *p && *p != '\n' && *p != '"'; p++) {
+      if (*p == '\\' && p[1])
+        p++;
+    }
+    return (*p == '"' ? p + 1 : p) - src;
+  }
+
+  if (0 == scan_date(p, 0, 0, 0) || 0 == scan_time(p, 0, 0, 0)) {
+    p += strspn(p, "0123456789.:+-Tt Zz");
+    for (; p > src && p[-1] == ' '; p--)
+      ;
+    return p - src;
+  }
+
+  for (; *p; p++) {
+    int ch = *p;
+    if (('A' <= ch && ch <= 'Z') || ('a' <= ch && ch <= 'z'))
+      continue;
+    if (strchr("0123456789+-_.", ch))
+      continue;
+    break;
+  }
+  return p - src;
+}
+
+/* Return src as a NUL terminated string, copying it into buf if it is a
+ * span. Return 0 if it does not fit.
+ */
+static const char *raw_cstr(toml_raw_t src, char *buf, int bufsz) {
+  int len = raw_len(src);
+  if (src[len] == 0)
+    return src;
+  if (len >= bufsz)
+    return 0;
+  memcpy(buf, src, len);
+  buf[len] = 0;
+  return buf;
+}
+
 int toml_rtots(toml_raw_t src_, toml_timestamp_t *ret) {
   if (!src_)
     return -1;
 
-  const char *p = src_;
+  char tmp[64];
+  const char *p = raw_cstr(src_, tmp, sizeof(tmp));
+  if (!p)
+    return -1;
   int must_parse_time = 0;
 
   memset(ret, 0, sizeof(*ret));
@@ -2057,12 +2221,13 @@ int toml_rtob(toml_raw_t src, int *ret_) {
     return -1;
   int dummy;
   int *ret = ret_ ? ret_ : &dummy;
+  int len = raw_len(src);
 
-  if (0 == strcmp(src, "true")) {
+  if (len == 4 && 0 == strncmp(src, "true", 4)) {
     *ret = 1;
     return 0;
   }
-  if (0 == strcmp(src, "false")) {
+  if (len == 5 && 0 == strncmp(src, "false", 5)) {
     *ret = 0;
     return 0;
   }
@@ -2077,7 +2242,10 @@ int toml_rtoi(toml_raw_t src, int64_t *ret_) {
   char buf[100];
   char *p = buf;
   char *q = p + sizeof(buf);
-  const char *s = src;
+  char tmp[100];
+  const char *s = raw_cstr(src, tmp, sizeof(tmp));
+  if (!s)
+    return -1;
   int base = 0;
   int64_t dummy;
   int64_t *ret = ret_ ? ret_ : &dummy;
@@ -2149,7 +2317,10 @@ int toml_rtod_ex(toml_raw_t src, double *ret_, char *buf, int buflen) {
 
   char *p = buf;
   char *q = p + buflen;
-  const char *s = src;
+  char tmp[100];
+  const char *s = raw_cstr(src, tmp, sizeof(tmp));
+  if (!s)
+    return -1;
   double dummy;
   double *ret = ret_ ? ret_ : &dummy;
 
@@ -2218,7 +2389,7 @@ int toml_rtos(toml_raw_t src, char **ret) {
 
   // for strings, first char must be a s-quote or d-quote
   int qchar = src[0];
-  int srclen = strlen(src);
+  int srclen = raw_len(src);
   if (!(qchar == '\'' || qchar == '"')) {
     return -1;
   }
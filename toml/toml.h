@@ -55,9 +55,19 @@ TOML_EXTERN toml_table_t *toml_parse_file(FILE *fp, char *errbuf, int errbufsz);
 TOML_EXTERN toml_table_t *toml_parse(char *conf, /* NUL terminated, please. */
                                      char *errbuf, int errbufsz);
 
-/* Free the table returned by toml_parse() or toml_parse_file(). Once
- * this function is called, any handles accessed through this tab
- * directly or indirectly are no longer valid.
+/* Parse a file by mapping it read-only instead of reading it into memory.
+ * Raw values in the returned table are spans into the mapping and are only
+ * unescaped when converted with toml_rto*() or the toml_*_in/at accessors.
+ * Return a table on success, or 0 otherwise.
+ * Caller must toml_free(the-return-value) after use; this also unmaps the
+ * file, so raw values must not be used past that point.
+ */
+TOML_EXTERN toml_table_t *toml_parse_mmap(const char *path, char *errbuf,
+                                          int errbufsz);
+
+/* Free the table returned by toml_parse(), toml_parse_file() or
+ * toml_parse_mmap(). Once this function is called, any handles accessed
+ * through this tab directly or indirectly are no longer valid.
  */
 TOML_EXTERN void toml_free(toml_table_t *tab);
 